@@ -1,5 +1,33 @@
 
 WARNING_SUP="-Wno-unused-function -Wno-unused-variable -Wno-missing-braces"
-LIBS="-lglfw -lGLU -lGL -lm"
-FLAGS="-O0 -g -Wall -fno-math-errno -march=native"
+LIBS="-lglfw -lGLU -lGL -lm -lpthread"
+FLAGS="-O0 -g -Wall -fno-math-errno -ffp-contract=off"
 clang ssbump.c $FLAGS -o ssbump.exe $LIBS $WARNING_SUP 
+clang sinm_batch.c $FLAGS -o sinm_batch.exe -lm -lpthread $WARNING_SUP
+
+#NOTE: ./build.sh bench times the normal map pipelines on every instruction set, extra
+#arguments go to sinm_bench
+if [ "$1" = "bench" ]; then
+    shift
+    clang sinm_bench.c -O2 -fno-math-errno -ffp-contract=off -o sinm_bench.exe -lm -lpthread $WARNING_SUP && ./sinm_bench.exe "$@"
+fi
+
+#NOTE: ./build.sh check runs sinm_batch over truncated and garbage files. Every one of
+#them has to come back as failed(exit code 2), a hang or a crash fails the check.
+if [ "$1" = "check" ]; then
+    CHECK_DIR=$(mktemp -d)
+    mkdir "$CHECK_DIR/in"
+    printf '\211PNG\r\n\032\nxxxx' > "$CHECK_DIR/in/truncated.png"
+    printf '\211PNG\r\n\032\n\000\000\000\rIHDR\000\000\000\020\000\000\000\020\020\000\000\000\000\000\000\000\000' > "$CHECK_DIR/in/truncated16.png"
+    printf 'GIF89a\020\000\020\000\000\000\000' > "$CHECK_DIR/in/truncated.gif"
+    head -c 4096 /dev/zero | tr '\000' 'x' > "$CHECK_DIR/in/garbage.jpg"
+    : > "$CHECK_DIR/in/empty.tga"
+    timeout 60 ./sinm_batch.exe "$CHECK_DIR/in" "$CHECK_DIR/out"
+    CHECK_STATUS=$?
+    rm -rf "$CHECK_DIR"
+    if [ $CHECK_STATUS -ne 2 ]; then
+        echo "check failed, sinm_batch exit code $CHECK_STATUS"
+        exit 1
+    fi
+    echo "check passed"
+fi
@@ -202,6 +202,63 @@ create_texture(const u32 *data, i32 w, i32 h, b32 useLinearColor)
 
     return result;
 }
+
+//Same as create_texture but uploads a prebuilt mip chain(level after level, see
+//sinm_mip_chain) instead of letting the driver box filter one.
+internal GLuint
+create_texture_mips(const u32 *chain, i32 w, i32 h, i32 levels, b32 useLinearColor)
+{
+    GLuint result;
+    glGenTextures(1, &result);
+    glBindTexture(GL_TEXTURE_2D, result);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    assert(!report_errors());
+
+    GLint format = (useLinearColor) ? GL_RGBA : GL_SRGB_ALPHA;
+    for (i32 level = 0; level < levels; ++level) {
+        glTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, chain);
+        assert(!report_errors());
+        chain += w * h;
+        w = (w > 1) ? w / 2 : 1;
+        h = (h > 1) ? h / 2 : 1;
+    }
+
+    return result;
+}
+
+//Uploads a block compressed chain from sinm_bc1/bc5/bc7_compress, one level after another.
+//"format" is the GL_COMPRESSED_* enum matching the encoder, the DXT1 formats use 8 bytes
+//per block and the rest 16.
+internal GLuint
+create_texture_compressed(const u8 *blocks, i32 w, i32 h, i32 levels, GLenum format)
+{
+    GLuint result;
+    glGenTextures(1, &result);
+    glBindTexture(GL_TEXTURE_2D, result);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (levels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    assert(!report_errors());
+
+    b32 isDxt1 = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT);
+    i32 blockSize = (isDxt1) ? 8 : 16;
+    for (i32 level = 0; level < levels; ++level) {
+        i32 size = ((w + 3) / 4) * ((h + 3) / 4) * blockSize;
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, size, blocks);
+        assert(!report_errors());
+        blocks += size;
+        w = (w > 1) ? w / 2 : 1;
+        h = (h > 1) ? h / 2 : 1;
+    }
+
+    return result;
+}
 static void 
 error_callback(int error, const char* description)
 {
@@ -27,7 +27,12 @@ float saturate(float x){
 
 void main() {
 
-    vec3 normal = normalize(texture(normalMap, UV*2.0f).rgb * 2.0f + 1.0f);
+    //NOTE: the normal map is uploaded as BC5 which only keeps x and y(encoded as
+    //(1 + v) * 127 / 255), z is rebuilt from the unit length
+    vec3 normal;
+    normal.xy = texture(normalMap, UV*2.0f).rg * (255.0f / 127.0f) - 1.0f;
+    normal.z = sqrt(saturate(1.0f - dot(normal.xy, normal.xy)));
+    normal = normalize(normal);
     normal = normalize((bumpBasis[0] * normal.x + bumpBasis[1] * normal.y + bumpBasis[2] * normal.z));
     normal.y = -normal.y;
 
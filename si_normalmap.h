@@ -1,5 +1,6 @@
 /* LICENSE AT END OF FILE */
 
+#ifndef SINM__KERNEL_PASS
 /***************************************************************************
  * Sir Irk's normal map generator
  *
@@ -15,6 +16,20 @@
  *  #define SI_NORMALMAP_STATIC for static defintions(no extern functions)
  *  #define SI_NORMALMAP_GPU to enable opengl gpu usage. Requires an opengl
  *   context.
+ *  #define SINM_NO_THREADS to disable the worker thread pool. The *_mt
+ *   functions then run on the calling thread.
+ *
+ *  The *_mt functions share one pool of worker threads(pthreads, or win32 threads on
+ *   windows). Only one call can use it at a time: a *_mt call made while another one
+ *   is running, from another thread or from inside a callback, runs on its calling
+ *   thread instead of waiting. The result is the same, it's just not parallel.
+ *  Include si_memory.h before this file to get the *_arena functions that take
+ *   their memory from a si_memory_arena instead of malloc.
+ *
+ *  The simd kernels are built for SSE4.1, AVX2 and AVX-512(F and BW) and picked at
+ *  runtime, no -m flags are needed. SSE4.1 is the minimum. Every level produces the same
+ *  pixels as long as the compiler doesn't fuse multiplies and adds(gcc defaults to
+ *  -ffp-contract=fast which does for AVX-512, use -ffp-contract=off).
  ***************************************************************************/
 
 #include <assert.h>
@@ -40,6 +55,19 @@
 #define sinm__inline __forceinline
 #endif
 
+//NOTE: for small simd helpers that must be inlined into the kernels even at -O0/-O2
+#ifdef _MSC_VER
+#define sinm__forceinline __forceinline
+#else
+#define sinm__forceinline inline __attribute__((always_inline))
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define sinm__unroll _Pragma("GCC unroll 16")
+#else
+#define sinm__unroll
+#endif
+
 #ifdef _MSC_VER
 #define sinm__aligned_var(type, bytes) __declspec(align(bytes)) type
 #else
@@ -56,6 +84,69 @@ typedef enum {
     sinm_greyscale_count, //Used for iterating, not a valid option
 } sinm_greyscale_type;
 
+typedef enum {
+    sinm_gradient_sobel3x3, //Default
+    sinm_gradient_sobel5x5, //Smoother, less sensitive to noise
+    sinm_gradient_scharr,   //3x3 with better rotational symmetry than sobel
+    sinm_gradient_prewitt,  //3x3 without the center weighting
+    sinm_gradient_central,  //Plain central difference, sharpest and noisiest
+    sinm_gradient_count,    //Used for iterating, not a valid option
+} sinm_gradient_type;
+
+typedef enum {
+    sinm_blur_box,       //Default, three box blurs in a row
+    sinm_blur_recursive, //Young-van Vliet recursive gaussian, same cost for any radius
+    sinm_blur_count,     //Used for iterating, not a valid option
+} sinm_blur_type;
+
+typedef enum {
+    sinm_pipeline_float,   //Default, box blur averages are computed with floats
+    sinm_pipeline_fixed16, //Box blur and gradients on 16 bit integer lanes, see sinm_set_pipeline
+    sinm_pipeline_count,   //Used for iterating, not a valid option
+} sinm_pipeline_type;
+
+typedef enum {
+    sinm_simd_auto, //Best instruction set the cpu supports
+    sinm_simd_sse41,
+    sinm_simd_avx2,
+    sinm_simd_avx512,
+} sinm_simd_level;
+
+typedef enum {
+    sinm_mip_normal_map, //Unit normals, renormalized on every level
+    sinm_mip_ssbump_map, //ssbump weights, keep the average length of their footprint
+    sinm_mip_color_map,  //Colors(albedo), averaged in roughly linear light, alpha is kept
+} sinm_mip_type;
+
+typedef enum {
+    sinm_bc_fast,     //Endpoints at the ends of the block's range(BC5) or principal axis(BC1, BC7)
+    sinm_bc_balanced, //Endpoints refit to the picked indices
+    sinm_bc_high,     //BC5 also tries the endpoints around the refit ones, BC1 and BC7 refit more often
+} sinm_bc_quality;
+
+typedef enum {
+    sinm_blend_linear,   //Weighted average of the normals
+    sinm_blend_udn,      //Adds the slopes of every layer to the base, keeps its z. Cheapest, flattens a bit
+    sinm_blend_whiteout, //Like udn but multiplies the z values, keeps more of the detail
+    sinm_blend_rnm,      //Reoriented normal mapping, rotates every layer onto the ones below it
+    sinm_blend_count,    //Used for iterating, not a valid option
+} sinm_blend_type;
+
+typedef struct {
+    int32_t x, y, w, h;
+} sinm_rect;
+
+typedef struct {
+    sinm_gradient_type gradient; //see sinm_set_gradient
+    sinm_blur_type blur;         //see sinm_set_blur
+    sinm_pipeline_type pipeline; //see sinm_set_pipeline
+} sinm_options;
+
+typedef struct {
+    float blurRadius; //Standard deviation of the blur like in sinm_normal_map
+    float weight;     //How much the gradients of this octave count
+} sinm_octave;
+
 #ifdef SI_NORMALMAP_GPU
 typedef struct {
     uint32_t fbo, buffer;
@@ -78,29 +169,306 @@ SINM_DEF uint32_t* sinm_normal_map(const uint32_t* in, int32_t w, int32_t h, flo
 //  "greyscaleType" specifies the conversion method from color to greyscale before
 //   generating the normal map. This step is skipped when using sinm_greyscale_none.
 
-#else //SI_NORMALMAP_IMPLEMENTATION
+SINM_DEF int sinm_normal_map_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY);
+//Same as sinm_normal_map but writes the result to "out" which must hold w*h pixels.
+//Returns 0 if the scratch memory could not be allocated.
+
+SINM_DEF int sinm_normal_map_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_buffer_mt(threadCount 1 is sinm_normal_map_buffer) with the
+//settings in "options" instead of the global ones, NULL uses sinm_default_options. The
+//other *_ex functions work the same way. Calls with different options can run at the
+//same time.
+
+SINM_DEF size_t sinm_normal_map_scratch_size(int32_t w, int32_t h, float blurRadius);
+//Bytes of scratch memory sinm_normal_map_buffer_arena takes from the arena(and gives
+//back) for a w * h image with the current sinm_set_blur mode, including up to 63 bytes
+//to align it.
+
+SINM_DEF size_t sinm_normal_map_scratch_size_ex(int32_t w, int32_t h, float blurRadius, const sinm_options* options);
+//Same as sinm_normal_map_scratch_size for sinm_normal_map_buffer_arena_ex with "options".
+
+#ifdef SI_MEMORY_HEADER_GAURD
+SINM_DEF int sinm_normal_map_buffer_arena(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, si_memory_arena* arena);
+//Same as sinm_normal_map_buffer but the scratch memory is pushed onto "arena" and popped
+//again before returning, nothing is allocated. Calls that reuse the same arena touch the
+//same pages every time. Returns 0 if fewer than sinm_normal_map_scratch_size bytes are
+//left in the arena.
+
+SINM_DEF uint32_t* sinm_normal_map_arena(const uint32_t* in, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, si_memory_arena* arena);
+//Same as sinm_normal_map but the result stays on "arena", 64 byte aligned, with the
+//scratch memory above it only while the function runs. Needs w * h * 4 + 63 bytes plus
+//sinm_normal_map_scratch_size, returns NULL and leaves the arena alone if they don't fit.
+
+SINM_DEF int sinm_normal_map_buffer_arena_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, si_memory_arena* arena, const sinm_options* options);
+//Same as sinm_normal_map_buffer_arena with "options", see sinm_normal_map_buffer_ex.
+#endif
 
-#include <x86intrin.h>
+SINM_DEF int sinm_normal_map_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount);
+//Multithreaded version of sinm_normal_map_buffer. The image is split into row
+//bands(with enough extra rows to cover the blur and sobel kernels) that are
+//processed on a pool of worker threads. The result is identical to the single
+//threaded version.
+//  "threadCount" is the number of threads to use. 0 uses one per logical core. If the
+//   pool is busy with another *_mt call it runs on the calling thread(see top of file).
+
+SINM_DEF int sinm_normal_map_buffer_streaming(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY);
+//Same result as sinm_normal_map_buffer but greyscale, blur and sobel are fused and
+//run a row at a time over small ring buffers instead of making full image passes.
+//Extra memory is a few rows per blur pass plus the running column sums(roughly
+//w * (6 * blurRadius + 24) bytes) instead of full size intermediate images.
+
+SINM_DEF int sinm_normal_map_buffer_streaming_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_options* options);
+//Same as sinm_normal_map_buffer_streaming with "options", see sinm_normal_map_buffer_ex.
+
+SINM_DEF int sinm_normal_map_tiled(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, size_t memoryBudget, int32_t threadCount);
+//Out of core version of sinm_normal_map_buffer_mt for images too big for memory, such as
+//64k x 64k terrain. "in" and "out" are meant to be memory mapped files: the image is
+//processed in tiles(with halo pixels around them for the blur and sobel kernels) that
+//each only read and write their own part, rows are indexed with 64 bits.
+//  "memoryBudget" is how many bytes of scratch memory all threads together may use.
+//   Tiles are made narrower to fit, more memory means less halo work. Past roughly
+//   threadCount * w * (6 * blurRadius + 28) bytes it no longer matters.
+//The result is identical to sinm_normal_map_buffer. Returns 0 if the budget is too small
+//for a single tile or the scratch memory could not be allocated.
+
+SINM_DEF int sinm_normal_map_tiled_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, size_t memoryBudget, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_tiled with "options", see sinm_normal_map_buffer_ex.
+
+SINM_DEF int sinm_normal_map_update(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_rect* dirty, int32_t dirtyCount, int32_t threadCount);
+//Brings "out", a normal map of "in" made with the same settings, up to date after the
+//pixels of "in" inside the "dirty" rectangles changed, such as brush strokes in a paint
+//tool. Only the normals the changes can reach(the rectangles grown by the blur and
+//gradient kernels, see sinm_normal_map_tiled) are made again and they are identical to
+//a full sinm_normal_map_buffer. Rectangles may overlap and stick out of the image.
+//sinm_blur_recursive reaches every pixel of a row and column so it redoes the whole
+//image. Returns 0 if the scratch memory could not be allocated.
+
+SINM_DEF int sinm_normal_map_update_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_rect* dirty, int32_t dirtyCount, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_update with "options", they have to match the ones "out" was
+//made with.
+
+SINM_DEF int sinm_normal_map_masked_buffer(const uint32_t* in, const uint32_t* mask, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY);
+//Same as sinm_normal_map_buffer but the blur radius changes from pixel to pixel. "mask" is
+//a w * h image whose red channel scales "blurRadius", 0 keeps the pixel sharp and 255
+//blurs it with the full radius. Every pixel is the average of a box around it with the
+//same variance as the gaussian(a single box, not three), looked up in a summed area
+//table so any radius costs the same. Boxes are clipped at the edges of the image and
+//their radius is capped at 1023. Uses w * h * 6 bytes of scratch memory.
+//Returns 0 if the scratch memory could not be allocated.
+
+SINM_DEF int sinm_normal_map_masked_buffer_mt(const uint32_t* in, const uint32_t* mask, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount);
+//Multithreaded version of sinm_normal_map_masked_buffer, the result is identical.
+
+SINM_DEF int sinm_normal_map_masked_buffer_ex(const uint32_t* in, const uint32_t* mask, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_masked_buffer_mt with "options", see sinm_normal_map_buffer_ex.
+
+SINM_DEF int sinm_normal_map_multiscale_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, const sinm_octave* octaves, int32_t octaveCount, sinm_greyscale_type greyscaleType, int flipY);
+//Normal map with the detail of several blur radii at once, like a small radius for the
+//surface detail and a large one for the overall shape. The heights are blurred step by
+//step from the smallest radius to the largest, gaussians add up so every level only
+//blurs by the difference to the one before it. The gradients of every level are scaled
+//by "scale" times the weight of its octave and added up before they are normalized. A
+//single octave with weight 1 is exactly sinm_normal_map_buffer. Uses up to w * h bytes
+//of scratch memory per octave plus 2 * w * h, returns 0 if it could not be allocated.
+
+SINM_DEF int sinm_normal_map_multiscale_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, const sinm_octave* octaves, int32_t octaveCount, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount);
+//Multithreaded version of sinm_normal_map_multiscale_buffer, the result is identical.
+
+SINM_DEF int sinm_normal_map_multiscale_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, const sinm_octave* octaves, int32_t octaveCount, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_multiscale_buffer_mt with "options", see sinm_normal_map_buffer_ex.
+
+SINM_DEF int sinm_normal_map_u16_buffer(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY);
+//Same as sinm_normal_map_buffer but "in" is a single channel 16 bit height field,
+//such as the result of stbi_load_16 with 1 channel. Blur and sobel run on the 16 bit
+//heights directly. "scale" means the same as for 8 bit input(65535 is as high as 255).
+
+SINM_DEF int sinm_normal_map_u16_buffer_mt(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount);
+//Multithreaded version of sinm_normal_map_u16_buffer, the result is identical. Bands of
+//rows are blurred with their halo like sinm_normal_map_buffer_mt.
+
+SINM_DEF int sinm_normal_map_u16_buffer_ex(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_u16_buffer_mt with "options", see sinm_normal_map_buffer_ex.
+
+SINM_DEF int sinm_normal_map_float_buffer(const float* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY);
+//Same as sinm_normal_map_u16_buffer but heights are floats in [0, 1]. They are
+//quantized to 16 bits, values outside the range are clamped.
+
+SINM_DEF int sinm_normal_map_float_buffer_mt(const float* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount);
+//Multithreaded version of sinm_normal_map_float_buffer, the result is identical.
+
+SINM_DEF int sinm_normal_map_float_buffer_ex(const float* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount, const sinm_options* options);
+//Same as sinm_normal_map_float_buffer_mt with "options", see sinm_normal_map_buffer_ex.
+
+SINM_DEF uint32_t* sinm_ssbump_map(const uint32_t* in, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY);
+//Converts input buffer to a self shadowed bump map(ssbump) and returns a pointer to it.
+//r, g and b hold the light reaching the surface from the three radiosity basis
+//directions(bumpBasis in shaders/ssbump_phong_forward.frag): the normal projected on
+//the basis vector times the part of the sky around it that the height field doesn't
+//block. A flat unshadowed surface is 147(1 / sqrt(3)) in every channel.
+//  "depth" is the height of a white(255) pixel, in texels
+//  "blurRadius" and "greyscaleType" work the same as for sinm_normal_map
+//  "shadowLength" is how far(in texels) to look for occluders. Past 64 texels the
+//   cost no longer grows with it.
+//The height field is treated as tiling. x follows the columns and y the rows,
+//"flipY" flips y.
+
+SINM_DEF int sinm_ssbump_map_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY);
+//Same as sinm_ssbump_map but writes the result to "out" which must hold w*h pixels.
+//Returns 0 if the scratch memory could not be allocated.
+
+SINM_DEF int sinm_ssbump_map_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount);
+//Multithreaded version of sinm_ssbump_map_buffer. Rows are split into bands that are
+//processed on the worker threads, the result is identical.
+//  "threadCount" is the number of threads to use. 0 uses one per logical core.
+
+SINM_DEF int sinm_ssbump_map_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options);
+//Same as sinm_ssbump_map_buffer_mt with "options". Only the blur settings apply, the
+//gradients are always sobel 3x3.
+
+SINM_DEF uint32_t* sinm_ambient_occlusion(const uint32_t* in, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType);
+//Bakes ambient occlusion from the same height input as sinm_normal_map and returns a
+//pointer to it. The result is grey, white where nothing blocks the sky.
+//  "depth" is the height of a white(255) pixel, in texels
+//  "blurRadius" and "greyscaleType" work the same as for sinm_normal_map
+//  "radius" is how far(in texels) to look for occluders. Past 64 texels the cost no
+//   longer grows with it.
+//  "directions" is the number of directions around every texel to look in. More is
+//   smoother but slower, 8 to 16 is usually enough.
+//The height field is treated as tiling.
+
+SINM_DEF int sinm_ambient_occlusion_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType);
+//Same as sinm_ambient_occlusion but writes the result to "out" which must hold w*h pixels.
+//Returns 0 if the scratch memory could not be allocated.
+
+SINM_DEF int sinm_ambient_occlusion_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType, int32_t threadCount);
+//Multithreaded version of sinm_ambient_occlusion_buffer, the result is identical.
+//  "threadCount" is the number of threads to use. 0 uses one per logical core.
+
+SINM_DEF int sinm_ambient_occlusion_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType, int32_t threadCount, const sinm_options* options);
+//Same as sinm_ambient_occlusion_buffer_mt with "options", only the blur settings apply.
+
+SINM_DEF void sinm_composite_layers(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, int32_t w, int32_t h, sinm_blend_type type);
+//Blends "count" normal maps into "out", in[0] is the base and every other layer is
+//blended on top of the result of the ones before it. "weights" is the strength of each
+//layer(NULL is 1 for all): sinm_blend_linear averages with them, the other modes fade
+//a layer towards a flat normal before blending it. All layers are read in one pass and
+//"out" may be one of them.
+
+SINM_DEF void sinm_composite_layers_mt(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, int32_t w, int32_t h, sinm_blend_type type, int32_t threadCount);
+//Multithreaded version of sinm_composite_layers, the result is identical.
+
+SINM_DEF int32_t sinm_mip_count(int32_t w, int32_t h);
+//Number of levels in a full mip chain of a w x h image, level 0 included.
+
+SINM_DEF size_t sinm_mip_chain_size(int32_t w, int32_t h);
+//Pixels needed to hold a full mip chain of a w x h image. Level i is
+//max(1, w >> i) x max(1, h >> i) pixels and the levels are stored one after another.
+
+SINM_DEF int sinm_mip_chain(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_mip_type type, float toksvigPower);
+//Builds the mip chain of a normal or ssbump map. "out" must hold sinm_mip_chain_size(w, h)
+//pixels and level 0 is a copy of "in".
+//Every 2x2 block is decoded, averaged and renormalized instead of averaging the bytes
+//like glGenerateMipmap does, which leaves shorter and darker normals on every level.
+//The averages always cover the whole level 0 footprint so a texel's variance isn't lost.
+//If "toksvigPower" is above 0 alpha holds the Toksvig factor for that specular power,
+//multiply the power by alpha / 255 in the shader. Otherwise alpha is 255. Color maps
+//ignore it and average their alpha instead.
+//Odd sizes drop the last row or column like the GL mip sizes do.
+//Returns 0 if the scratch memory could not be allocated.
+
+SINM_DEF int sinm_mip_chain_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_mip_type type, float toksvigPower, int32_t threadCount);
+//Multithreaded version of sinm_mip_chain, the levels are split into bands of rows.
+//The result is identical. A threadCount of 0 uses one thread per logical core.
+
+SINM_DEF size_t sinm_bc5_size(int32_t w, int32_t h);
+//Bytes needed for a BC5 image of w x h pixels, 16 for every 4x4 block.
+
+SINM_DEF void sinm_bc5_compress(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality);
+//Compresses the red and green channels of "in"(usually a normal map) to BC5, also known
+//as RGTC2 or 3Dc. Upload it as GL_COMPRESSED_RG_RGTC2 and rebuild the normal's
+//z = sqrt(1 - x * x - y * y) in the shader. Blocks hanging over the right or bottom edge
+//repeat the last column or row. "quality" trades speed for error, see sinm_bc_quality.
+
+SINM_DEF void sinm_bc5_compress_mt(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount);
+//Multithreaded version of sinm_bc5_compress, the result is identical.
+//A threadCount of 0 uses one thread per logical core.
+
+SINM_DEF size_t sinm_bc1_size(int32_t w, int32_t h);
+//Bytes needed for a BC1 image of w x h pixels, 8 for every 4x4 block.
+
+SINM_DEF void sinm_bc1_compress(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality);
+//Compresses the rgb channels of "in"(albedo, 8:1 against rgba) to BC1, also known as DXT1.
+//Only the opaque 4 color mode is used, alpha is dropped. Upload it as
+//GL_COMPRESSED_RGB_S3TC_DXT1_EXT or the SRGB variant.
+
+SINM_DEF void sinm_bc1_compress_mt(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount);
+//Multithreaded version of sinm_bc1_compress, the result is identical.
+
+SINM_DEF size_t sinm_bc7_size(int32_t w, int32_t h);
+//Bytes needed for a BC7 image of w x h pixels, 16 for every 4x4 block.
+
+SINM_DEF void sinm_bc7_compress(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality);
+//Compresses all four channels of "in"(ssbump maps or albedo with alpha) to BC7. Only mode 6
+//(one subset, 7 bit endpoints with a p-bit, 4 bit indices) is tried which keeps it fast
+//and is a good fit for smooth data. Upload it as GL_COMPRESSED_RGBA_BPTC_UNORM.
+
+SINM_DEF void sinm_bc7_compress_mt(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount);
+//Multithreaded version of sinm_bc7_compress, the result is identical.
+
+SINM_DEF sinm_simd_level sinm_set_simd_level(sinm_simd_level level);
+//Forces the simd kernels to use the given instruction set, mostly for benchmarking.
+//Levels the cpu doesn't support fall back to the best one it does and
+//sinm_simd_auto goes back to the default. Returns the level now in use.
+
+SINM_DEF sinm_simd_level sinm_get_simd_level(void);
+//Returns the instruction set the simd kernels run with. Unless it was forced it is
+//picked with cpuid the first time a kernel runs.
+
+SINM_DEF sinm_gradient_type sinm_set_gradient(sinm_gradient_type type);
+//Picks the derivative filter the cpu normal map functions use from now on and returns
+//the previous one, sinm_gradient_sobel3x3 is the default. Every filter is scaled to
+//give the same result as sobel 3x3 on a constant slope so "scale" keeps its meaning.
+//The gpu path and sinm_ssbump_map always use sobel 3x3.
+//It is a global default, change it while no normal maps are being generated. Calls
+//that need other settings, or run while another thread changes them, should pass
+//their own to the *_ex functions instead.
+
+SINM_DEF sinm_blur_type sinm_set_blur(sinm_blur_type type);
+//Picks the gaussian blur the cpu functions use from now on and returns the previous one.
+//"blurRadius" is the standard deviation for both. sinm_blur_recursive is a closer fit
+//to a real gaussian at large radii but has to see whole rows and columns at once, so
+//sinm_normal_map_buffer_streaming and sinm_normal_map_tiled always use sinm_blur_box
+//and sinm_normal_map_buffer_mt needs memory for the full height field like
+//sinm_normal_map_buffer. A global default like sinm_set_gradient.
+
+SINM_DEF sinm_pipeline_type sinm_set_pipeline(sinm_pipeline_type type);
+//Picks the arithmetic of the cpu box blur and gradient kernels and returns the previous
+//one. sinm_pipeline_fixed16 keeps 8 bit heights in 16 bit integer lanes, twice as many per
+//register as the float kernels, and divides the box sums with a multiply and a shift.
+//The error bound is zero: the integer gradients are exact and so are the box averages,
+//boxes where that can't be guaranteed or where the float division is off by one(some
+//sizes wider than 39 pixels) run with floats. Normal maps come out byte for byte the same
+//in both modes. sinm_blur_recursive, 16 bit heights and the gradients of multi-scale
+//normal maps always use floats. A global default like sinm_set_gradient.
+
+SINM_DEF sinm_options sinm_default_options(void);
+//Returns the settings the functions without an "options" parameter use, the ones last
+//picked with sinm_set_gradient, sinm_set_blur and sinm_set_pipeline.
+//A good start for the options of the *_ex functions.
+
+SINM_DEF void sinm_shutdown(void);
+//Stops and joins the worker threads that the multithreaded functions start on first use
+//and keep for later calls. Call it before exiting or unloading the code, a call running
+//on another thread is waited for. Functions called afterwards start new workers.
 
-#ifdef __AVX__
-#define simd_prefix_float(name) _mm256_##name
-#define SINM_SIMD_WIDTH 8
-#define simd__int __m256i
-#define simd__float __m256
-#define simd__and_ix(a, b) _mm256_and_si256(a, b)
-#define simd__or_ix(a, b) _mm256_or_si256(a, b)
-#define simd__loadu_ix(a) _mm256_loadu_si256(a)
-#define simd__storeu_ix(ptr, v) _mm256_storeu_si256(ptr, v)
+#else //SI_NORMALMAP_IMPLEMENTATION
+
+#ifdef _MSC_VER
+#include <intrin.h>
 #else
-#define simd_prefix_float(name) _mm_##name
-#define SINM_SIMD_WIDTH 4
-#define simd__int __m128i
-#define simd__float __m128
-#define simd__and_ix(a, b) _mm_and_si128(a, b)
-#define simd__or_ix(a, b) _mm_or_si128(a, b)
-#define simd__loadu_ix(a) _mm_loadu_si128(a)
-#define simd__storeu_ix(ptr, v) _mm_storeu_si128(ptr, v)
-#endif // __AVX__
+#include <x86intrin.h>
+#endif
+#include <math.h>
 
 #define simd__set1_epi32(a) simd_prefix_float(set1_epi32(a))
 #define simd__setzero_ix() simd_prefix_float(setzero_si256())
@@ -110,19 +478,44 @@ SINM_DEF uint32_t* sinm_normal_map(const uint32_t* in, int32_t w, int32_t h, flo
 #define simd__sub_epi32(a, b) simd_prefix_float(sub_epi32(a, b))
 #define simd__max_epi32(a, b) simd_prefix_float(max_epi32(a, b))
 #define simd__min_epi32(a, b) simd_prefix_float(min_epi32(a, b))
+#define simd__mullo_epi32(a, b) simd_prefix_float(mullo_epi32(a, b))
 #define simd__loadu_ps(a) simd_prefix_float(loadu_ps(a))
+#define simd__storeu_ps(a, b) simd_prefix_float(storeu_ps(a, b))
 #define simd__srli_epi32(a, i) simd_prefix_float(srli_epi32(a, i))
 #define simd__slli_epi32(a, i) simd_prefix_float(slli_epi32(a, i))
 #define simd__set1_ps(a) simd_prefix_float(set1_ps(a))
 #define simd__cvtepi32_ps(a) simd_prefix_float(cvtepi32_ps(a))
 #define simd__cvtps_epi32(a) simd_prefix_float(cvtps_epi32(a))
+#define simd__cvttps_epi32(a) simd_prefix_float(cvttps_epi32(a))
 #define simd__add_ps(a, b) simd_prefix_float(add_ps(a, b))
+#define simd__sub_ps(a, b) simd_prefix_float(sub_ps(a, b))
+#define simd__max_ps(a, b) simd_prefix_float(max_ps(a, b))
+#define simd__min_ps(a, b) simd_prefix_float(min_ps(a, b))
 #define simd__mul_ps(a, b) simd_prefix_float(mul_ps(a, b))
 #define simd__sqrt_ps(a) simd_prefix_float(sqrt_ps(a))
 #define simd__cmp_ps(a, b, c) simd_prefix_float(cmp_ps(a, b, c))
 #define simd__div_ps(a, b) simd_prefix_float(div_ps(a, b))
 #define simd__hadd_ps(a, b) simd_prefix_float(hadd_ps(a, b))
+#define simd__unpacklo_epi32(a, b) simd_prefix_float(unpacklo_epi32(a, b))
+#define simd__unpackhi_epi32(a, b) simd_prefix_float(unpackhi_epi32(a, b))
+#define simd__unpacklo_epi64(a, b) simd_prefix_float(unpacklo_epi64(a, b))
+#define simd__unpackhi_epi64(a, b) simd_prefix_float(unpackhi_epi64(a, b))
 #define simd__cvtss_f32(a) simd_prefix_float(cvtss_f32(a))
+#define simd__set1_pd(a) simd_prefix_float(set1_pd(a))
+#define simd__loadu_pd(a) simd_prefix_float(loadu_pd(a))
+#define simd__storeu_pd(a, b) simd_prefix_float(storeu_pd(a, b))
+#define simd__add_pd(a, b) simd_prefix_float(add_pd(a, b))
+#define simd__sub_pd(a, b) simd_prefix_float(sub_pd(a, b))
+#define simd__mul_pd(a, b) simd_prefix_float(mul_pd(a, b))
+#define simd__max_pd(a, b) simd_prefix_float(max_pd(a, b))
+#define simd__min_pd(a, b) simd_prefix_float(min_pd(a, b))
+#define simd__set1_epi16(a) simd_prefix_float(set1_epi16(a))
+#define simd__add_epi16(a, b) simd_prefix_float(add_epi16(a, b))
+#define simd__sub_epi16(a, b) simd_prefix_float(sub_epi16(a, b))
+#define simd__slli_epi16(a, i) simd_prefix_float(slli_epi16(a, i))
+#define simd__mullo_epi16(a, b) simd_prefix_float(mullo_epi16(a, b))
+#define simd__mulhi_epu16(a, b) simd_prefix_float(mulhi_epu16(a, b))
+#define simd__srl_epi16(a, count) simd_prefix_float(srl_epi16(a, count))
 
 #define sinm__min(a, b) ((a) < (b) ? (a) : (b))
 #define sinm__max(a, b) ((a) > (b) ? (a) : (b))
@@ -143,12 +536,6 @@ sinm__length(float x, float y, float z)
     return sqrtf(x * x + y * y + z * z);
 }
 
-sinm__inline static simd__float
-sinm__length_simd(simd__float x, simd__float y, simd__float z)
-{
-    return simd__sqrt_ps(simd__add_ps(simd__add_ps(simd__mul_ps(x, x), simd__mul_ps(y, y)), simd__mul_ps(z, z)));
-}
-
 sinm__inline static sinm__v3
 sinm__normalized(float x, float y, float z)
 {
@@ -204,16 +591,6 @@ sinm__rgba_to_v3(uint32_t c)
     return result;
 }
 
-static sinm__inline void
-sinm__rgba_to_v3_simd(simd__int c, simd__float* x, simd__float* y, simd__float* z)
-{
-    simd__int ff = simd__set1_epi32(0xFF);
-    simd__int v127 = simd__set1_epi32(127);
-    *x = simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 0), ff), v127));
-    *y = simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 8), ff), v127));
-    *z = simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 16), ff), v127));
-}
-
 static sinm__inline uint32_t
 sinm__unit_vector_to_rgba(sinm__v3 v)
 {
@@ -223,17 +600,241 @@ sinm__unit_vector_to_rgba(sinm__v3 v)
     return r | g << 8u | b << 16u | 255u << 24u;
 }
 
-static sinm__inline simd__int
-sinm__v3_to_rgba_simd(simd__float x, simd__float y, simd__float z)
+
+#ifndef SINM_MAX_THREADS
+#define SINM_MAX_THREADS 64
+#endif
+
+//NOTE: jobs are handed out from a shared counter so threads that finish early
+//just grab the next one. "threadIndex" is in [0, threadCount) and can be used to
+//index per thread scratch memory.
+typedef void sinm__job_proc(void* data, int32_t jobIndex, int32_t threadIndex);
+
+#ifndef SINM_NO_THREADS
+//NOTE: the pool only needs a mutex, two condition variables and an atomic
+//increment, these map them onto win32 or pthreads.
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+typedef SRWLOCK sinm__mutex;
+typedef CONDITION_VARIABLE sinm__cond;
+typedef HANDLE sinm__thread;
+typedef DWORD sinm__thread_result;
+#define SINM__THREAD_PROC WINAPI
+#define SINM__MUTEX_INIT SRWLOCK_INIT
+#define SINM__COND_INIT CONDITION_VARIABLE_INIT
+#define sinm__mutex_lock(m) AcquireSRWLockExclusive(m)
+#define sinm__mutex_unlock(m) ReleaseSRWLockExclusive(m)
+#define sinm__cond_wait(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define sinm__cond_signal(c) WakeConditionVariable(c)
+#define sinm__cond_broadcast(c) WakeAllConditionVariable(c)
+#define sinm__atomic_next(counter) (InterlockedIncrement((volatile LONG*)(counter)) - 1)
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t sinm__mutex;
+typedef pthread_cond_t sinm__cond;
+typedef pthread_t sinm__thread;
+typedef void* sinm__thread_result;
+#define SINM__THREAD_PROC
+#define SINM__MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define SINM__COND_INIT PTHREAD_COND_INITIALIZER
+#define sinm__mutex_lock(m) pthread_mutex_lock(m)
+#define sinm__mutex_unlock(m) pthread_mutex_unlock(m)
+#define sinm__cond_wait(c, m) pthread_cond_wait(c, m)
+#define sinm__cond_signal(c) pthread_cond_signal(c)
+#define sinm__cond_broadcast(c) pthread_cond_broadcast(c)
+#define sinm__atomic_next(counter) __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED)
+#endif
+
+typedef struct
 {
-    simd__float one = simd__set1_ps(1.0f);
-    simd__float v127 = simd__set1_ps(127.0f);
-    simd__int a = simd__set1_epi32(255u << 24u);
-    simd__int r = simd__cvtps_epi32(simd__mul_ps(simd__add_ps(one, x), v127));
-    simd__int g = simd__cvtps_epi32(simd__mul_ps(simd__add_ps(one, y), v127));
-    simd__int b = simd__cvtps_epi32(simd__mul_ps(simd__add_ps(one, z), v127));
-    simd__int c = simd__or_ix(simd__or_ix(simd__or_ix(r, simd__slli_epi32(g, 8)), simd__slli_epi32(b, 16)), a);
-    return c;
+    sinm__mutex mutex;
+    sinm__cond wake;
+    sinm__cond done;
+    sinm__thread threads[SINM_MAX_THREADS];
+    int32_t threadCount;
+    int32_t busy;
+    int32_t quit;
+
+    uint32_t generation;
+    int32_t participants;
+    int32_t pending;
+
+    sinm__job_proc* proc;
+    void* data;
+    int32_t jobCount;
+    int32_t nextJob;
+} sinm__thread_pool;
+
+static sinm__thread_pool sinm__pool = { SINM__MUTEX_INIT, SINM__COND_INIT, SINM__COND_INIT };
+
+static void
+sinm__run_jobs(sinm__thread_pool* pool, int32_t threadIndex)
+{
+    for (;;) {
+        int32_t job = sinm__atomic_next(&pool->nextJob);
+        if (job >= pool->jobCount) {
+            break;
+        }
+        pool->proc(pool->data, job, threadIndex);
+    }
+}
+
+static sinm__thread_result SINM__THREAD_PROC
+sinm__worker_thread(void* arg)
+{
+    sinm__thread_pool* pool = &sinm__pool;
+    int32_t threadIndex = (int32_t)(intptr_t)arg;
+    uint32_t seen = 0;
+
+    sinm__mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->generation == seen) {
+            sinm__cond_wait(&pool->wake, &pool->mutex);
+        }
+        seen = pool->generation;
+        if (pool->quit) {
+            break;
+        }
+        if (threadIndex < pool->participants) {
+            sinm__mutex_unlock(&pool->mutex);
+            sinm__run_jobs(pool, threadIndex);
+            sinm__mutex_lock(&pool->mutex);
+            if (--pool->pending == 0) {
+                sinm__cond_broadcast(&pool->done);
+            }
+        }
+    }
+    sinm__mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+static int32_t
+sinm__start_thread(sinm__thread* thread, intptr_t threadIndex)
+{
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, sinm__worker_thread, (void*)threadIndex, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, sinm__worker_thread, (void*)threadIndex) == 0;
+#endif
+}
+
+static void
+sinm__join_thread(sinm__thread thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+#endif //SINM_NO_THREADS
+
+static int32_t
+sinm__thread_count(int32_t requested)
+{
+#ifdef SINM_NO_THREADS
+    return 1;
+#else
+    if (requested <= 0) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        requested = (int32_t)info.dwNumberOfProcessors;
+#else
+        requested = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    return sinm__min(SINM_MAX_THREADS, sinm__max(1, requested));
+#endif
+}
+
+//Runs proc for every job index in [0, jobCount) using up to threadCount threads
+//(including the calling thread). If the pool is already in use(nested or
+//concurrent calls) the jobs run on the calling thread instead.
+static void
+sinm__parallel_for(sinm__job_proc* proc, void* data, int32_t jobCount, int32_t threadCount)
+{
+    threadCount = sinm__min(threadCount, jobCount);
+#ifndef SINM_NO_THREADS
+    sinm__thread_pool* pool = &sinm__pool;
+    if (threadCount > 1) {
+        sinm__mutex_lock(&pool->mutex);
+        if (!pool->busy) {
+            pool->busy = 1;
+            while (pool->threadCount < threadCount - 1) {
+                if (!sinm__start_thread(&pool->threads[pool->threadCount], pool->threadCount + 1)) {
+                    break;
+                }
+                ++pool->threadCount;
+            }
+            threadCount = sinm__min(threadCount, pool->threadCount + 1);
+
+            pool->proc = proc;
+            pool->data = data;
+            pool->jobCount = jobCount;
+            pool->nextJob = 0;
+            pool->participants = threadCount;
+            pool->pending = threadCount - 1;
+            ++pool->generation;
+            sinm__cond_broadcast(&pool->wake);
+            sinm__mutex_unlock(&pool->mutex);
+
+            sinm__run_jobs(pool, 0);
+
+            sinm__mutex_lock(&pool->mutex);
+            while (pool->pending > 0) {
+                sinm__cond_wait(&pool->done, &pool->mutex);
+            }
+            pool->busy = 0;
+            //NOTE: "done" is shared with sinm_shutdown waiting for the pool to be free
+            sinm__cond_broadcast(&pool->done);
+            sinm__mutex_unlock(&pool->mutex);
+            return;
+        }
+        sinm__mutex_unlock(&pool->mutex);
+    }
+#endif
+    for (int32_t i = 0; i < jobCount; ++i) {
+        proc(data, i, 0);
+    }
+}
+
+//NOTE: the pool stays busy while the workers are joined so calls that come in
+//meanwhile run on their own thread instead of starting new workers
+SINM_DEF void
+sinm_shutdown(void)
+{
+#ifndef SINM_NO_THREADS
+    sinm__thread_pool* pool = &sinm__pool;
+    sinm__mutex_lock(&pool->mutex);
+    while (pool->busy) {
+        sinm__cond_wait(&pool->done, &pool->mutex);
+    }
+    pool->busy = 1;
+    pool->quit = 1;
+    ++pool->generation;
+    sinm__cond_broadcast(&pool->wake);
+    sinm__mutex_unlock(&pool->mutex);
+
+    for (int32_t i = 0; i < pool->threadCount; ++i) {
+        sinm__join_thread(pool->threads[i]);
+    }
+
+    sinm__mutex_lock(&pool->mutex);
+    pool->threadCount = 0;
+    pool->quit = 0;
+    pool->busy = 0;
+    sinm__cond_broadcast(&pool->done);
+    sinm__mutex_unlock(&pool->mutex);
+#endif
 }
 
 SINM_DEF void
@@ -253,818 +854,5766 @@ sinm__generate_gaussian_box(float* outBoxes, int32_t n, float sigma)
     }
 }
 
-//NOTE: decently optimized box blur based on http://blog.ivank.net/fastest-gaussian-blur.html
-SINM_DEF void
-sinm__box_blur_h(uint32_t* in, uint32_t* out, int32_t w, int32_t h, float r)
+//NOTE: every gradient filter is separable, the x derivative is "smooth" down the
+//columns times "diff" along the rows and y the other way around. "strength" scales the
+//result to match sobel 3x3 on a constant slope.
+typedef struct
 {
-    float invR = 1.0f / (r + r + 1);
-    for (int i = 0; i < h; ++i) {
-        int32_t oi = i * w;
-        int32_t li = oi;
-        int32_t ri = (int32_t)(oi + r);
-        uint32_t fv = in[oi] & 0xFFu;
-        uint32_t lv = in[oi + w - 1] & 0xFFu;
-        uint32_t sum = (uint32_t)((r + 1.0f) * fv);
+    int32_t radius;
+    float smooth[5];
+    float diff[5];
+    float strength;
+} sinm__gradient_filter;
+
+static const sinm__gradient_filter sinm__gradient_filters[sinm_gradient_count] = {
+    { 1, { 1, 2, 1 }, { -1, 0, 1 }, 1.0f },
+    { 2, { 1, 4, 6, 4, 1 }, { -1, -2, 0, 2, 1 }, 1.0f / 16.0f },
+    { 1, { 3, 10, 3 }, { -1, 0, 1 }, 1.0f / 4.0f },
+    { 1, { 1, 1, 1 }, { -1, 0, 1 }, 4.0f / 3.0f },
+    { 1, { 0, 1, 0 }, { -1, 0, 1 }, 4.0f },
+};
 
-        for (int j = 0; j < r; ++j) {
-            sum += in[oi + j] & 0xFFu;
-        }
-        for (int j = 0; j <= r; ++j) {
-            sum += (in[ri++] & 0xFFu) - fv;
-            out[oi++] = sinm__greyscale_from_byte((uint8_t)(sum * invR));
-        }
-        for (int j = (int)r + 1; j < (w - r); ++j) {
-            sum += (in[ri++] & 0xFFu) - (in[li++] & 0xFFu);
-            out[oi++] = sinm__greyscale_from_byte((uint8_t)(sum * invR));
-        }
-        for (int j = (int)(w - r); j < w; ++j) {
-            sum += lv - (in[li++] & 0xFFu);
-            out[oi++] = sinm__greyscale_from_byte((uint8_t)(sum * invR));
-        }
+static sinm_gradient_type sinm__gradient = sinm_gradient_sobel3x3;
+
+//NOTE: Young-van Vliet recursive gaussian. A pass runs the third order filter
+//w[n] = b * x[n] + a[0] * w[n - 1] + a[1] * w[n - 2] + a[2] * w[n - 3] forward and then the
+//same backward over w. "m" is the Triggs-Sdika matrix that starts the backward pass as
+//if the last pixel went on forever. The poles get very close to 1 for large sigmas so
+//everything runs in doubles, floats are already visibly off at sigma 50.
+typedef struct
+{
+    double b;
+    double a[3];
+    double m[9];
+} sinm__recursive_gaussian;
+
+static void
+sinm__recursive_gaussian_init(sinm__recursive_gaussian* g, float sigma)
+{
+    double q = (sigma >= 2.5f) ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    double q2 = q * q;
+    double q3 = q2 * q;
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    double a1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    double a2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    double a3 = 0.422205 * q3 / b0;
+    g->a[0] = a1;
+    g->a[1] = a2;
+    g->a[2] = a3;
+    g->b = 1.0 - (a1 + a2 + a3);
+
+    double s = 1.0 / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3));
+    g->m[0] = s * (-a3 * a1 + 1.0 - a3 * a3 - a2);
+    g->m[1] = s * (a3 + a1) * (a2 + a3 * a1);
+    g->m[2] = s * a3 * (a1 + a3 * a2);
+    g->m[3] = s * (a1 + a3 * a2);
+    g->m[4] = -s * (a2 - 1.0) * (a2 + a3 * a1);
+    g->m[5] = -s * a3 * (a3 * a1 + a3 * a3 + a2 - 1.0);
+    g->m[6] = s * (a3 * a1 + a2 + a1 * a1 - a2 * a2);
+    g->m[7] = s * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3);
+    g->m[8] = s * a3 * (a1 + a3 * a2);
+}
+
+static sinm_blur_type sinm__blur = sinm_blur_box;
+static sinm_pipeline_type sinm__pipeline = sinm_pipeline_float;
+
+//NOTE: sinm_pipeline_fixed16 box blurs divide the window sums of 8 bit heights, at most
+//255 * size, by the box size without floats. The 16 bit kernels keep the high half of
+//sum * multiplier and shift it right by "shift", the scalar code uses a 32 bit
+//reciprocal. Both are rounded up so they give sum / size exactly as long as the rounding
+//error times the largest sum stays below one step, see sinm__box_reciprocal.
+static sinm__inline uint32_t
+sinm__fixed_multiplier(int32_t size, int32_t* shift)
+{
+    int32_t s = 0;
+    while ((2 << s) < size) {
+        ++s;
     }
+    *shift = s;
+    return (uint32_t)((((uint64_t)1 << (16 + s)) + size - 1) / size);
 }
 
-SINM_DEF void
-sinm__box_blur_v(uint32_t* in, uint32_t* out, int32_t w, int32_t h, float r)
+static sinm__inline uint32_t
+sinm__fixed_reciprocal(int32_t size)
 {
-    float invR = 1.0f / (r + r + 1);
-    for (int i = 0; i < w; ++i) {
-        int32_t oi = i;
-        int32_t li = oi;
-        int32_t ri = (int32_t)(oi + r * w);
-        uint32_t fv = in[oi] & 0xFFu;
-        uint32_t lv = in[oi + w * (h - 1)] & 0xFFu;
-        uint32_t sum = (uint32_t)((r + 1) * fv);
+    return (uint32_t)((((uint64_t)1 << 32) + size - 1) / size);
+}
 
-        for (int j = 0; j < r; j++) {
-            sum += in[oi + j * w] & 0xFFu;
-        }
-        for (int j = 0; j <= r; j++) {
-            sum += (in[ri] & 0xFFu) - fv;
-            out[oi] = sinm__greyscale_from_byte((uint8_t)(sum * invR));
-            ri += w;
-            oi += w;
-        }
-        for (int j = (int)(r + 1); j < h - r; j++) {
-            sum += (in[ri] & 0xFFu) - (in[li] & 0xFFu);
-            out[oi] = sinm__greyscale_from_byte((uint8_t)(sum * invR));
-            li += w;
-            ri += w;
-            oi += w;
-        }
-        for (int j = (int)(h - r); j < h; j++) {
-            sum += lv - (in[li] & 0xFFu);
-            out[oi] = sinm__greyscale_from_byte((uint8_t)(sum * invR));
-            li += w;
-            oi += w;
+//NOTE: "rows" are the 2 * radius + 1 input rows around the output row, already clamped
+//to the image. Scalar reference for the simd kernels.
+static void
+sinm__gradient_normals_row(const uint8_t* const* rows, uint32_t* out, int32_t xs, int32_t xe, int32_t w, float scale, int flipY, sinm_gradient_type type)
+{
+    const sinm__gradient_filter* filter = &sinm__gradient_filters[type];
+    int32_t size = filter->radius * 2 + 1;
+    float yDir = (flipY) ? -1.0f : 1.0f;
+    scale *= filter->strength;
+
+    for (int32_t x = xs; x < xe; ++x) {
+        float xmag = 0.0f;
+        float ymag = 0.0f;
+        for (int32_t a = 0; a < size; ++a) {
+            float column = 0.0f;
+            float row = 0.0f;
+            for (int32_t b = 0; b < size; ++b) {
+                int32_t xIdx = sinm__min(w - 1, sinm__max(1, x + b - filter->radius));
+                column += rows[b][sinm__min(w - 1, sinm__max(1, x + a - filter->radius))] * filter->smooth[b];
+                row += rows[a][xIdx] * filter->smooth[b];
+            }
+            xmag += column * filter->diff[a];
+            ymag += row * filter->diff[a];
         }
+        sinm__v3 color = sinm__normalized(xmag * scale, ymag * scale * yDir, 255.0f);
+        out[x] = sinm__unit_vector_to_rgba(color);
     }
 }
 
-SINM_DEF void
-sinm__gaussian_box(uint32_t* in, uint32_t* out, int32_t w, int32_t h, float r)
+//NOTE: like the original sobel kernel rows are clamped to [1, h - 1], the first row is never read
+static sinm__inline void
+sinm__gradient_rows(const uint8_t* in, const uint8_t** rows, int32_t y, int32_t w, int32_t h, int32_t radius)
 {
-    float boxes[3];
-    sinm__generate_gaussian_box(boxes, sizeof(boxes) / sizeof(boxes[0]), r);
-
-    for (int i = 0; i < 3; ++i) {
-        sinm__box_blur_h(in, out, w, h, (boxes[i] - 1) / 2);
-        sinm__box_blur_v(out, in, w, h, (boxes[i] - 1) / 2);
+    for (int32_t a = 0; a < radius * 2 + 1; ++a) {
+        rows[a] = in + (size_t)sinm__min(h - 1, sinm__max(1, y + a - radius)) * w;
     }
-
-    memcpy(out, in, w * h * sizeof(uint32_t));
 }
 
-#ifdef SI_NORMALMAP_GPU
-static const char* sinm__gaussian_blur_vert_shader_source = {
-
-    "#version 410 core\n"
-    "layout (location = 0) in vec3 iPos;\n"
-    "layout (location = 1) in vec2 iTexCoords;\n"
-    "out vec2 TexCoords;\n"
-    "void main(){\n"
-    "   TexCoords = iTexCoords;\n"
-    "   gl_Position = vec4(iPos, 1.0);\n"
-    "}\n"
-};
-static const char* sinm__gaussian_blur_frag_shader_source = {
-
-    "#version 410 core\n"
-    "out vec4 FragColor;\n"
-    "in vec2 TexCoords;\n"
-    "uniform sampler2D image;\n"
-    "uniform bool horizontal;\n"
-    "uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);\n"
-    "void main() {\n"
-    "    vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel\n"
-    "    vec3 result = texture(image, TexCoords).rgb * weight[0]; // current fragment's contribution\n"
-    "    if(horizontal) {\n"
-    "        for(int i = 1; i < 5; ++i) {\n"
-    "            result += texture(image, TexCoords + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];\n"
-    "            result += texture(image, TexCoords - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];\n"
-    "        }\n"
-    "    } else {\n"
-    "        for(int i = 1; i < 5; ++i) {\n"
-    "            result += texture(image, TexCoords + vec2(0.0, tex_offset.y * i)).rgb * weight[i];\n"
-    "            result += texture(image, TexCoords - vec2(0.0, tex_offset.y * i)).rgb * weight[i];\n"
-    "        }\n"
-    "    }\n"
-    "    FragColor = vec4(result, 1.0);\n"
-    "}\n"
-};
-
-typedef struct
+SINM_DEF void
+sinm__gradient_normals_row_range(const uint8_t* in, uint32_t* out, int32_t xs, int32_t xe, int32_t w, int32_t h, float scale, int flipY, sinm_gradient_type type)
 {
-    int initialized;
-    uint32_t inTex;
-    uint32_t quadVAO;
-    uint32_t pingpongFBO[2];
-    uint32_t pingpongBuffers[2];
-
-    uint32_t greyscaleAverageShader;
-    uint32_t greyscaleLuminanceShader;
-    uint32_t greyscaleLightnessShader;
-    uint32_t blurShader;
-    uint32_t normalMapShader;
-    uint32_t normalizeShader;
-    uint32_t compositeShader;
-} sinm__opengl_ctx;
+    for (int32_t y = 0; y < h; ++y) {
+        const uint8_t* rows[5];
+        sinm__gradient_rows(in, rows, y, w, h, sinm__gradient_filters[type].radius);
+        sinm__gradient_normals_row(rows, out + (size_t)y * w, xs, xe, w, scale, flipY, type);
+    }
+}
 
-static sinm__opengl_ctx sinm__glCtx = { 0 };
+SINM_DEF void
+sinm__normalize(uint32_t* in, int32_t w, int32_t h, float scale, int flipY)
+{
+    float invScale = 1.0f / scale;
+    float yDir = (flipY) ? -1.0f : 1.0f;
+    for (int32_t i = 0; i < w * h; ++i) {
+        sinm__v3 v = sinm__rgba_to_v3(in[i]);
+        in[i] = sinm__unit_vector_to_rgba(sinm__normalized(v.x, v.y * yDir, v.z * invScale));
+    }
+}
 
+#if 0
 SINM_DEF void
-sinm_initialize_opengl()
+sinm__normalize_gpu(uint32_t* in, )
 {
-    const float quadVertices[] = {
-        // positions        // texture Coords
-        -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, //1
-        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, //2
-        1.0f, 1.0f, 0.0f, 1.0f, 1.0f, //3
-        1.0f, -1.0f, 0.0f, 1.0f, 0.0f, //4
-    };
+}
+
+#endif
+
+SINM_DEF void sinm__composite(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h)
+{
+    for (int32_t i = 0; i < w * h; ++i) {
+        uint32_t c1 = in1[i];
+        uint32_t c2 = in2[i];
+        uint32_t r1 = c1 & 0xFFu;
+        uint32_t r2 = c2 & 0xFFu;
+        uint32_t g1 = (c1 >> 8) & 0xFFu;
+        uint32_t g2 = (c2 >> 8) & 0xFFu;
+        uint32_t b1 = (c1 >> 16) & 0xFFu;
+        uint32_t b2 = (c2 >> 16) & 0xFFu;
+        uint32_t r = (r1 + r2) >> 1;
+        uint32_t g = (g1 + g2) >> 1;
+        uint32_t b = (b1 + b2) >> 1;
+        out[i] = (r | g << 8u | b << 16u | 255u << 24u);
+    }
+}
+
+static void
+sinm__greyscale(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+{
+    int32_t count = w * h;
+    switch (type) {
+    case sinm_greyscale_lightness: {
+        for (int32_t i = 0; i < count; ++i) {
+            uint32_t c = in[i];
+            uint32_t l = sinm__lightness_average(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu);
+            out[i] = sinm__greyscale_from_byte(l);
+        }
+    } break;
+
+    case sinm_greyscale_average: {
+        for (int32_t i = 0; i < count; ++i) {
+            uint32_t c = in[i];
+            uint32_t l = sinm__average(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu);
+            out[i] = sinm__greyscale_from_byte(l);
+        }
+    } break;
+
+    case sinm_greyscale_luminance: {
+        for (int32_t i = 0; i < count; ++i) {
+            uint32_t c = in[i];
+            uint32_t l = sinm__luminance(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu);
+            out[i] = sinm__greyscale_from_byte(l);
+        }
+    } break;
+    default: {
+        //INVALID OPTION
+        assert(false);
+    } break;
+    }
+}
+
+#define SINM__SSBUMP_DIRECTIONS 16
+#define SINM__SSBUMP_ELEVATIONS 8
+
+//Everything the ssbump kernels need besides the heights and horizons. "weights" is the
+//part of each basis vector's light coming from every direction and elevation.
+typedef struct
+{
+    float gradientScale;
+    float gradientScaleY;
+    float tanElevation[SINM__SSBUMP_ELEVATIONS];
+    float weights[SINM__SSBUMP_DIRECTIONS][SINM__SSBUMP_ELEVATIONS][3];
+} sinm__ssbump_setup;
+
+//NOTE: bumpBasis from shaders/ssbump_phong_forward.frag
+static const float sinm__ssbump_basis[3][3] = {
+    { 0.81649658f, 0.0f, 0.57735027f },
+    { -0.40824829f, 0.70710678f, 0.57735027f },
+    { -0.40824829f, -0.70710678f, 0.57735027f },
+};
+
+//Compresses block row "by" of a w x h image
+typedef void sinm__bc_row_proc(const uint32_t* in, int32_t w, int32_t h, int32_t by, uint8_t* out, sinm_bc_quality quality);
+
+//Writes the lowest "count" bits of "value" at bit "*pos" of a zeroed 128 bit block
+static sinm__inline void
+sinm__put_bits(uint64_t* block, int32_t* pos, uint64_t value, int32_t count)
+{
+    int32_t bit = *pos & 63;
+    block[*pos >> 6] |= value << bit;
+    if (bit + count > 64) {
+        block[(*pos >> 6) + 1] |= value >> (64 - bit);
+    }
+    *pos += count;
+}
+
+//Normals of a row from the 2 * radius + 1 rows of 8 bit heights around it
+typedef void sinm__gradient_row_proc(const uint8_t* const* rows, uint32_t* out, int32_t w, float scale, int flipY);
+
+//NOTE: the simd kernels are compiled for every instruction set in the SINM__KERNEL_PASS
+//part of this file and one of these tables is picked at runtime.
+typedef struct
+{
+    sinm_simd_level level;
+    int32_t width;
+    void (*greyscale)(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type);
+    void (*heights)(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_greyscale_type type);
+    void (*box_blur_h)(const uint8_t* in, uint8_t* out, int32_t w, int32_t h, float r);
+    void (*box_blur_v)(const uint8_t* in, uint8_t* out, int32_t w, int32_t h, float r);
+    void (*box_blur_h_fixed)(const uint8_t* in, uint8_t* out, int32_t w, int32_t h, int32_t r);
+    void (*box_blur_v_fixed)(const uint8_t* in, uint8_t* out, int32_t w, int32_t h, int32_t r);
+    void (*recursive_blur_h)(const uint8_t* in, uint8_t* out, int32_t w, int32_t ys, int32_t ye, const sinm__recursive_gaussian* g, double* scratch);
+    void (*recursive_blur_v)(const uint8_t* in, uint8_t* out, int32_t w, int32_t h, int32_t xs, int32_t xe, const sinm__recursive_gaussian* g, double* scratch);
+    void (*sat_rows)(const uint8_t* in, uint32_t* sat, int32_t w, int32_t ys, int32_t ye);
+    void (*sat_columns)(uint32_t* sat, int32_t w, int32_t h, int32_t xs, int32_t xe);
+    void (*sat_blur_row)(const uint32_t* sat, const uint8_t* mask, uint8_t* out, int32_t w, int32_t h, int32_t y, float sigmaScale);
+    sinm__gradient_row_proc* gradient_normals_row[sinm_gradient_count];
+    sinm__gradient_row_proc* gradient_normals_row_fixed[sinm_gradient_count];
+    void (*gradient_levels_row[sinm_gradient_count])(const uint8_t* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, int flipY);
+    void (*box_blur_h16)(const uint16_t* in, uint16_t* out, int32_t w, int32_t h, float r);
+    void (*box_blur_v16)(const uint16_t* in, uint16_t* out, int32_t w, int32_t h, float r);
+    void (*recursive_blur_h16)(const uint16_t* in, uint16_t* out, int32_t w, int32_t ys, int32_t ye, const sinm__recursive_gaussian* g, double* scratch);
+    void (*recursive_blur_v16)(const uint16_t* in, uint16_t* out, int32_t w, int32_t h, int32_t xs, int32_t xe, const sinm__recursive_gaussian* g, double* scratch);
+    void (*gradient_normals_row16[sinm_gradient_count])(const uint16_t* const* rows, uint32_t* out, int32_t w, float scale, int flipY);
+    void (*normalize)(uint32_t* in, int32_t w, int32_t h, float scale, int flipY);
+    void (*composite)(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h);
+    void (*composite_layers)(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, size_t start, size_t end, sinm_blend_type type);
+    void (*horizon_row)(const uint8_t* heights, const int32_t* offsets, const float* invDist, int32_t steps, float* horizon, int32_t w);
+    void (*ssbump_accumulate)(const float* horizon, float* light, int32_t w, size_t planeSize, const sinm__ssbump_setup* setup, int32_t direction);
+    void (*ssbump_row)(const uint8_t* heights, int32_t stride, const float* light, size_t planeSize, uint32_t* out, int32_t w, const sinm__ssbump_setup* setup);
+    void (*ao_accumulate)(const float* horizon, float* occlusion, uint32_t* out, int32_t w, float scale);
+    void (*mip_first_row)(const uint32_t* row0, const uint32_t* row1, int32_t srcW, float* const dst[4], int32_t dstW, sinm_mip_type type);
+    void (*mip_reduce_row)(const float* const row0[4], const float* const row1[4], int32_t srcW, float* const dst[4], int32_t dstW);
+    void (*mip_encode_row)(const float* const planes[4], uint32_t* out, int32_t w, sinm_mip_type type, float toksvigPower);
+    sinm__bc_row_proc* bc1_row;
+    sinm__bc_row_proc* bc5_row;
+    sinm__bc_row_proc* bc7_row;
+} sinm__kernel_table;
+
+#define SINM__K__(name, suffix) name##_##suffix
+#define SINM__K_(name, suffix) SINM__K__(name, suffix)
+#define SINM__K(name) SINM__K_(name, SINM__KERNEL_SUFFIX)
+#define SINM__H(name) SINM__K(SINM__K_(name, SINM__HEIGHT_SUFFIX))
+
+//Columns blurred together by sinm__box_blur_v_simd. 64 pixels is one or two cache lines per row.
+#define SINM__BLUR_STRIP_WIDTH 64
+#define SINM__BLUR_STRIP_VECTORS (SINM__BLUR_STRIP_WIDTH / SINM_SIMD_WIDTH)
+#define SINM__BLUR_STRIP_VECTORS16 (SINM__BLUR_STRIP_WIDTH / (SINM_SIMD_WIDTH * 2))
+
+//Largest box radius of the masked blur and largest height in its summed area table.
+#define SINM__SAT_MAX_RADIUS 1023
+#define SINM__SAT_MAX_HEIGHT 255
+
+#define sinm__stringify(x) #x
+#if defined(__clang__)
+#define sinm__target_push(isa) _Pragma(sinm__stringify(clang attribute push(__attribute__((target(isa))), apply_to = function)))
+#define sinm__target_pop() _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#define sinm__target_push(isa) _Pragma("GCC push_options") _Pragma(sinm__stringify(GCC target(isa)))
+#define sinm__target_pop() _Pragma("GCC pop_options")
+#else
+#define sinm__target_push(isa)
+#define sinm__target_pop()
+#endif
+
+#define SINM__KERNEL_PASS 1
+#include "si_normalmap.h"
+#undef SINM__KERNEL_PASS
+#define SINM__KERNEL_PASS 2
+#include "si_normalmap.h"
+#undef SINM__KERNEL_PASS
+#define SINM__KERNEL_PASS 3
+#include "si_normalmap.h"
+#undef SINM__KERNEL_PASS
+
+//NOTE: read by every call, possibly from several threads at once, so the pointer is
+//only loaded and stored atomically. The first call that finds it empty installs the
+//best table with a compare and swap.
+static const sinm__kernel_table* sinm__active_kernels;
+
+#ifdef _MSC_VER
+#define sinm__load_kernels() ((const sinm__kernel_table*)_InterlockedCompareExchangePointer((void* volatile*)&sinm__active_kernels, NULL, NULL))
+#define sinm__store_kernels(table) _InterlockedExchangePointer((void* volatile*)&sinm__active_kernels, (void*)(table))
+#define sinm__install_kernels(table) _InterlockedCompareExchangePointer((void* volatile*)&sinm__active_kernels, (void*)(table), NULL)
+#else
+#define sinm__load_kernels() __atomic_load_n(&sinm__active_kernels, __ATOMIC_ACQUIRE)
+#define sinm__store_kernels(table) __atomic_store_n(&sinm__active_kernels, table, __ATOMIC_RELEASE)
+static sinm__inline void
+sinm__install_kernels(const sinm__kernel_table* table)
+{
+    const sinm__kernel_table* expected = NULL;
+    __atomic_compare_exchange_n(&sinm__active_kernels, &expected, table, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+static sinm_simd_level
+sinm__detect_simd_level(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    int osxsave = (info[2] >> 27) & 1;
+    if (maxLeaf >= 7 && osxsave) {
+        //NOTE: the os has to save the ymm/zmm registers as well
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        //NOTE: avx512f for the float kernels and avx512bw for the 16 bit ones
+        if (((info[1] >> 16) & 1) && ((info[1] >> 30) & 1) && (xcr0 & 0xE6) == 0xE6) {
+            return sinm_simd_avx512;
+        }
+        if (((info[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6) {
+            return sinm_simd_avx2;
+        }
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return sinm_simd_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return sinm_simd_avx2;
+    }
+#endif
+    return sinm_simd_sse41;
+}
+
+static const sinm__kernel_table*
+sinm__kernels_for_level(sinm_simd_level level)
+{
+    sinm_simd_level supported = sinm__detect_simd_level();
+    if (level == sinm_simd_auto || level > supported) {
+        level = supported;
+    }
+
+    switch (level) {
+    case sinm_simd_avx512: {
+        return &sinm__kernels_avx512;
+    }
+    case sinm_simd_avx2: {
+        return &sinm__kernels_avx2;
+    }
+    default: {
+        return &sinm__kernels_sse41;
+    }
+    }
+}
+
+SINM_DEF sinm_simd_level
+sinm_set_simd_level(sinm_simd_level level)
+{
+    const sinm__kernel_table* table = sinm__kernels_for_level(level);
+    sinm__store_kernels(table);
+    return table->level;
+}
+
+static sinm__inline const sinm__kernel_table*
+sinm__kernels(void)
+{
+    const sinm__kernel_table* table = sinm__load_kernels();
+    if (!table) {
+        //NOTE: if another thread got here first its table is kept, it's the same one
+        //unless sinm_set_simd_level was called in between
+        sinm__install_kernels(sinm__kernels_for_level(sinm_simd_auto));
+        table = sinm__load_kernels();
+    }
+    return table;
+}
+
+SINM_DEF sinm_simd_level
+sinm_get_simd_level(void)
+{
+    return sinm__kernels()->level;
+}
+
+SINM_DEF sinm_gradient_type
+sinm_set_gradient(sinm_gradient_type type)
+{
+    assert(type >= 0 && type < sinm_gradient_count);
+    sinm_gradient_type previous = sinm__gradient;
+    sinm__gradient = type;
+    return previous;
+}
+
+SINM_DEF sinm_blur_type
+sinm_set_blur(sinm_blur_type type)
+{
+    assert(type >= 0 && type < sinm_blur_count);
+    sinm_blur_type previous = sinm__blur;
+    sinm__blur = type;
+    return previous;
+}
+
+SINM_DEF sinm_pipeline_type
+sinm_set_pipeline(sinm_pipeline_type type)
+{
+    assert(type >= 0 && type < sinm_pipeline_count);
+    sinm_pipeline_type previous = sinm__pipeline;
+    sinm__pipeline = type;
+    return previous;
+}
+
+SINM_DEF sinm_options
+sinm_default_options(void)
+{
+    sinm_options result;
+    result.gradient = sinm__gradient;
+    result.blur = sinm__blur;
+    result.pipeline = sinm__pipeline;
+    return result;
+}
+
+//Copy of "options" or of the global defaults if it is NULL. Every call reads its
+//settings once so they can't change halfway through.
+static sinm__inline sinm_options
+sinm__resolve_options(const sinm_options* options)
+{
+    if (!options) {
+        return sinm_default_options();
+    }
+    assert(options->gradient >= 0 && options->gradient < sinm_gradient_count);
+    assert(options->blur >= 0 && options->blur < sinm_blur_count);
+    assert(options->pipeline >= 0 && options->pipeline < sinm_pipeline_count);
+    return *options;
+}
+
+//sinm__fixed_reciprocal for a box blur of radius "r" with sinm_pipeline_type "pipeline",
+//0 if it has to run with floats. Boxes wider than 257 pixels could overflow 16 bits.
+static uint32_t
+sinm__box_reciprocal(int32_t r, sinm_pipeline_type pipeline)
+{
+    int32_t size = r * 2 + 1;
+    if (pipeline != sinm_pipeline_fixed16 || r < 1 || r > 128) {
+        return 0;
+    }
+
+    int32_t shift;
+    uint64_t product = (uint64_t)sinm__fixed_multiplier(size, &shift) * size;
+    uint64_t step = (uint64_t)1 << (16 + shift);
+    if ((product - step) * 255 * size >= step) {
+        return 0;
+    }
+
+    //NOTE: the float kernels are exact too except where the quotient is a whole number
+    //and sum * (1 / size) comes out just below it. Those sizes keep using floats so both
+    //modes always give the same heights.
+    float invR = 1.0f / size;
+    for (uint32_t q = 1; q <= 255; ++q) {
+        if ((uint32_t)((float)(q * size) * invR) != q) {
+            return 0;
+        }
+    }
+    return sinm__fixed_reciprocal(size);
+}
+
+//Row kernel of the gradient filter and pipeline in "options"
+static sinm__inline sinm__gradient_row_proc*
+sinm__gradient_row_kernel(const sinm__kernel_table* kernels, const sinm_options* options)
+{
+    if (options->pipeline == sinm_pipeline_fixed16) {
+        return kernels->gradient_normals_row_fixed[options->gradient];
+    }
+    return kernels->gradient_normals_row[options->gradient];
+}
+
+SINM_DEF void
+sinm__gaussian_box(uint8_t* in, uint8_t* out, int32_t w, int32_t h, float r, sinm_pipeline_type pipeline)
+{
+    float boxes[3];
+    sinm__generate_gaussian_box(boxes, sizeof(boxes) / sizeof(boxes[0]), r);
+    const sinm__kernel_table* kernels = sinm__kernels();
+
+    for (int i = 0; i < 3; ++i) {
+        int32_t radius = (int32_t)((boxes[i] - 1) / 2);
+        if (sinm__box_reciprocal(radius, pipeline)) {
+            kernels->box_blur_h_fixed(in, out, w, h, radius);
+            kernels->box_blur_v_fixed(out, in, w, h, radius);
+        } else {
+            kernels->box_blur_h(in, out, w, h, (boxes[i] - 1) / 2);
+            kernels->box_blur_v(out, in, w, h, (boxes[i] - 1) / 2);
+        }
+    }
+
+    memcpy(out, in, (size_t)w * h);
+}
+
+//Doubles of scratch memory a thread needs for sinm__recursive_blur_h_simd and
+//sinm__recursive_blur_v_simd on a w * h image
+static size_t
+sinm__recursive_blur_scratch_size(int32_t w, int32_t h)
+{
+    return (size_t)SINM__BLUR_STRIP_WIDTH * sinm__max(w, h);
+}
+
+typedef struct
+{
+    uint8_t* heights;
+    double* scratch;
+    size_t scratchSize;
+    int32_t w, h;
+    sinm__recursive_gaussian gaussian;
+} sinm__recursive_blur_job;
+
+//NOTE: jobs are SINM__BLUR_STRIP_WIDTH rows for the horizontal pass and one strip of
+//columns for the vertical one
+static void
+sinm__recursive_blur_h_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__recursive_blur_job* job = (sinm__recursive_blur_job*)data;
+    int32_t ys = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t ye = sinm__min(job->h, ys + SINM__BLUR_STRIP_WIDTH);
+    sinm__kernels()->recursive_blur_h(job->heights, job->heights, job->w, ys, ye, &job->gaussian,
+        job->scratch + threadIndex * job->scratchSize);
+}
+
+static void
+sinm__recursive_blur_v_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__recursive_blur_job* job = (sinm__recursive_blur_job*)data;
+    int32_t xs = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t xe = sinm__min(job->w, xs + SINM__BLUR_STRIP_WIDTH);
+    sinm__kernels()->recursive_blur_v(job->heights, job->heights, job->w, job->h, xs, xe, &job->gaussian,
+        job->scratch + threadIndex * job->scratchSize);
+}
+
+//Blurs "heights" in place with the blur picked in "options", "temp" is scratch
+//memory for another w * h heights. "scratch" is for the recursive blur, one
+//sinm__recursive_blur_scratch_size per thread, it is allocated here if it is NULL.
+//Returns 0 if the scratch memory could not be allocated.
+static int
+sinm__blur_heights(uint8_t* heights, uint8_t* temp, int32_t w, int32_t h, float radius, int32_t threadCount, double* scratch, const sinm_options* options)
+{
+    if (options->blur == sinm_blur_box) {
+        sinm__gaussian_box(heights, temp, w, h, radius, options->pipeline);
+        return 1;
+    }
+
+    sinm__recursive_blur_job job;
+    job.heights = heights;
+    job.w = w;
+    job.h = h;
+    sinm__recursive_gaussian_init(&job.gaussian, radius);
+
+    int32_t rowJobs = (h + SINM__BLUR_STRIP_WIDTH - 1) / SINM__BLUR_STRIP_WIDTH;
+    int32_t columnJobs = (w + SINM__BLUR_STRIP_WIDTH - 1) / SINM__BLUR_STRIP_WIDTH;
+    threadCount = sinm__min(threadCount, sinm__max(rowJobs, columnJobs));
+    job.scratchSize = sinm__recursive_blur_scratch_size(w, h);
+    job.scratch = scratch;
+    if (!scratch) {
+        job.scratch = (double*)malloc(threadCount * job.scratchSize * sizeof(double));
+        if (!job.scratch) {
+            return 0;
+        }
+    }
+
+    sinm__parallel_for(sinm__recursive_blur_h_proc, &job, rowJobs, threadCount);
+    sinm__parallel_for(sinm__recursive_blur_v_proc, &job, columnJobs, threadCount);
+
+    if (!scratch) {
+        free(job.scratch);
+    }
+    return 1;
+}
+
+//Normals for the rows in [ys, ye) of a w * h height field
+static void
+sinm__gradient_normals_simd(const uint8_t* in, uint32_t* out, int32_t w, int32_t h, int32_t ys, int32_t ye, float scale, int flipY, const sinm_options* options)
+{
+    sinm__gradient_row_proc* rowKernel = sinm__gradient_row_kernel(sinm__kernels(), options);
+    for (int32_t y = ys; y < ye; ++y) {
+        const uint8_t* rows[5];
+        sinm__gradient_rows(in, rows, y, w, h, sinm__gradient_filters[options->gradient].radius);
+        rowKernel(rows, out + (size_t)y * w, w, scale, flipY);
+    }
+}
+
+
+SINM_DEF sinm__inline void
+sinm_normalize(uint32_t* in, int32_t w, int32_t h, float scale, int flipY)
+{
+    sinm__kernels()->normalize(in, w, h, scale, flipY);
+}
+
+SINM_DEF sinm__inline void
+sinm_composite(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h)
+{
+    sinm__kernels()->composite(in1, in2, out, w, h);
+}
+
+SINM_DEF sinm__inline uint32_t*
+sinm_composite_alloc(const uint32_t* in1, const uint32_t* in2, int32_t w, int32_t h)
+{
+    uint32_t* result = (uint32_t*)malloc(sizeof(uint32_t) * w * h);
+    if (result) {
+        sinm_composite(in1, in2, result, w, h);
+    }
+    return result;
+}
+
+//NOTE: every job composites a band of rows
+typedef struct
+{
+    const uint32_t* const* in;
+    const float* weights;
+    int32_t count;
+    uint32_t* out;
+    size_t size;
+    size_t bandSize;
+    sinm_blend_type type;
+} sinm__composite_job;
+
+static void
+sinm__composite_band_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__composite_job* job = (sinm__composite_job*)data;
+    size_t start = (size_t)jobIndex * job->bandSize;
+    size_t end = sinm__min(job->size, start + job->bandSize);
+    sinm__kernels()->composite_layers(job->in, job->weights, job->count, job->out, start, end, job->type);
+}
+
+SINM_DEF void
+sinm_composite_layers_mt(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, int32_t w, int32_t h, sinm_blend_type type, int32_t threadCount)
+{
+    assert(in && count > 0);
+    assert(w > 0 && h > 0);
+    assert(type >= 0 && type < sinm_blend_count);
+    threadCount = sinm__thread_count(threadCount);
+
+    sinm__composite_job job;
+    job.in = in;
+    job.weights = weights;
+    job.count = count;
+    job.out = out;
+    job.size = (size_t)w * h;
+    job.type = type;
+
+    int32_t bandsPerThread = 4;
+    int32_t bandRows = (h + threadCount * bandsPerThread - 1) / (threadCount * bandsPerThread);
+    bandRows = sinm__max(bandRows, sinm__max(1, 16384 / w));
+    job.bandSize = (size_t)bandRows * w;
+    int32_t bandCount = (h + bandRows - 1) / bandRows;
+    sinm__parallel_for(sinm__composite_band_proc, &job, bandCount, threadCount);
+}
+
+SINM_DEF void
+sinm_composite_layers(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, int32_t w, int32_t h, sinm_blend_type type)
+{
+    sinm_composite_layers_mt(in, weights, count, out, w, h, type, 1);
+}
+
+SINM_DEF void
+sinm_greyscale(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+{
+    sinm__kernels()->greyscale(in, out, w, h, type);
+}
+
+#ifdef SI_NORMALMAP_GPU
+static const char* sinm__gaussian_blur_vert_shader_source = {
+
+    "#version 410 core\n"
+    "layout (location = 0) in vec3 iPos;\n"
+    "layout (location = 1) in vec2 iTexCoords;\n"
+    "out vec2 TexCoords;\n"
+    "void main(){\n"
+    "   TexCoords = iTexCoords;\n"
+    "   gl_Position = vec4(iPos, 1.0);\n"
+    "}\n"
+};
+static const char* sinm__gaussian_blur_frag_shader_source = {
+
+    "#version 410 core\n"
+    "out vec4 FragColor;\n"
+    "in vec2 TexCoords;\n"
+    "uniform sampler2D image;\n"
+    "uniform bool horizontal;\n"
+    "uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);\n"
+    "void main() {\n"
+    "    vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel\n"
+    "    vec3 result = texture(image, TexCoords).rgb * weight[0]; // current fragment's contribution\n"
+    "    if(horizontal) {\n"
+    "        for(int i = 1; i < 5; ++i) {\n"
+    "            result += texture(image, TexCoords + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];\n"
+    "            result += texture(image, TexCoords - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];\n"
+    "        }\n"
+    "    } else {\n"
+    "        for(int i = 1; i < 5; ++i) {\n"
+    "            result += texture(image, TexCoords + vec2(0.0, tex_offset.y * i)).rgb * weight[i];\n"
+    "            result += texture(image, TexCoords - vec2(0.0, tex_offset.y * i)).rgb * weight[i];\n"
+    "        }\n"
+    "    }\n"
+    "    FragColor = vec4(result, 1.0);\n"
+    "}\n"
+};
+
+typedef struct
+{
+    int initialized;
+    uint32_t inTex;
+    uint32_t quadVAO;
+    uint32_t pingpongFBO[2];
+    uint32_t pingpongBuffers[2];
+
+    uint32_t greyscaleAverageShader;
+    uint32_t greyscaleLuminanceShader;
+    uint32_t greyscaleLightnessShader;
+    uint32_t blurShader;
+    uint32_t normalMapShader;
+    uint32_t normalizeShader;
+    uint32_t compositeShader;
+} sinm__opengl_ctx;
+
+static sinm__opengl_ctx sinm__glCtx = { 0 };
+
+SINM_DEF void
+sinm_initialize_opengl()
+{
+    const float quadVertices[] = {
+        // positions        // texture Coords
+        -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, //1
+        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, //2
+        1.0f, 1.0f, 0.0f, 1.0f, 1.0f, //3
+        1.0f, -1.0f, 0.0f, 1.0f, 0.0f, //4
+    };
 
     if (!sinm__glCtx.initialized) {
         glGenTextures(1, &sinm__glCtx.inTex);
 
-        uint32_t quadVBO;
-        glGenVertexArrays(1, &sinm__glCtx.quadVAO);
-        glGenBuffers(1, &quadVBO);
-        glBindVertexArray(sinm__glCtx.quadVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        uint32_t quadVBO;
+        glGenVertexArrays(1, &sinm__glCtx.quadVAO);
+        glGenBuffers(1, &quadVBO);
+        glBindVertexArray(sinm__glCtx.quadVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+
+        GLuint vShader = glsys::create_shader(GL_VERTEX_SHADER, sinm__gaussian_blur_vert_shader_source);
+
+        {
+            std::string fCode = fsys::read_file<std::string>("shaders/greyscale_average.frag");
+            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
+            GLuint program = glsys::create_program(vShader, fShader);
+            assert(program != 0);
+            sinm__glCtx.greyscaleAverageShader = program;
+        }
+
+        {
+            std::string fCode = fsys::read_file<std::string>("shaders/greyscale_luminance.frag");
+            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
+            GLuint program = glsys::create_program(vShader, fShader);
+            assert(program != 0);
+            sinm__glCtx.greyscaleLuminanceShader = program;
+        }
+
+        {
+            std::string fCode = fsys::read_file<std::string>("shaders/greyscale_lightness.frag");
+            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
+            GLuint program = glsys::create_program(vShader, fShader);
+            assert(program != 0);
+            sinm__glCtx.greyscaleLightnessShader = program;
+        }
+
+        {
+            GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(fShader, 1, &sinm__gaussian_blur_frag_shader_source, NULL);
+            glCompileShader(fShader);
+            GLuint program = glCreateProgram();
+            glAttachShader(program, vShader);
+            glAttachShader(program, fShader);
+            glLinkProgram(program);
+            sinm__glCtx.blurShader = program;
+        }
+
+        {
+            std::string fCode = fsys::read_file<std::string>("shaders/normal_map.frag");
+            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
+            GLuint program = glsys::create_program(vShader, fShader);
+            assert(program != 0);
+            sinm__glCtx.normalMapShader = program;
+        }
+
+        {
+            std::string fCode = fsys::read_file<std::string>("shaders/normalize.frag");
+            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
+            GLuint program = glsys::create_program(vShader, fShader);
+            assert(program != 0);
+            sinm__glCtx.normalizeShader = program;
+        }
+
+        {
+            std::string fCode = fsys::read_file<std::string>("shaders/composite.frag");
+            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
+            GLuint program = glsys::create_program(vShader, fShader);
+            assert(program != 0);
+            sinm__glCtx.compositeShader = program;
+        }
+        sinm__glCtx.initialized = 1;
+        assert(!glsys::report_errors());
+    }
+}
+
+//NOTE: GPU -> RAM copy is slow. Only use this function if you really need to(such as writing the data to a file)
+SINM_DEF void
+sinm_gpu_normal_map_to_buffer(uint32_t* out, uint32_t inFBO, int32_t w, int32_t h)
+{
+    assert(inFBO != 0); //opengl context not initialized
+    assert(out);
+    assert(w > 0 && h > 0);
+
+    BEGIN_TIMER(gpu_to_buffer_copy)
+    glBindFramebuffer(GL_FRAMEBUFFER, inFBO);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, out);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    END_TIMER(gpu_to_buffer_copy)
+}
+
+SINM_DEF void
+sinm_composite_gpu(sinm_gpu_buffer outBuffer, const sinm_gpu_buffer* inBuffers, int32_t count, int32_t w, int32_t h)
+{
+    assert(sinm__glCtx.initialized);
+    assert(inBuffers);
+
+    if (count <= 1) {
+        return;
+    }
+
+    count = sinm__min(5, count);
+    glUseProgram(sinm__glCtx.compositeShader);
+    glViewport(0, 0, w, h);
+
+#define MAX_COMPOSITE_LAYERS 5
+    int texUnis[MAX_COMPOSITE_LAYERS] = {};
+    texUnis[0] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[0]");
+    texUnis[1] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[1]");
+    texUnis[2] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[2]");
+    texUnis[3] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[3]");
+    texUnis[4] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[4]");
+    for (int i = 0; i < count; ++i) {
+        glUniform1i(texUnis[i], i);
+    }
+
+    glUniform1i(glGetUniformLocation(sinm__glCtx.compositeShader, "numImages"), count);
+    glBindVertexArray(sinm__glCtx.quadVAO);
+    glBindFramebuffer(GL_FRAMEBUFFER, outBuffer.fbo);
+    for (int i = 0; i < count; ++i) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        uint32_t buffer = inBuffers[i].buffer;
+        glBindTexture(GL_TEXTURE_2D, buffer);
+    }
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//TODO optimize
+SINM_DEF void
+sinm__normal_map_gpu(const uint32_t* inBuffer, uint32_t outFBO, int32_t w, int32_t h, float scale, int numBlurPasses, sinm_greyscale_type greyscaleType, int flipY = 0)
+{
+    assert(sinm__glCtx.initialized);
+    assert(outFBO != 0);
+    assert(inBuffer);
+
+    glBindTexture(GL_TEXTURE_2D, sinm__glCtx.inTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, inBuffer);
+
+    glGenFramebuffers(2, sinm__glCtx.pingpongFBO);
+    glGenTextures(2, sinm__glCtx.pingpongBuffers);
+    for (unsigned int i = 0; i < 2; i++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, sinm__glCtx.pingpongFBO[i]);
+        glBindTexture(GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[i], 0);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glViewport(0, 0, w, h);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(sinm__glCtx.quadVAO);
+
+    if (greyscaleType != sinm_greyscale_none) {
+        switch (greyscaleType) {
+        case sinm_greyscale_average: {
+            glUseProgram(sinm__glCtx.greyscaleAverageShader);
+        } break;
+        case sinm_greyscale_luminance: {
+            glUseProgram(sinm__glCtx.greyscaleLuminanceShader);
+        } break;
+        case sinm_greyscale_lightness: {
+            glUseProgram(sinm__glCtx.greyscaleLightnessShader);
+        } break;
+        default: {
+            //INVALID OPTION
+            assert(false);
+        } break;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, sinm__glCtx.pingpongFBO[0]);
+        glBindTexture(GL_TEXTURE_2D, sinm__glCtx.inTex);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+
+    { //Blur passes
+        glUseProgram(sinm__glCtx.blurShader);
+        GLint texUni = glGetUniformLocation(sinm__glCtx.blurShader, "image");
+        GLint horizontalUni = glGetUniformLocation(sinm__glCtx.blurShader, "horizontal");
+        glUniform1i(texUni, 0);
+
+        int blurPasses = sinm__max(2, numBlurPasses * 2);
+        int horizontal = 1;
+        int firstIteration = 1;
+        for (int i = 0; i < blurPasses; ++i) {
+            glBindFramebuffer(GL_FRAMEBUFFER, sinm__glCtx.pingpongFBO[horizontal]);
+            glUniform1i(horizontalUni, horizontal);
+            glBindTexture(GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[!horizontal]);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            horizontal = !horizontal;
+            firstIteration = false;
+        }
+    }
+    assert(!glsys::report_errors());
+
+    { //Conversion to normal map
+        glUseProgram(sinm__glCtx.normalMapShader);
+        GLint texUni = glGetUniformLocation(sinm__glCtx.normalMapShader, "image");
+        GLint scaleUni = glGetUniformLocation(sinm__glCtx.normalMapShader, "scale");
+        GLint flipYUni = glGetUniformLocation(sinm__glCtx.normalMapShader, "flipY");
+        glUniform1i(texUni, 0);
+        glUniform1f(scaleUni, sinm__max(1.0f, scale));
+        float yDir = (flipY) ? -1.0f : 1.0f;
+
+        glUniform1f(flipYUni, yDir);
+        glBindFramebuffer(GL_FRAMEBUFFER, outFBO);
+        glBindTexture(GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[1]);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        assert(!glsys::report_errors());
+    }
+    assert(!glsys::report_errors());
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(0);
+}
+
+//Returns and opengl texture ID. To get the raw data use sinm_gpu_normal_map_to_buffer()
+//For best performance keep everything in GPU memory until you really need to access the data(such as writing it to a file)
+
+SINM_DEF sinm_gpu_buffer
+sinm_normal_map_gpu(const uint32_t* in, int32_t w, int32_t h, float scale, int numBlurPasses, sinm_greyscale_type greyscaleType, int flipY)
+{
+    assert(sinm__glCtx.initialized);
+    assert(w > 0 && h > 0);
+    assert(in);
+
+    scale = sinm__max(1.0f, scale);
+
+    sinm_gpu_buffer result = {};
+    glGenFramebuffers(1, &result.fbo);
+    glGenTextures(1, &result.buffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, result.fbo);
+    glBindTexture(GL_TEXTURE_2D, result.buffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, result.buffer, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    sinm__normal_map_gpu(in, result.fbo, w, h, scale, numBlurPasses, greyscaleType, flipY);
+
+    return result;
+}
+#endif //SINM_NORMALMAP_GPU
+
+//NOTE: Fused pipeline. Instead of running every pass over the full image, rows are
+//pulled through greyscale -> (horizontal blur -> vertical blur) x3 -> sobel one at a
+//time. Each vertical pass keeps a running sum per column and only needs a ring of
+//2 * radius + 2 rows from the previous pass so the working set stays in cache.
+//Produces exactly the same pixels as the full image passes.
+
+#define SINM__STREAM_MAX_PASSES 3
+#define SINM__STREAM_FINAL_ROWS 6 //rows of the widest gradient filter plus one
+
+typedef struct
+{
+    uint8_t* rows;
+    int32_t ringSize;
+    int32_t next; //next row to be produced
+} sinm__stream_ring;
+
+typedef struct
+{
+    const uint32_t* in;
+    size_t stride; //pixels from one input row to the next
+    int32_t w, h;
+    sinm_greyscale_type greyscaleType;
+    sinm_options options;
+
+    int32_t numPasses;
+    int32_t radii[SINM__STREAM_MAX_PASSES];
+    uint32_t reciprocals[SINM__STREAM_MAX_PASSES]; //sinm__box_reciprocal of every pass
+
+    //rings[i] holds the input rows of vertical pass i, rings[numPasses] the blurred rows
+    sinm__stream_ring rings[SINM__STREAM_MAX_PASSES + 1];
+    uint32_t* sums[SINM__STREAM_MAX_PASSES];
+    uint32_t* normals; //one row, for writing part of a row
+    uint8_t* temp;
+} sinm__stream;
+
+static int32_t
+sinm__stream_passes(int32_t w, int32_t h, float blurRadius, int32_t* radii)
+{
+    float radius = sinm__min(sinm__min(w, h), sinm__max(0, blurRadius));
+    if (radius < 1.0f) {
+        return 0;
+    }
+
+    float boxes[SINM__STREAM_MAX_PASSES];
+    sinm__generate_gaussian_box(boxes, SINM__STREAM_MAX_PASSES, radius);
+    for (int i = 0; i < SINM__STREAM_MAX_PASSES; ++i) {
+        radii[i] = (int32_t)((boxes[i] - 1) / 2);
+    }
+    return SINM__STREAM_MAX_PASSES;
+}
+
+//Scratch memory needed by the fused pipeline for rows "w" pixels wide of an
+//imageW x imageH image, in bytes. Rounded up to a cache line so per thread blocks
+//don't share one.
+static size_t
+sinm__stream_scratch_size(int32_t w, int32_t imageW, int32_t imageH, float blurRadius)
+{
+    int32_t radii[SINM__STREAM_MAX_PASSES];
+    int32_t numPasses = sinm__stream_passes(imageW, imageH, blurRadius, radii);
+
+    size_t size = (size_t)(numPasses + 1) * w * sizeof(uint32_t); //column sums and normals
+    size_t rows = 1 + SINM__STREAM_FINAL_ROWS;
+    for (int32_t i = 0; i < numPasses; ++i) {
+        rows += radii[i] * 2 + 2; //ring
+    }
+    size += rows * w;
+    return (size + 63) & ~(size_t)63;
+}
+
+//Streams a w x h window of an imageW x imageH image, "in" points at the window's first
+//pixel and rows are "stride" pixels apart.
+//NOTE: the blur radius is based on the full image size so a window produces exactly
+//the same pixels as the full image would.
+static void
+sinm__stream_init(sinm__stream* s, const uint32_t* in, size_t stride, uint8_t* scratch, int32_t w, int32_t h, int32_t imageW, int32_t imageH, float blurRadius, sinm_greyscale_type greyscaleType, const sinm_options* options)
+{
+    s->in = in;
+    s->stride = stride;
+    s->w = w;
+    s->h = h;
+    s->greyscaleType = greyscaleType;
+    s->options = *options;
+    s->numPasses = sinm__stream_passes(imageW, imageH, blurRadius, s->radii);
+    for (int32_t i = 0; i < s->numPasses; ++i) {
+        s->reciprocals[i] = sinm__box_reciprocal(s->radii[i], options->pipeline);
+    }
+
+    for (int32_t i = 0; i < s->numPasses; ++i) {
+        s->sums[i] = (uint32_t*)scratch;
+        scratch += w * sizeof(uint32_t);
+    }
+    s->normals = (uint32_t*)scratch;
+    scratch += w * sizeof(uint32_t);
+    s->temp = scratch;
+    scratch += w;
+    for (int32_t i = 0; i <= s->numPasses; ++i) {
+        sinm__stream_ring* ring = &s->rings[i];
+        ring->ringSize = (i < s->numPasses) ? s->radii[i] * 2 + 2 : SINM__STREAM_FINAL_ROWS;
+        ring->rows = scratch;
+        ring->next = 0;
+        scratch += ring->ringSize * w;
+    }
+}
+
+static sinm__inline uint8_t*
+sinm__stream_row(sinm__stream_ring* ring, int32_t y, int32_t w)
+{
+    return ring->rows + (y % ring->ringSize) * w;
+}
+
+static void sinm__stream_advance(sinm__stream* s, int32_t ringIndex, int32_t y);
+
+//Vertical box blur of row "y" of the pass feeding ring "pass + 1"
+static void
+sinm__stream_box_blur_v_row(sinm__stream* s, int32_t pass, int32_t y, uint8_t* out)
+{
+    int32_t w = s->w;
+    int32_t h = s->h;
+    int32_t r = s->radii[pass];
+    float invR = 1.0f / (r + r + 1);
+    uint32_t reciprocal = s->reciprocals[pass];
+    sinm__stream_ring* src = &s->rings[pass];
+    uint32_t* sums = s->sums[pass];
+
+    sinm__stream_advance(s, pass, sinm__min(h - 1, y + r));
+
+    if (y == 0) {
+        const uint8_t* first = sinm__stream_row(src, 0, w);
+        for (int32_t x = 0; x < w; ++x) {
+            sums[x] = first[x] * (r + 1);
+        }
+        for (int32_t j = 1; j <= r; ++j) {
+            const uint8_t* row = sinm__stream_row(src, sinm__min(h - 1, j), w);
+            for (int32_t x = 0; x < w; ++x) {
+                sums[x] += row[x];
+            }
+        }
+    } else {
+        const uint8_t* add = sinm__stream_row(src, sinm__min(h - 1, y + r), w);
+        const uint8_t* sub = sinm__stream_row(src, sinm__max(0, y - r - 1), w);
+        for (int32_t x = 0; x < w; ++x) {
+            sums[x] += add[x] - sub[x];
+        }
+    }
+
+    if (reciprocal) {
+        for (int32_t x = 0; x < w; ++x) {
+            out[x] = (uint8_t)(((uint64_t)sums[x] * reciprocal) >> 32);
+        }
+    } else {
+        for (int32_t x = 0; x < w; ++x) {
+            out[x] = (uint8_t)(sums[x] * invR);
+        }
+    }
+}
+
+//Makes sure every row up to and including "y" has been produced for the given ring
+static void
+sinm__stream_advance(sinm__stream* s, int32_t ringIndex, int32_t y)
+{
+    int32_t w = s->w;
+    sinm__stream_ring* ring = &s->rings[ringIndex];
+
+    for (; ring->next <= y; ++ring->next) {
+        int32_t row = ring->next;
+        uint8_t* dst = sinm__stream_row(ring, row, w);
+        uint8_t* src = (ringIndex < s->numPasses) ? s->temp : dst;
+
+        if (ringIndex == 0) {
+            sinm__kernels()->heights(s->in + row * s->stride, src, w, 1, s->greyscaleType);
+        } else {
+            sinm__stream_box_blur_v_row(s, ringIndex - 1, row, src);
+        }
+
+        if (ringIndex < s->numPasses) {
+            int32_t r = s->radii[ringIndex];
+            if (s->reciprocals[ringIndex]) {
+                sinm__kernels()->box_blur_h_fixed(src, dst, w, 1, r);
+            } else {
+                sinm__kernels()->box_blur_h(src, dst, w, 1, (float)r);
+            }
+        }
+    }
+}
+
+//Writes columns [xs, xe) of normal map rows [ys, ye) to "out", which points at column xs
+//of row ys. Output rows are "outStride" pixels apart.
+static void
+sinm__stream_normals(sinm__stream* s, uint32_t* out, size_t outStride, int32_t ys, int32_t ye, int32_t xs, int32_t xe, float scale, int flipY)
+{
+    int32_t w = s->w;
+    int32_t h = s->h;
+    sinm__stream_ring* blurred = &s->rings[s->numPasses];
+    sinm__gradient_row_proc* rowKernel = sinm__gradient_row_kernel(sinm__kernels(), &s->options);
+    int32_t radius = sinm__gradient_filters[s->options.gradient].radius;
+
+    for (int32_t y = ys; y < ye; ++y) {
+        //NOTE: the gradient kernels read rows clamped to [1, h - 1]
+        sinm__stream_advance(s, s->numPasses, sinm__min(h - 1, sinm__max(1, y + radius)));
+
+        const uint8_t* rows[5];
+        for (int32_t a = 0; a < radius * 2 + 1; ++a) {
+            rows[a] = sinm__stream_row(blurred, sinm__min(h - 1, sinm__max(1, y + a - radius)), w);
+        }
+
+        uint32_t* dst = out + (size_t)(y - ys) * outStride;
+        if (xs == 0 && xe == w) {
+            rowKernel(rows, dst, w, scale, flipY);
+        } else {
+            rowKernel(rows, s->normals, w, scale, flipY);
+            memcpy(dst, s->normals + xs, (xe - xs) * sizeof(uint32_t));
+        }
+    }
+}
+
+typedef struct
+{
+    const uint32_t* in;
+    uint32_t* out;
+    uint8_t* heights;
+    int32_t w, h;
+    int32_t jobSize;
+    float scale;
+    sinm_greyscale_type greyscaleType;
+    sinm_options options;
+    int flipY;
+} sinm__frame_job;
+
+static void
+sinm__frame_heights_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__frame_job* job = (sinm__frame_job*)data;
+    int32_t y0 = jobIndex * job->jobSize;
+    int32_t y1 = sinm__min(job->h, y0 + job->jobSize);
+    size_t offset = (size_t)y0 * job->w;
+    sinm__kernels()->heights(job->in + offset, job->heights + offset, job->w, y1 - y0, job->greyscaleType);
+}
+
+static void
+sinm__frame_normals_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__frame_job* job = (sinm__frame_job*)data;
+    int32_t y0 = jobIndex * job->jobSize;
+    int32_t y1 = sinm__min(job->h, y0 + job->jobSize);
+    sinm__gradient_normals_simd(job->heights, job->out, job->w, job->h, y0, y1, job->scale, job->flipY, &job->options);
+}
+
+//Runs the whole pipeline on "h" rows of an image that is "imageH" rows tall.
+//The rows can be a band of a larger image in which case the first and last few
+//rows of the result are not valid(see sinm__normal_map_halo).
+//"heights" is scratch memory for two w * h height fields and "blurScratch" is passed
+//on to sinm__blur_heights. Every pass is split into jobs of rows for up to
+//"threadCount" threads. Returns 0 if the blur could not allocate its scratch memory.
+//NOTE: the blur radius is based on the full image size so a band
+//produces exactly the same pixels as the full image would.
+static int
+sinm__normal_map_rows(const uint32_t* in, uint32_t* out, uint8_t* heights, int32_t w, int32_t h, int32_t imageH, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, double* blurScratch, const sinm_options* options)
+{
+    sinm__frame_job job;
+    job.in = in;
+    job.out = out;
+    job.heights = heights;
+    job.w = w;
+    job.h = h;
+    job.jobSize = 64;
+    job.scale = scale;
+    job.greyscaleType = greyscaleType;
+    job.options = *options;
+    job.flipY = flipY;
+    int32_t jobCount = (h + job.jobSize - 1) / job.jobSize;
+
+    sinm__parallel_for(sinm__frame_heights_proc, &job, jobCount, threadCount);
+
+    float radius = sinm__min(sinm__min(w, imageH), sinm__max(0, blurRadius));
+    if (radius >= 1.0f && !sinm__blur_heights(heights, heights + (size_t)w * h, w, h, radius, threadCount, blurScratch, options)) {
+        return 0;
+    }
+
+    sinm__parallel_for(sinm__frame_normals_proc, &job, jobCount, threadCount);
+    return 1;
+}
+
+//Number of rows above and below a band that are needed to produce exact results
+//for the band. Each box blur pass can read "box radius" rows past the edge and
+//the gradient kernel needs one more than its radius since it never reads the first
+//row of its input.
+static int32_t
+sinm__normal_map_halo(int32_t w, int32_t h, float blurRadius, sinm_gradient_type gradient)
+{
+    int32_t halo = sinm__gradient_filters[gradient].radius + 1;
+    float radius = sinm__min(sinm__min(w, h), sinm__max(0, blurRadius));
+    if (radius >= 1.0f) {
+        float boxes[3];
+        sinm__generate_gaussian_box(boxes, sizeof(boxes) / sizeof(boxes[0]), radius);
+        for (int i = 0; i < 3; ++i) {
+            halo += (int32_t)ceilf((boxes[i] - 1) / 2);
+        }
+    }
+    return halo;
+}
+
+//sinm_normal_map_buffer on one thread with resolved options
+static int
+sinm__normal_map_frame(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    uint8_t* heights = (uint8_t*)malloc((size_t)w * h * 2);
+
+    if (heights) {
+        int result = sinm__normal_map_rows(in, out, heights, w, h, h, scale, blurRadius, greyscaleType, flipY, 1, NULL, options);
+        free(heights);
+        return result;
+    }
+    return 0;
+}
+
+SINM_DEF size_t
+sinm_normal_map_scratch_size_ex(int32_t w, int32_t h, float blurRadius, const sinm_options* options)
+{
+    sinm_options o = sinm__resolve_options(options);
+    size_t size = 63 + (((size_t)w * h * 2 + 63) & ~(size_t)63);
+    float radius = sinm__min(sinm__min(w, h), sinm__max(0, blurRadius));
+    if (radius >= 1.0f && o.blur == sinm_blur_recursive) {
+        size += sinm__recursive_blur_scratch_size(w, h) * sizeof(double);
+    }
+    return size;
+}
+
+SINM_DEF size_t
+sinm_normal_map_scratch_size(int32_t w, int32_t h, float blurRadius)
+{
+    return sinm_normal_map_scratch_size_ex(w, h, blurRadius, NULL);
+}
+
+#ifdef SI_MEMORY_HEADER_GAURD
+//Pushes "size" bytes that already include 63 bytes for rounding the start up to 64.
+//Returns NULL and leaves the arena alone if they don't fit.
+static uint8_t*
+sinm__arena_push(si_memory_arena* arena, size_t size)
+{
+    if ((size_t)(arena->size - arena->used) < size) {
+        return NULL;
+    }
+    uint8_t* result = (uint8_t*)(((uintptr_t)(arena->base + arena->used) + 63) & ~(uintptr_t)63);
+    arena->used += size;
+    return result;
+}
+
+SINM_DEF int
+sinm_normal_map_buffer_arena_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, si_memory_arena* arena, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    sinm_options o = sinm__resolve_options(options);
+    si_size used = arena->used;
+    uint8_t* heights = sinm__arena_push(arena, sinm_normal_map_scratch_size_ex(w, h, blurRadius, &o));
+    if (!heights) {
+        return 0;
+    }
+
+    //NOTE: the recursive blur's scratch follows the two height fields
+    double* blurScratch = (double*)(heights + (((size_t)w * h * 2 + 63) & ~(size_t)63));
+    int result = sinm__normal_map_rows(in, out, heights, w, h, h, scale, blurRadius, greyscaleType, flipY, 1, blurScratch, &o);
+    arena->used = used;
+    return result;
+}
+
+SINM_DEF int
+sinm_normal_map_buffer_arena(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, si_memory_arena* arena)
+{
+    return sinm_normal_map_buffer_arena_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, arena, NULL);
+}
+
+SINM_DEF uint32_t*
+sinm_normal_map_arena(const uint32_t* in, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, si_memory_arena* arena)
+{
+    si_size used = arena->used;
+    uint32_t* result = (uint32_t*)sinm__arena_push(arena, (size_t)w * h * sizeof(uint32_t) + 63);
+    if (result && sinm_normal_map_buffer_arena(in, result, w, h, scale, blurRadius, greyscaleType, flipY, arena)) {
+        return result;
+    }
+    arena->used = used;
+    return NULL;
+}
+#endif //SI_MEMORY_HEADER_GAURD
+
+SINM_DEF int
+sinm_normal_map_buffer_streaming_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    sinm_options o = sinm__resolve_options(options);
+    uint8_t* scratch = (uint8_t*)malloc(sinm__stream_scratch_size(w, w, h, blurRadius));
+
+    if (scratch) {
+        sinm__stream stream;
+        sinm__stream_init(&stream, in, w, scratch, w, h, w, h, blurRadius, greyscaleType, &o);
+        sinm__stream_normals(&stream, out, w, 0, h, 0, w, scale, flipY);
+        free(scratch);
+        return 1;
+    }
+    return 0;
+}
+
+SINM_DEF int
+sinm_normal_map_buffer_streaming(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY)
+{
+    return sinm_normal_map_buffer_streaming_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, NULL);
+}
+
+typedef struct
+{
+    const uint32_t* in;
+    uint32_t* out;
+    uint8_t* scratch;
+    size_t scratchSize;
+    int32_t w, h;
+    int32_t bandRows;
+    int32_t halo;
+    float scale;
+    float blurRadius;
+    sinm_greyscale_type greyscaleType;
+    sinm_options options;
+    int flipY;
+} sinm__band_job;
+
+//NOTE: every band is streamed through the fused pipeline so a thread only needs a
+//few rows of scratch memory. The halo rows are blurred but never run through sobel.
+static void
+sinm__normal_map_band_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__band_job* job = (sinm__band_job*)data;
+    int32_t w = job->w;
+    int32_t y0 = jobIndex * job->bandRows;
+    int32_t y1 = sinm__min(job->h, y0 + job->bandRows);
+    int32_t s0 = sinm__max(0, y0 - job->halo);
+    int32_t s1 = sinm__min(job->h, y1 + job->halo);
+
+    sinm__stream stream;
+    sinm__stream_init(&stream, job->in + (size_t)s0 * w, w, job->scratch + threadIndex * job->scratchSize,
+        w, s1 - s0, w, job->h, job->blurRadius, job->greyscaleType, &job->options);
+    sinm__stream_normals(&stream, job->out + (size_t)y0 * w, w, y0 - s0, y1 - s0, 0, w, job->scale, job->flipY);
+}
+
+SINM_DEF int
+sinm_normal_map_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    sinm_options o = sinm__resolve_options(options);
+    threadCount = sinm__thread_count(threadCount);
+
+    //NOTE: the recursive blur needs whole columns so there are no bands. It blurs in
+    //place, the second height field of sinm__normal_map_rows is only for the box blur.
+    if (o.blur == sinm_blur_recursive) {
+        uint8_t* heights = (uint8_t*)malloc((size_t)w * h);
+        if (!heights) {
+            return 0;
+        }
+        int result = sinm__normal_map_rows(in, out, heights, w, h, h, scale, blurRadius, greyscaleType, flipY, threadCount, NULL, &o);
+        free(heights);
+        return result;
+    }
+
+    sinm__band_job job;
+    job.in = in;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    job.options = o;
+    job.halo = sinm__normal_map_halo(w, h, blurRadius, o.gradient);
+    job.scale = scale;
+    job.blurRadius = blurRadius;
+    job.greyscaleType = greyscaleType;
+    job.flipY = flipY;
+
+    //NOTE: a few bands per thread for load balancing but keep them tall enough
+    //that the halo rows don't dominate the work
+    int32_t bandsPerThread = 4;
+    job.bandRows = (h + threadCount * bandsPerThread - 1) / (threadCount * bandsPerThread);
+    job.bandRows = sinm__max(job.bandRows, sinm__max(16, job.halo * 4));
+
+    int32_t bandCount = (h + job.bandRows - 1) / job.bandRows;
+    if (threadCount == 1 || bandCount == 1) {
+        return sinm__normal_map_frame(in, out, w, h, scale, blurRadius, greyscaleType, flipY, &o);
+    }
+
+    threadCount = sinm__min(threadCount, bandCount);
+    job.scratchSize = sinm__stream_scratch_size(w, w, h, blurRadius);
+    job.scratch = (uint8_t*)malloc(threadCount * job.scratchSize);
+    if (!job.scratch) {
+        return 0;
+    }
+
+    sinm__parallel_for(sinm__normal_map_band_proc, &job, bandCount, threadCount);
+
+    free(job.scratch);
+    return 1;
+}
+
+SINM_DEF int
+sinm_normal_map_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount)
+{
+    return sinm_normal_map_buffer_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_normal_map_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY)
+{
+    return sinm_normal_map_buffer_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, 1, NULL);
+}
+
+typedef struct
+{
+    const uint32_t* in;
+    uint32_t* out;
+    uint8_t* scratch;
+    size_t scratchSize;
+    int32_t w, h;
+    int32_t tileW, tileH;
+    int32_t tilesX;
+    int32_t halo;
+    float scale;
+    float blurRadius;
+    sinm_greyscale_type greyscaleType;
+    sinm_options options;
+    int flipY;
+    const sinm_rect* rects; //tiles of sinm_normal_map_update
+} sinm__tile_job;
+
+//NOTE: same as the bands of sinm_normal_map_buffer_mt but the halo also goes left and
+//right. Only the tile's own columns of the normal rows are written.
+static void
+sinm__normal_map_rect(sinm__tile_job* job, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t threadIndex)
+{
+    int32_t sx0 = sinm__max(0, x0 - job->halo);
+    int32_t sy0 = sinm__max(0, y0 - job->halo);
+    int32_t sx1 = sinm__min(job->w, x1 + job->halo);
+    int32_t sy1 = sinm__min(job->h, y1 + job->halo);
+
+    sinm__stream stream;
+    sinm__stream_init(&stream, job->in + (size_t)sy0 * job->w + sx0, job->w, job->scratch + threadIndex * job->scratchSize,
+        sx1 - sx0, sy1 - sy0, job->w, job->h, job->blurRadius, job->greyscaleType, &job->options);
+    sinm__stream_normals(&stream, job->out + (size_t)y0 * job->w + x0, job->w, y0 - sy0, y1 - sy0, x0 - sx0, x1 - sx0, job->scale, job->flipY);
+}
+
+static void
+sinm__normal_map_tile_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__tile_job* job = (sinm__tile_job*)data;
+    int32_t x0 = (jobIndex % job->tilesX) * job->tileW;
+    int32_t y0 = (jobIndex / job->tilesX) * job->tileH;
+    sinm__normal_map_rect(job, x0, y0, sinm__min(job->w, x0 + job->tileW), sinm__min(job->h, y0 + job->tileH), threadIndex);
+}
+
+static void
+sinm__normal_map_rects_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__tile_job* job = (sinm__tile_job*)data;
+    const sinm_rect* r = &job->rects[jobIndex];
+    sinm__normal_map_rect(job, r->x, r->y, r->x + r->w, r->y + r->h, threadIndex);
+}
+
+SINM_DEF int
+sinm_normal_map_tiled_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, size_t memoryBudget, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    sinm_options o = sinm__resolve_options(options);
+    threadCount = sinm__thread_count(threadCount);
+
+    sinm__tile_job job;
+    job.in = in;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    job.options = o;
+    job.halo = sinm__normal_map_halo(w, h, blurRadius, o.gradient);
+    job.scale = scale;
+    job.blurRadius = blurRadius;
+    job.greyscaleType = greyscaleType;
+    job.flipY = flipY;
+
+    //NOTE: the scratch memory of a tile only depends on its width, tiles are as wide
+    //as the budget allows. Narrower than this and the halo columns cost more than the tile.
+    int32_t minTileW = sinm__min(w, 64);
+    size_t minScratch = sinm__stream_scratch_size(sinm__min(w, minTileW + 2 * job.halo), w, h, blurRadius);
+    threadCount = (int32_t)sinm__min((size_t)threadCount, memoryBudget / minScratch);
+    if (threadCount < 1) {
+        return 0;
+    }
+
+    size_t columnBytes = sinm__stream_scratch_size(1024, w, h, blurRadius) / 1024;
+    size_t budgetW = memoryBudget / threadCount / columnBytes;
+    job.tileW = w;
+    if (budgetW < (size_t)w + 64) {
+        job.tileW = sinm__max(minTileW, ((int32_t)budgetW - 2 * job.halo - 64) & ~63);
+    }
+    job.tileH = sinm__min(h, sinm__max(256, job.halo * 8));
+    job.tilesX = (w + job.tileW - 1) / job.tileW;
+    int32_t tilesY = (h + job.tileH - 1) / job.tileH;
+
+    job.scratchSize = sinm__stream_scratch_size(sinm__min(w, job.tileW + 2 * job.halo), w, h, blurRadius);
+    job.scratch = (uint8_t*)malloc(threadCount * job.scratchSize);
+    if (!job.scratch) {
+        return 0;
+    }
+
+    //NOTE: tiles are handed out row by row so the threads work on neighbouring tiles
+    //and the mapped pages of a band of rows can be dropped once it is done
+    int64_t tileCount = (int64_t)job.tilesX * tilesY;
+    assert(tileCount <= INT32_MAX);
+    sinm__parallel_for(sinm__normal_map_tile_proc, &job, (int32_t)tileCount, threadCount);
+
+    free(job.scratch);
+    return 1;
+}
+
+SINM_DEF int
+sinm_normal_map_tiled(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, size_t memoryBudget, int32_t threadCount)
+{
+    return sinm_normal_map_tiled_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, memoryBudget, threadCount, NULL);
+}
+
+static sinm__inline int
+sinm__rects_overlap(sinm_rect a, sinm_rect b)
+{
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static sinm__inline sinm_rect
+sinm__rects_union(sinm_rect a, sinm_rect b)
+{
+    sinm_rect result;
+    result.x = sinm__min(a.x, b.x);
+    result.y = sinm__min(a.y, b.y);
+    result.w = sinm__max(a.x + a.w, b.x + b.w) - result.x;
+    result.h = sinm__max(a.y + a.h, b.y + b.h) - result.y;
+    return result;
+}
+
+SINM_DEF int
+sinm_normal_map_update_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_rect* dirty, int32_t dirtyCount, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0 && dirtyCount >= 0);
+    sinm_options o = sinm__resolve_options(options);
+    if (o.blur == sinm_blur_recursive) {
+        return sinm_normal_map_buffer_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, threadCount, &o);
+    }
+    threadCount = sinm__thread_count(threadCount);
+
+    sinm__tile_job job;
+    job.in = in;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    job.options = o;
+    job.halo = sinm__normal_map_halo(w, h, blurRadius, o.gradient);
+    job.scale = scale;
+    job.blurRadius = blurRadius;
+    job.greyscaleType = greyscaleType;
+    job.flipY = flipY;
+
+    //NOTE: the rectangles grow by the halo to cover every normal the change reaches and
+    //the ones that overlap are merged so no pixel is written by two threads
+    sinm_rect* regions = (sinm_rect*)malloc(sinm__max(1, dirtyCount) * sizeof(sinm_rect));
+    if (!regions) {
+        return 0;
+    }
+    int32_t regionCount = 0;
+    for (int32_t i = 0; i < dirtyCount; ++i) {
+        if (dirty[i].w <= 0 || dirty[i].h <= 0) {
+            continue;
+        }
+        sinm_rect r;
+        r.x = sinm__max(0, dirty[i].x - job.halo);
+        r.y = sinm__max(0, dirty[i].y - job.halo);
+        r.w = sinm__min(w, dirty[i].x + dirty[i].w + job.halo) - r.x;
+        r.h = sinm__min(h, dirty[i].y + dirty[i].h + job.halo) - r.y;
+        if (r.w <= 0 || r.h <= 0) {
+            continue;
+        }
+        //NOTE: the regions so far don't overlap each other, only "r" has to be checked
+        //again against all of them once it grew
+        for (int32_t j = 0; j < regionCount; ++j) {
+            if (sinm__rects_overlap(regions[j], r)) {
+                r = sinm__rects_union(regions[j], r);
+                regions[j] = regions[--regionCount];
+                j = -1;
+            }
+        }
+        regions[regionCount++] = r;
+    }
+
+    //NOTE: the regions are cut into tiles like sinm_normal_map_tiled so big ones still
+    //spread over the threads
+    int32_t tileW = sinm__max(256, job.halo * 4);
+    int32_t tileH = sinm__max(64, job.halo * 4);
+    int32_t tileCount = 0;
+    for (int32_t i = 0; i < regionCount; ++i) {
+        tileCount += ((regions[i].w + tileW - 1) / tileW) * ((regions[i].h + tileH - 1) / tileH);
+    }
+
+    int result = 1;
+    sinm_rect* tiles = (sinm_rect*)malloc(sinm__max(1, tileCount) * sizeof(sinm_rect));
+    threadCount = sinm__max(1, sinm__min(threadCount, tileCount));
+    job.scratchSize = sinm__stream_scratch_size(sinm__min(w, tileW + 2 * job.halo), w, h, blurRadius);
+    job.scratch = (uint8_t*)malloc(threadCount * job.scratchSize);
+    if (tiles && job.scratch) {
+        int32_t t = 0;
+        for (int32_t i = 0; i < regionCount; ++i) {
+            for (int32_t y = 0; y < regions[i].h; y += tileH) {
+                for (int32_t x = 0; x < regions[i].w; x += tileW) {
+                    tiles[t].x = regions[i].x + x;
+                    tiles[t].y = regions[i].y + y;
+                    tiles[t].w = sinm__min(tileW, regions[i].w - x);
+                    tiles[t].h = sinm__min(tileH, regions[i].h - y);
+                    ++t;
+                }
+            }
+        }
+        job.rects = tiles;
+        sinm__parallel_for(sinm__normal_map_rects_proc, &job, tileCount, threadCount);
+    } else {
+        result = 0;
+    }
+
+    free(job.scratch);
+    free(tiles);
+    free(regions);
+    return result;
+}
+
+SINM_DEF int
+sinm_normal_map_update(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, const sinm_rect* dirty, int32_t dirtyCount, int32_t threadCount)
+{
+    return sinm_normal_map_update_ex(in, out, w, h, scale, blurRadius, greyscaleType, flipY, dirty, dirtyCount, threadCount, NULL);
+}
+
+//NOTE: the summed area table has a row and a column of zeros in front so entry
+//(x, y) is the sum of the heights above and to the left of pixel(x, y). It is 32 bits
+//and wraps around on big images, that is fine as long as every box sum fits: the blur
+//radius is capped at SINM__SAT_MAX_RADIUS and reads boxes one pixel wider, so at most
+//2049 * 2049 heights of 255 which is below 2^31. Heights wider than 8 bits don't fit,
+//a 16 bit masked path needs 64 bit sums or a smaller cap, the typedef below fails to
+//compile if the bound is broken.
+typedef char sinm__sat_box_sums_fit[((2 * (SINM__SAT_MAX_RADIUS + 1) + 1) * (2 * (SINM__SAT_MAX_RADIUS + 1) + 1) * (uint64_t)SINM__SAT_MAX_HEIGHT < ((uint64_t)1 << 31)) ? 1 : -1];
+
+typedef struct
+{
+    const uint8_t* heights;
+    const uint8_t* mask;
+    uint8_t* out;
+    uint32_t* sat;
+    int32_t w, h;
+    float sigmaScale;
+} sinm__sat_job;
+
+static void
+sinm__sat_rows_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__sat_job* job = (sinm__sat_job*)data;
+    int32_t ys = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t ye = sinm__min(job->h, ys + SINM__BLUR_STRIP_WIDTH);
+    sinm__kernels()->sat_rows(job->heights, job->sat, job->w, ys, ye);
+}
+
+static void
+sinm__sat_columns_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__sat_job* job = (sinm__sat_job*)data;
+    int32_t xs = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t xe = sinm__min(job->w, xs + SINM__BLUR_STRIP_WIDTH);
+    sinm__kernels()->sat_columns(job->sat, job->w, job->h, xs, xe);
+}
+
+static void
+sinm__sat_blur_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__sat_job* job = (sinm__sat_job*)data;
+    const sinm__kernel_table* kernels = sinm__kernels();
+    int32_t ys = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t ye = sinm__min(job->h, ys + SINM__BLUR_STRIP_WIDTH);
+    for (int32_t y = ys; y < ye; ++y) {
+        kernels->sat_blur_row(job->sat, job->mask, job->out, job->w, job->h, y, job->sigmaScale);
+    }
+}
+
+SINM_DEF int
+sinm_normal_map_masked_buffer_ex(const uint32_t* in, const uint32_t* mask, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    //NOTE: the table lookups use 32 bit offsets of up to SINM__SAT_MAX_RADIUS + 2 rows
+    assert(w > 0 && h > 0 && w < INT32_MAX / (SINM__SAT_MAX_RADIUS + 2) - 1);
+    threadCount = sinm__thread_count(threadCount);
+
+    size_t size = (size_t)w * h;
+    size_t satSize = ((size_t)w + 1) * ((size_t)h + 1);
+    uint8_t* memory = (uint8_t*)malloc(satSize * sizeof(uint32_t) + size * 2);
+    if (!memory) {
+        return 0;
+    }
+
+    sinm__sat_job sat;
+    sat.sat = (uint32_t*)memory;
+    uint8_t* heights = memory + satSize * sizeof(uint32_t);
+    uint8_t* maskHeights = heights + size;
+    sat.heights = heights;
+    sat.mask = maskHeights;
+    sat.out = heights;
+    sat.w = w;
+    sat.h = h;
+    sat.sigmaScale = sinm__max(0, blurRadius) / 255.0f;
+
+    sinm__frame_job frame;
+    frame.in = mask;
+    frame.out = out;
+    frame.heights = maskHeights;
+    frame.w = w;
+    frame.h = h;
+    frame.jobSize = SINM__BLUR_STRIP_WIDTH;
+    frame.scale = scale;
+    frame.greyscaleType = sinm_greyscale_none;
+    frame.options = sinm__resolve_options(options);
+    frame.flipY = flipY;
+    int32_t rowJobs = (h + SINM__BLUR_STRIP_WIDTH - 1) / SINM__BLUR_STRIP_WIDTH;
+    int32_t columnJobs = (w + SINM__BLUR_STRIP_WIDTH - 1) / SINM__BLUR_STRIP_WIDTH;
+
+    sinm__parallel_for(sinm__frame_heights_proc, &frame, rowJobs, threadCount);
+    frame.in = in;
+    frame.heights = heights;
+    frame.greyscaleType = greyscaleType;
+    sinm__parallel_for(sinm__frame_heights_proc, &frame, rowJobs, threadCount);
+
+    memset(sat.sat, 0, (w + 1) * sizeof(uint32_t));
+    sinm__parallel_for(sinm__sat_rows_proc, &sat, rowJobs, threadCount);
+    sinm__parallel_for(sinm__sat_columns_proc, &sat, columnJobs, threadCount);
+    //NOTE: the heights are in the table now, the blurred ones replace them
+    sinm__parallel_for(sinm__sat_blur_proc, &sat, rowJobs, threadCount);
+    sinm__parallel_for(sinm__frame_normals_proc, &frame, rowJobs, threadCount);
+
+    free(memory);
+    return 1;
+}
+
+SINM_DEF int
+sinm_normal_map_masked_buffer_mt(const uint32_t* in, const uint32_t* mask, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount)
+{
+    return sinm_normal_map_masked_buffer_ex(in, mask, out, w, h, scale, blurRadius, greyscaleType, flipY, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_normal_map_masked_buffer(const uint32_t* in, const uint32_t* mask, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY)
+{
+    return sinm_normal_map_masked_buffer_ex(in, mask, out, w, h, scale, blurRadius, greyscaleType, flipY, 1, NULL);
+}
+
+//NOTE: multi-scale normal maps. Every level of the pyramid is kept and the normals
+//are made in one pass over all of them.
+typedef struct
+{
+    const uint8_t* const* levels;
+    const float* scales;
+    const uint8_t** rows; //5 row pointers per level for every thread
+    int32_t levelCount;
+    uint32_t* out;
+    int32_t w, h;
+    int32_t jobSize;
+    sinm_gradient_type gradient;
+    int flipY;
+} sinm__multiscale_job;
+
+static void
+sinm__multiscale_normals_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__multiscale_job* job = (sinm__multiscale_job*)data;
+    const sinm__kernel_table* kernels = sinm__kernels();
+    int32_t radius = sinm__gradient_filters[job->gradient].radius;
+    const uint8_t** rows = job->rows + (size_t)threadIndex * job->levelCount * 5;
+    int32_t y0 = jobIndex * job->jobSize;
+    int32_t y1 = sinm__min(job->h, y0 + job->jobSize);
+    for (int32_t y = y0; y < y1; ++y) {
+        for (int32_t l = 0; l < job->levelCount; ++l) {
+            sinm__gradient_rows(job->levels[l], rows + l * 5, y, job->w, job->h, radius);
+        }
+        kernels->gradient_levels_row[job->gradient](rows, job->scales, job->levelCount, job->out + (size_t)y * job->w, job->w, job->flipY);
+    }
+}
+
+SINM_DEF int
+sinm_normal_map_multiscale_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, const sinm_octave* octaves, int32_t octaveCount, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    assert(octaves && octaveCount > 0);
+    sinm_options o = sinm__resolve_options(options);
+    threadCount = sinm__thread_count(threadCount);
+
+    //NOTE: temp for the blur followed by one height field per level, worst case the
+    //unblurred heights and one level for every octave
+    int32_t maxLevels = octaveCount + 1;
+    size_t levelSize = ((size_t)w * h + 63) & ~(size_t)63;
+    size_t heightsSize = levelSize * (maxLevels + 1);
+    size_t octavesSize = octaveCount * sizeof(sinm_octave) + maxLevels * (sizeof(uint8_t*) + sizeof(float));
+    size_t rowsSize = (size_t)threadCount * maxLevels * 5 * sizeof(uint8_t*);
+    uint8_t* memory = (uint8_t*)malloc(heightsSize + octavesSize + rowsSize);
+    if (!memory) {
+        return 0;
+    }
+    uint8_t* temp = memory;
+    sinm_octave* sorted = (sinm_octave*)(memory + heightsSize);
+    uint8_t** levels = (uint8_t**)(sorted + octaveCount);
+    float* scales = (float*)(levels + maxLevels);
+
+    //NOTE: radii are clamped like in sinm__normal_map_rows and sorted
+    for (int32_t i = 0; i < octaveCount; ++i) {
+        sinm_octave octave = octaves[i];
+        octave.blurRadius = sinm__min(sinm__min(w, h), sinm__max(0, octave.blurRadius));
+        int32_t j = i;
+        for (; j > 0 && sorted[j - 1].blurRadius > octave.blurRadius; --j) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = octave;
+    }
+
+    sinm__frame_job frame;
+    frame.in = in;
+    frame.heights = memory + levelSize;
+    frame.w = w;
+    frame.h = h;
+    frame.jobSize = 64;
+    frame.greyscaleType = greyscaleType;
+    int32_t jobCount = (h + frame.jobSize - 1) / frame.jobSize;
+    sinm__parallel_for(sinm__frame_heights_proc, &frame, jobCount, threadCount);
+
+    //NOTE: every level is blurred from the one before it by the difference of their radii.
+    //Octaves whose level would not change(the step is below 1 like blurRadius below 1 in
+    //sinm_normal_map) share the level.
+    int32_t levelCount = 1;
+    float blurred = 0.0f;
+    levels[0] = memory + levelSize;
+    scales[0] = 0.0f;
+    for (int32_t i = 0; i < octaveCount; ++i) {
+        float radius = sorted[i].blurRadius;
+        float step = sqrtf(radius * radius - blurred * blurred);
+        if (step >= 1.0f) {
+            uint8_t* level = memory + levelSize * (levelCount + 1);
+            memcpy(level, levels[levelCount - 1], (size_t)w * h);
+            if (!sinm__blur_heights(level, temp, w, h, step, threadCount, NULL, &o)) {
+                free(memory);
+                return 0;
+            }
+            levels[levelCount] = level;
+            scales[levelCount] = 0.0f;
+            ++levelCount;
+            blurred = radius;
+        }
+        scales[levelCount - 1] += scale * sorted[i].weight;
+    }
+
+    sinm__multiscale_job job;
+    job.levels = (const uint8_t* const*)levels;
+    job.scales = scales;
+    job.rows = (const uint8_t**)(memory + heightsSize + octavesSize);
+    job.levelCount = levelCount;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    job.jobSize = frame.jobSize;
+    job.gradient = o.gradient;
+    job.flipY = flipY;
+    sinm__parallel_for(sinm__multiscale_normals_proc, &job, jobCount, threadCount);
+
+    free(memory);
+    return 1;
+}
+
+SINM_DEF int
+sinm_normal_map_multiscale_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, const sinm_octave* octaves, int32_t octaveCount, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount)
+{
+    return sinm_normal_map_multiscale_buffer_ex(in, out, w, h, scale, octaves, octaveCount, greyscaleType, flipY, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_normal_map_multiscale_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, const sinm_octave* octaves, int32_t octaveCount, sinm_greyscale_type greyscaleType, int flipY)
+{
+    return sinm_normal_map_multiscale_buffer_ex(in, out, w, h, scale, octaves, octaveCount, greyscaleType, flipY, 1, NULL);
+}
+
+//Normals for the rows in [ys, ye) of a w * h 16 bit height field
+static void
+sinm__gradient_normals16(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, int32_t ys, int32_t ye, float scale, int flipY, sinm_gradient_type gradient)
+{
+    const sinm__kernel_table* kernels = sinm__kernels();
+    int32_t gradientRadius = sinm__gradient_filters[gradient].radius;
+    for (int32_t y = ys; y < ye; ++y) {
+        const uint16_t* rows[5];
+        for (int32_t a = 0; a < gradientRadius * 2 + 1; ++a) {
+            rows[a] = in + (size_t)sinm__min(h - 1, sinm__max(1, y + a - gradientRadius)) * w;
+        }
+        kernels->gradient_normals_row16[gradient](rows, out + (size_t)y * w, w, scale, flipY);
+    }
+}
+
+//Same as sinm__normal_map_rows but for 16 bit heights, the box blur and one thread.
+//Only the normals of rows [ys, ye) are written. "heights" is scratch memory for two
+//w * h height fields.
+static void
+sinm__normal_map_box16(const uint16_t* in, uint32_t* out, uint16_t* heights, int32_t w, int32_t h, int32_t imageH, int32_t ys, int32_t ye, float scale, float blurRadius, int flipY, sinm_gradient_type gradient)
+{
+    const sinm__kernel_table* kernels = sinm__kernels();
+    const uint16_t* src = in;
+
+    float radius = sinm__min(sinm__min(w, imageH), sinm__max(0, blurRadius));
+    if (radius >= 1.0f) {
+        float boxes[3];
+        sinm__generate_gaussian_box(boxes, sizeof(boxes) / sizeof(boxes[0]), radius);
+        uint16_t* temp = heights + (size_t)w * h;
+        for (int i = 0; i < 3; ++i) {
+            kernels->box_blur_h16(src, temp, w, h, (boxes[i] - 1) / 2);
+            kernels->box_blur_v16(temp, heights, w, h, (boxes[i] - 1) / 2);
+            src = heights;
+        }
+    }
+    sinm__gradient_normals16(src, out, w, h, ys, ye, scale, flipY, gradient);
+}
+
+typedef struct
+{
+    const uint16_t* in;
+    uint32_t* out;
+    uint16_t* heights;
+    size_t bandSize;
+    double* scratch;
+    size_t scratchSize;
+    int32_t w, h;
+    int32_t bandRows;
+    int32_t halo;
+    float scale;
+    float blurRadius;
+    sinm_gradient_type gradient;
+    int flipY;
+    sinm__recursive_gaussian gaussian;
+} sinm__u16_job;
+
+//NOTE: same bands as sinm_normal_map_buffer_mt, every thread blurs its band and the halo
+//rows around it in "bandSize" heights of its own
+static void
+sinm__u16_band_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__u16_job* job = (sinm__u16_job*)data;
+    int32_t w = job->w;
+    int32_t y0 = jobIndex * job->bandRows;
+    int32_t y1 = sinm__min(job->h, y0 + job->bandRows);
+    int32_t s0 = sinm__max(0, y0 - job->halo);
+    int32_t s1 = sinm__min(job->h, y1 + job->halo);
+    sinm__normal_map_box16(job->in + (size_t)s0 * w, job->out + (size_t)s0 * w, job->heights + threadIndex * job->bandSize,
+        w, s1 - s0, job->h, y0 - s0, y1 - s0, job->scale, job->blurRadius, job->flipY, job->gradient);
+}
+
+//NOTE: the recursive blur needs whole columns so there are no bands, jobs are the same
+//rows and strips of columns as sinm__recursive_blur_h_proc and sinm__recursive_blur_v_proc
+static void
+sinm__recursive_blur_h16_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__u16_job* job = (sinm__u16_job*)data;
+    int32_t ys = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t ye = sinm__min(job->h, ys + SINM__BLUR_STRIP_WIDTH);
+    sinm__kernels()->recursive_blur_h16(job->in, job->heights, job->w, ys, ye, &job->gaussian,
+        job->scratch + threadIndex * job->scratchSize);
+}
+
+static void
+sinm__recursive_blur_v16_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__u16_job* job = (sinm__u16_job*)data;
+    int32_t xs = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t xe = sinm__min(job->w, xs + SINM__BLUR_STRIP_WIDTH);
+    sinm__kernels()->recursive_blur_v16(job->heights, job->heights, job->w, job->h, xs, xe, &job->gaussian,
+        job->scratch + threadIndex * job->scratchSize);
+}
+
+static void
+sinm__u16_normals_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__u16_job* job = (sinm__u16_job*)data;
+    int32_t ys = jobIndex * SINM__BLUR_STRIP_WIDTH;
+    int32_t ye = sinm__min(job->h, ys + SINM__BLUR_STRIP_WIDTH);
+    sinm__gradient_normals16(job->heights, job->out, job->w, job->h, ys, ye, job->scale, job->flipY, job->gradient);
+}
+
+//sinm_normal_map_u16_buffer_ex with resolved options
+static int
+sinm__normal_map_u16(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    sinm__u16_job job;
+    job.in = in;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    job.scale = scale;
+    job.blurRadius = blurRadius;
+    job.gradient = options->gradient;
+    job.flipY = flipY;
+
+    float radius = sinm__min(sinm__min(w, h), sinm__max(0, blurRadius));
+    if (radius >= 1.0f && options->blur == sinm_blur_recursive) {
+        int32_t rowJobs = (h + SINM__BLUR_STRIP_WIDTH - 1) / SINM__BLUR_STRIP_WIDTH;
+        int32_t columnJobs = (w + SINM__BLUR_STRIP_WIDTH - 1) / SINM__BLUR_STRIP_WIDTH;
+        threadCount = sinm__min(threadCount, sinm__max(rowJobs, columnJobs));
+        job.scratchSize = sinm__recursive_blur_scratch_size(w, h);
+        job.heights = (uint16_t*)malloc((size_t)w * h * sizeof(uint16_t));
+        job.scratch = (double*)malloc(threadCount * job.scratchSize * sizeof(double));
+        if (!job.heights || !job.scratch) {
+            free(job.heights);
+            free(job.scratch);
+            return 0;
+        }
+        sinm__recursive_gaussian_init(&job.gaussian, radius);
+
+        sinm__parallel_for(sinm__recursive_blur_h16_proc, &job, rowJobs, threadCount);
+        sinm__parallel_for(sinm__recursive_blur_v16_proc, &job, columnJobs, threadCount);
+        sinm__parallel_for(sinm__u16_normals_proc, &job, rowJobs, threadCount);
+
+        free(job.heights);
+        free(job.scratch);
+        return 1;
+    }
+
+    //NOTE: a single thread blurs the whole image as one band
+    job.halo = sinm__normal_map_halo(w, h, blurRadius, options->gradient);
+    int32_t bandsPerThread = 4;
+    job.bandRows = (h + threadCount * bandsPerThread - 1) / (threadCount * bandsPerThread);
+    job.bandRows = (threadCount == 1) ? h : sinm__max(job.bandRows, sinm__max(16, job.halo * 4));
+
+    int32_t bandCount = (h + job.bandRows - 1) / job.bandRows;
+    threadCount = sinm__min(threadCount, bandCount);
+    job.bandSize = (size_t)w * sinm__min(h, job.bandRows + 2 * job.halo) * 2;
+    job.heights = (uint16_t*)malloc(threadCount * job.bandSize * sizeof(uint16_t));
+    if (!job.heights) {
+        return 0;
+    }
+
+    sinm__parallel_for(sinm__u16_band_proc, &job, bandCount, threadCount);
+
+    free(job.heights);
+    return 1;
+}
+
+SINM_DEF int
+sinm_normal_map_u16_buffer_ex(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    sinm_options o = sinm__resolve_options(options);
+    return sinm__normal_map_u16(in, out, w, h, scale, blurRadius, flipY, sinm__thread_count(threadCount), &o);
+}
+
+SINM_DEF int
+sinm_normal_map_u16_buffer_mt(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount)
+{
+    return sinm_normal_map_u16_buffer_ex(in, out, w, h, scale, blurRadius, flipY, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_normal_map_u16_buffer(const uint16_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY)
+{
+    return sinm_normal_map_u16_buffer_ex(in, out, w, h, scale, blurRadius, flipY, 1, NULL);
+}
+
+SINM_DEF int
+sinm_normal_map_float_buffer_ex(const float* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    sinm_options o = sinm__resolve_options(options);
+    size_t count = (size_t)w * h;
+    uint16_t* quantized = (uint16_t*)malloc(count * sizeof(uint16_t));
+
+    if (quantized) {
+        for (size_t i = 0; i < count; ++i) {
+            float v = sinm__min(1.0f, sinm__max(0.0f, in[i]));
+            quantized[i] = (uint16_t)(v * 65535.0f + 0.5f);
+        }
+        int result = sinm__normal_map_u16(quantized, out, w, h, scale, blurRadius, flipY, sinm__thread_count(threadCount), &o);
+        free(quantized);
+        return result;
+    }
+    return 0;
+}
+
+SINM_DEF int
+sinm_normal_map_float_buffer_mt(const float* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY, int32_t threadCount)
+{
+    return sinm_normal_map_float_buffer_ex(in, out, w, h, scale, blurRadius, flipY, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_normal_map_float_buffer(const float* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, int flipY)
+{
+    return sinm_normal_map_float_buffer_ex(in, out, w, h, scale, blurRadius, flipY, 1, NULL);
+}
+
+SINM_DEF sinm__inline uint32_t*
+sinm_normal_map(const uint32_t* in, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY)
+{
+    uint32_t* result = (uint32_t*)malloc((size_t)w * h * sizeof(uint32_t));
+    if (result) {
+        if (!sinm_normal_map_buffer(in, result, w, h, scale, blurRadius, greyscaleType, flipY)) {
+            free(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+//NOTE: horizon engine. Finds the horizon of every texel of a tiling height field for
+//a set of azimuths, as the slope(rise over run) of the steepest texel within
+//"maxDistance" texels in that direction, and hands it to a consumer a row at a time.
+//The height field is swept along parallel lines, one step per texel on the major
+//axis, from the far end back. The points ahead of the current texel are kept as an
+//upper convex hull on a stack. Its top is the point that sets the horizon and points
+//under the line from the current texel to the next hull point can never set it again,
+//so every texel is pushed and popped at most once. Points that get out of range are
+//dropped from the bottom(which can miss a point that was popped for one of them).
+//For short distances marching SINM_SIMD_WIDTH texels at once is faster than the
+//branchy sweep so horizon_row is used instead, a row and all directions at a time so
+//the consumer's data stays in cache.
+#define SINM__HORIZON_MARCH_MAX 64
+
+typedef void sinm__horizon_consumer(void* data, int32_t direction, int32_t y, const float* horizon);
+
+typedef struct
+{
+    const uint8_t* heights;
+    const uint8_t* padded; //first pixel of the image inside the wrapped field, "pad" texels on every side
+    int32_t stride;
+    int32_t pad;
+    int32_t w, h;
+    int32_t maxDistance;
+    float heightScale;
+    int32_t march;
+    float* horizon; //full plane for the sweep, a row per thread for the march
+
+    int32_t directionCount;
+    const float* dx;
+    const float* dy;
+    sinm__horizon_consumer* consumer;
+    void* consumerData;
+
+    //sweep
+    int32_t direction;
+    int32_t xMajor;
+    int32_t length; //steps per line, the major axis size plus maxDistance to prime the hull
+    float slopeScale;
+    int32_t* major; //major axis coordinate of every step
+    int32_t* minor; //offset on the minor axis of every step, in [0, minor axis size)
+    int32_t* hulls; //two stacks of "hullSize" per thread
+    int32_t hullSize;
+
+    //march, "steps" offsets and height scale / distance per direction
+    int32_t* offsets;
+    float* invDist;
+
+    int32_t threadCount;
+    int32_t jobSize;
+    void* memory;
+} sinm__horizons;
+
+static sinm__inline int32_t
+sinm__wrap(int32_t i, int32_t n)
+{
+    i %= n;
+    return (i < 0) ? i + n : i;
+}
+
+//"heights" must stay valid until sinm__horizons_free. "heightScale" turns a height
+//difference into texels. "dx" and "dy" are unit directions in texels.
+static int
+sinm__horizons_init(sinm__horizons* hz, const uint8_t* heights, int32_t w, int32_t h, float heightScale, float maxDistance,
+    const float* dx, const float* dy, int32_t directionCount, int32_t threadCount)
+{
+    hz->heights = heights;
+    hz->w = w;
+    hz->h = h;
+    hz->heightScale = heightScale;
+    hz->maxDistance = (int32_t)ceilf(sinm__min((float)sinm__max(w, h), sinm__max(1.0f, maxDistance)));
+    hz->march = hz->maxDistance <= SINM__HORIZON_MARCH_MAX;
+    hz->dx = dx;
+    hz->dy = dy;
+    hz->directionCount = directionCount;
+    hz->threadCount = threadCount;
+    hz->hullSize = sinm__max(w, h) + hz->maxDistance;
+
+    //NOTE: extra columns on the right so the last vector of a row can be loaded whole
+    hz->pad = (hz->march) ? hz->maxDistance : 1;
+    hz->stride = w + hz->pad * 2 + 16;
+
+    size_t paddedSize = ((size_t)hz->stride * (h + hz->pad * 2) + 63) & ~(size_t)63;
+    size_t horizonSize = (size_t)w * ((hz->march) ? threadCount : h) * sizeof(float);
+    size_t tablesSize = (hz->march)
+        ? (size_t)hz->maxDistance * directionCount * (sizeof(int32_t) + sizeof(float))
+        : (size_t)hz->hullSize * (2 + threadCount * 2) * sizeof(int32_t);
+    uint8_t* memory = (uint8_t*)malloc(paddedSize + horizonSize + tablesSize);
+    if (!memory) {
+        return 0;
+    }
+
+    hz->memory = memory;
+    hz->horizon = (float*)(memory + paddedSize);
+    if (hz->march) {
+        hz->offsets = (int32_t*)(memory + paddedSize + horizonSize);
+        hz->invDist = (float*)(hz->offsets + hz->maxDistance * directionCount);
+        for (int32_t a = 0; a < directionCount; ++a) {
+            for (int32_t k = 0; k < hz->maxDistance; ++k) {
+                int32_t ox = (int32_t)floorf(dx[a] * (k + 1) + 0.5f);
+                int32_t oy = (int32_t)floorf(dy[a] * (k + 1) + 0.5f);
+                hz->offsets[a * hz->maxDistance + k] = oy * hz->stride + ox;
+                hz->invDist[a * hz->maxDistance + k] = heightScale / sqrtf((float)(ox * ox + oy * oy));
+            }
+        }
+    } else {
+        hz->major = (int32_t*)(memory + paddedSize + horizonSize);
+        hz->minor = hz->major + hz->hullSize;
+        hz->hulls = hz->minor + hz->hullSize;
+    }
+
+    for (int32_t y = 0; y < h + hz->pad * 2; ++y) {
+        const uint8_t* src = heights + (size_t)sinm__wrap(y - hz->pad, h) * w;
+        uint8_t* dst = memory + (size_t)y * hz->stride;
+        for (int32_t x = 0; x < hz->stride; ++x) {
+            dst[x] = src[sinm__wrap(x - hz->pad, w)];
+        }
+    }
+    hz->padded = memory + (size_t)hz->pad * hz->stride + hz->pad;
+    return 1;
+}
+
+static void
+sinm__horizons_free(sinm__horizons* hz)
+{
+    free(hz->memory);
+}
+
+static void
+sinm__horizon_sweep_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__horizons* hz = (sinm__horizons*)data;
+    int32_t majorSize = (hz->xMajor) ? hz->w : hz->h;
+    int32_t minorSize = (hz->xMajor) ? hz->h : hz->w;
+    int32_t c0 = jobIndex * hz->jobSize;
+    int32_t c1 = sinm__min(minorSize, c0 + hz->jobSize);
+
+    //NOTE: the hull holds [bottom, top), every step pushes once so it never wraps
+    int32_t* hullT = hz->hulls + threadIndex * hz->hullSize * 2;
+    int32_t* hullH = hullT + hz->hullSize;
+
+    for (int32_t c = c0; c < c1; ++c) {
+        int32_t bottom = 0;
+        int32_t top = 0;
+        for (int32_t t = hz->length - 1; t >= 0; --t) {
+            int32_t minor = c + hz->minor[t];
+            minor -= (minor >= minorSize) ? minorSize : 0;
+            size_t index = (hz->xMajor) ? (size_t)minor * hz->w + hz->major[t] : (size_t)hz->major[t] * hz->w + minor;
+            int32_t height = hz->heights[index];
+
+            //NOTE: at most one point gets out of range per step
+            if (bottom < top && hullT[bottom] - t > hz->maxDistance) {
+                ++bottom;
+            }
+            while (top - bottom >= 2) {
+                int32_t t1 = hullT[top - 1] - t;
+                int32_t t2 = hullT[top - 2] - t;
+                int32_t h1 = hullH[top - 1] - height;
+                int32_t h2 = hullH[top - 2] - height;
+                if (h2 * t1 < h1 * t2) {
+                    break;
+                }
+                --top;
+            }
+
+            if (t < majorSize) {
+                float slope = 0.0f;
+                if (top > bottom && hullH[top - 1] > height) {
+                    slope = (hullH[top - 1] - height) * hz->slopeScale / (hullT[top - 1] - t);
+                }
+                hz->horizon[index] = slope;
+            }
+
+            hullT[top] = t;
+            hullH[top] = height;
+            ++top;
+        }
+    }
+}
+
+static void
+sinm__horizon_consume_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__horizons* hz = (sinm__horizons*)data;
+    int32_t y0 = jobIndex * hz->jobSize;
+    int32_t y1 = sinm__min(hz->h, y0 + hz->jobSize);
+    for (int32_t y = y0; y < y1; ++y) {
+        hz->consumer(hz->consumerData, hz->direction, y, hz->horizon + (size_t)y * hz->w);
+    }
+}
+
+static void
+sinm__horizon_march_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__horizons* hz = (sinm__horizons*)data;
+    const sinm__kernel_table* kernels = sinm__kernels();
+    float* horizon = hz->horizon + threadIndex * hz->w;
+    int32_t y0 = jobIndex * hz->jobSize;
+    int32_t y1 = sinm__min(hz->h, y0 + hz->jobSize);
+    for (int32_t y = y0; y < y1; ++y) {
+        for (int32_t a = 0; a < hz->directionCount; ++a) {
+            int32_t steps = hz->maxDistance;
+            kernels->horizon_row(hz->padded + (size_t)y * hz->stride, hz->offsets + a * steps, hz->invDist + a * steps, steps, horizon, hz->w);
+            hz->consumer(hz->consumerData, a, y, horizon);
+        }
+    }
+}
+
+//Calls "consumer" once for every row and direction. Different rows can run on
+//different threads at the same time but a row never does.
+static void
+sinm__horizons_run(sinm__horizons* hz, sinm__horizon_consumer* consumer, void* consumerData)
+{
+    //NOTE: a few jobs per thread for load balancing
+    int32_t jobsPerThread = 4;
+    int32_t rowJobSize = sinm__max(1, (hz->h + hz->threadCount * jobsPerThread - 1) / (hz->threadCount * jobsPerThread));
+    int32_t rowJobs = (hz->h + rowJobSize - 1) / rowJobSize;
+    hz->consumer = consumer;
+    hz->consumerData = consumerData;
+
+    if (hz->march) {
+        hz->jobSize = rowJobSize;
+        sinm__parallel_for(sinm__horizon_march_proc, hz, rowJobs, hz->threadCount);
+        return;
+    }
+
+    for (int32_t a = 0; a < hz->directionCount; ++a) {
+        float dx = hz->dx[a];
+        float dy = hz->dy[a];
+        hz->xMajor = fabsf(dx) >= fabsf(dy);
+        int32_t majorSize = (hz->xMajor) ? hz->w : hz->h;
+        int32_t minorSize = (hz->xMajor) ? hz->h : hz->w;
+        float majorDir = (hz->xMajor) ? dx : dy;
+        float m = ((hz->xMajor) ? dy : dx) / fabsf(majorDir);
+
+        hz->length = majorSize + hz->maxDistance;
+        //NOTE: a step is one texel on the major axis and 1 / |majorDir| texels along the line
+        hz->slopeScale = hz->heightScale * fabsf(majorDir);
+        for (int32_t t = 0; t < hz->length; ++t) {
+            hz->major[t] = sinm__wrap((majorDir > 0) ? t : majorSize - 1 - t, majorSize);
+            hz->minor[t] = sinm__wrap((int32_t)floorf(t * m + 0.5f), minorSize);
+        }
+
+        hz->jobSize = sinm__max(1, (minorSize + hz->threadCount * jobsPerThread - 1) / (hz->threadCount * jobsPerThread));
+        sinm__parallel_for(sinm__horizon_sweep_proc, hz, (minorSize + hz->jobSize - 1) / hz->jobSize, hz->threadCount);
+
+        hz->direction = a;
+        hz->jobSize = rowJobSize;
+        sinm__parallel_for(sinm__horizon_consume_proc, hz, rowJobs, hz->threadCount);
+    }
+}
+
+//Greyscale and blur passes for the bakers, the same as the normal map's.
+//"heights" is scratch memory for two w * h height fields. Returns 0 if the blur
+//could not allocate its scratch memory.
+static int
+sinm__bake_heights(const uint32_t* in, uint8_t* heights, int32_t w, int32_t h, float blurRadius, sinm_greyscale_type greyscaleType, int32_t threadCount, const sinm_options* options)
+{
+    sinm__kernels()->heights(in, heights, w, h, greyscaleType);
+    float radius = sinm__min(sinm__min(w, h), sinm__max(0, blurRadius));
+    if (radius >= 1.0f) {
+        return sinm__blur_heights(heights, heights + (size_t)w * h, w, h, radius, threadCount, NULL, options);
+    }
+    return 1;
+}
+
+//NOTE: ssbump baking. For every direction sinm__ssbump_accumulate_simd adds up the light
+//from the elevations above the horizon for each basis vector.
+typedef struct
+{
+    const uint8_t* heights; //see sinm__horizons
+    int32_t stride;
+    float* light; //three w * h planes
+    size_t planeSize;
+    uint32_t* out;
+    int32_t w, h;
+    int32_t jobSize;
+    sinm__ssbump_setup setup;
+} sinm__ssbump_job;
+
+static void
+sinm__ssbump_accumulate(void* data, int32_t direction, int32_t y, const float* horizon)
+{
+    sinm__ssbump_job* job = (sinm__ssbump_job*)data;
+    sinm__kernels()->ssbump_accumulate(horizon, job->light + (size_t)y * job->w, job->w, job->planeSize, &job->setup, direction);
+}
+
+static void
+sinm__ssbump_band_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__ssbump_job* job = (sinm__ssbump_job*)data;
+    const sinm__kernel_table* kernels = sinm__kernels();
+    int32_t y0 = jobIndex * job->jobSize;
+    int32_t y1 = sinm__min(job->h, y0 + job->jobSize);
+    for (int32_t y = y0; y < y1; ++y) {
+        kernels->ssbump_row(job->heights + (size_t)y * job->stride, job->stride, job->light + (size_t)y * job->w, job->planeSize,
+            job->out + (size_t)y * job->w, job->w, &job->setup);
+    }
+}
+
+static void
+sinm__ssbump_setup_init(sinm__ssbump_setup* setup, float depth, int flipY)
+{
+    const float pi = 3.14159265f;
+    //NOTE: sobel gives 8 times the height difference between neighbours
+    setup->gradientScale = depth / (255.0f * 8.0f);
+    setup->gradientScaleY = (flipY) ? -setup->gradientScale : setup->gradientScale;
+
+    float weightSum[3] = { 0 };
+    for (int32_t a = 0; a < SINM__SSBUMP_DIRECTIONS; ++a) {
+        float angle = 2.0f * pi * a / SINM__SSBUMP_DIRECTIONS;
+        //NOTE: light from elevation e covers cos(e) of the sky, each basis vector
+        //sees it at the angle between them
+        for (int32_t e = 0; e < SINM__SSBUMP_ELEVATIONS; ++e) {
+            float elevation = 0.5f * pi * (e + 0.5f) / SINM__SSBUMP_ELEVATIONS;
+            float l[3] = { cosf(elevation) * cosf(angle), cosf(elevation) * sinf(angle), sinf(elevation) };
+            setup->tanElevation[e] = tanf(elevation);
+            for (int32_t i = 0; i < 3; ++i) {
+                float cosine = l[0] * sinm__ssbump_basis[i][0] + l[1] * sinm__ssbump_basis[i][1] + l[2] * sinm__ssbump_basis[i][2];
+                setup->weights[a][e][i] = sinm__max(0.0f, cosine) * cosf(elevation);
+                weightSum[i] += setup->weights[a][e][i];
+            }
+        }
+    }
+    for (int32_t a = 0; a < SINM__SSBUMP_DIRECTIONS; ++a) {
+        for (int32_t e = 0; e < SINM__SSBUMP_ELEVATIONS; ++e) {
+            for (int32_t i = 0; i < 3; ++i) {
+                setup->weights[a][e][i] /= weightSum[i];
+            }
+        }
+    }
+}
+
+SINM_DEF int
+sinm_ssbump_map_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0);
+    const float pi = 3.14159265f;
+    sinm_options o = sinm__resolve_options(options);
+    threadCount = sinm__thread_count(threadCount);
+
+    //NOTE: the light planes are read a whole simd vector at a time
+    size_t planeSize = (size_t)w * h + 16;
+    size_t heightsSize = ((size_t)w * h * 2 + 63) & ~(size_t)63;
+    uint8_t* memory = (uint8_t*)malloc(heightsSize + planeSize * 3 * sizeof(float));
+    if (!memory) {
+        return 0;
+    }
+
+    uint8_t* heights = memory;
+    float* light = (float*)(memory + heightsSize);
+    memset(light, 0, planeSize * 3 * sizeof(float));
+
+    if (!sinm__bake_heights(in, heights, w, h, blurRadius, greyscaleType, threadCount, &o)) {
+        free(memory);
+        return 0;
+    }
+
+    float yDir = (flipY) ? -1.0f : 1.0f;
+    float dx[SINM__SSBUMP_DIRECTIONS];
+    float dy[SINM__SSBUMP_DIRECTIONS];
+    for (int32_t a = 0; a < SINM__SSBUMP_DIRECTIONS; ++a) {
+        float angle = 2.0f * pi * a / SINM__SSBUMP_DIRECTIONS;
+        dx[a] = cosf(angle);
+        dy[a] = sinf(angle) * yDir;
+    }
+
+    sinm__horizons hz;
+    if (!sinm__horizons_init(&hz, heights, w, h, depth / 255.0f, shadowLength, dx, dy, SINM__SSBUMP_DIRECTIONS, threadCount)) {
+        free(memory);
+        return 0;
+    }
+
+    sinm__ssbump_job job;
+    job.heights = hz.padded;
+    job.stride = hz.stride;
+    job.light = light;
+    job.planeSize = planeSize;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    sinm__ssbump_setup_init(&job.setup, depth, flipY);
+
+    sinm__horizons_run(&hz, sinm__ssbump_accumulate, &job);
+
+    int32_t bandsPerThread = 4;
+    job.jobSize = sinm__max(1, (h + threadCount * bandsPerThread - 1) / (threadCount * bandsPerThread));
+    sinm__parallel_for(sinm__ssbump_band_proc, &job, (h + job.jobSize - 1) / job.jobSize, threadCount);
+
+    sinm__horizons_free(&hz);
+    free(memory);
+    return 1;
+}
+
+SINM_DEF int
+sinm_ssbump_map_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY, int32_t threadCount)
+{
+    return sinm_ssbump_map_buffer_ex(in, out, w, h, depth, blurRadius, shadowLength, greyscaleType, flipY, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_ssbump_map_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY)
+{
+    return sinm_ssbump_map_buffer_ex(in, out, w, h, depth, blurRadius, shadowLength, greyscaleType, flipY, 1, NULL);
+}
+
+SINM_DEF sinm__inline uint32_t*
+sinm_ssbump_map(const uint32_t* in, int32_t w, int32_t h, float depth, float blurRadius, float shadowLength, sinm_greyscale_type greyscaleType, int flipY)
+{
+    uint32_t* result = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)w * h);
+    if (result) {
+        if (!sinm_ssbump_map_buffer(in, result, w, h, depth, blurRadius, shadowLength, greyscaleType, flipY)) {
+            free(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+//NOTE: ambient occlusion baking. A direction whose horizon is at elevation e leaves
+//1 - sin(e)^2 = 1 / (1 + slope^2) of its slice of the cosine weighted sky unblocked.
+//The slices are averaged, measured from the ground plane rather than the normal.
+typedef struct
+{
+    float* occlusion; //w * h sums of the unblocked sky
+    uint32_t* out;
+    int32_t w;
+    int32_t directions;
+} sinm__ao_job;
+
+static void
+sinm__ao_accumulate(void* data, int32_t direction, int32_t y, const float* horizon)
+{
+    sinm__ao_job* job = (sinm__ao_job*)data;
+    int32_t w = job->w;
+    uint32_t* out = (direction == job->directions - 1) ? job->out + (size_t)y * w : NULL;
+    sinm__kernels()->ao_accumulate(horizon, job->occlusion + (size_t)y * w, out, w, 1.0f / job->directions);
+}
+
+SINM_DEF int
+sinm_ambient_occlusion_buffer_ex(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType, int32_t threadCount, const sinm_options* options)
+{
+    assert(w > 0 && h > 0 && directions > 0);
+    const float pi = 3.14159265f;
+    sinm_options o = sinm__resolve_options(options);
+    threadCount = sinm__thread_count(threadCount);
+
+    size_t heightsSize = ((size_t)w * h * 2 + 63) & ~(size_t)63;
+    size_t occlusionSize = (size_t)w * h * sizeof(float);
+    size_t directionsSize = (size_t)directions * 2 * sizeof(float);
+    uint8_t* memory = (uint8_t*)malloc(heightsSize + occlusionSize + directionsSize);
+    if (!memory) {
+        return 0;
+    }
+
+    uint8_t* heights = memory;
+    sinm__ao_job job;
+    job.occlusion = (float*)(memory + heightsSize);
+    job.out = out;
+    job.w = w;
+    job.directions = directions;
+    memset(job.occlusion, 0, occlusionSize);
+
+    float* dx = (float*)(memory + heightsSize + occlusionSize);
+    float* dy = dx + directions;
+    for (int32_t a = 0; a < directions; ++a) {
+        float angle = 2.0f * pi * a / directions;
+        dx[a] = cosf(angle);
+        dy[a] = sinf(angle);
+    }
+
+    if (!sinm__bake_heights(in, heights, w, h, blurRadius, greyscaleType, threadCount, &o)) {
+        free(memory);
+        return 0;
+    }
+
+    sinm__horizons hz;
+    if (!sinm__horizons_init(&hz, heights, w, h, depth / 255.0f, radius, dx, dy, directions, threadCount)) {
+        free(memory);
+        return 0;
+    }
+    sinm__horizons_run(&hz, sinm__ao_accumulate, &job);
+
+    sinm__horizons_free(&hz);
+    free(memory);
+    return 1;
+}
+
+SINM_DEF int
+sinm_ambient_occlusion_buffer_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType, int32_t threadCount)
+{
+    return sinm_ambient_occlusion_buffer_ex(in, out, w, h, depth, blurRadius, radius, directions, greyscaleType, threadCount, NULL);
+}
+
+SINM_DEF int
+sinm_ambient_occlusion_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType)
+{
+    return sinm_ambient_occlusion_buffer_ex(in, out, w, h, depth, blurRadius, radius, directions, greyscaleType, 1, NULL);
+}
+
+SINM_DEF sinm__inline uint32_t*
+sinm_ambient_occlusion(const uint32_t* in, int32_t w, int32_t h, float depth, float blurRadius, float radius, int32_t directions, sinm_greyscale_type greyscaleType)
+{
+    uint32_t* result = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)w * h);
+    if (result) {
+        if (!sinm_ambient_occlusion_buffer(in, result, w, h, depth, blurRadius, radius, directions, greyscaleType)) {
+            free(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+//NOTE: mip chains. Every level is built from the previous level's planes in bands of
+//rows and encoded right away while the row is still in cache.
+typedef struct
+{
+    const uint32_t* in; //level 0 pixels, NULL once the planes hold the previous level
+    float* src[4];
+    float* dst[4];
+    uint32_t* out;
+    int32_t srcW, srcH;
+    int32_t dstW, dstH;
+    int32_t bandRows;
+    sinm_mip_type type;
+    float toksvigPower;
+} sinm__mip_job;
+
+static void
+sinm__mip_level_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__mip_job* job = (sinm__mip_job*)data;
+    const sinm__kernel_table* kernels = sinm__kernels();
+    int32_t y0 = jobIndex * job->bandRows;
+    int32_t y1 = sinm__min(job->dstH, y0 + job->bandRows);
+
+    for (int32_t y = y0; y < y1; ++y) {
+        int32_t a = sinm__min(2 * y, job->srcH - 1);
+        int32_t b = sinm__min(2 * y + 1, job->srcH - 1);
+        float* dst[4];
+        for (int32_t i = 0; i < 4; ++i) {
+            dst[i] = job->dst[i] + y * job->dstW;
+        }
+
+        if (job->in) {
+            kernels->mip_first_row(job->in + a * job->srcW, job->in + b * job->srcW, job->srcW, dst, job->dstW, job->type);
+        } else {
+            const float* row0[4];
+            const float* row1[4];
+            for (int32_t i = 0; i < 4; ++i) {
+                row0[i] = job->src[i] + a * job->srcW;
+                row1[i] = job->src[i] + b * job->srcW;
+            }
+            kernels->mip_reduce_row(row0, row1, job->srcW, dst, job->dstW);
+        }
+        kernels->mip_encode_row((const float* const*)dst, job->out + y * job->dstW, job->dstW, job->type, job->toksvigPower);
+    }
+}
+
+SINM_DEF int32_t
+sinm_mip_count(int32_t w, int32_t h)
+{
+    int32_t levels = 1;
+    while (w > 1 || h > 1) {
+        w = sinm__max(1, w >> 1);
+        h = sinm__max(1, h >> 1);
+        ++levels;
+    }
+    return levels;
+}
+
+SINM_DEF size_t
+sinm_mip_chain_size(int32_t w, int32_t h)
+{
+    size_t size = (size_t)w * h;
+    while (w > 1 || h > 1) {
+        w = sinm__max(1, w >> 1);
+        h = sinm__max(1, h >> 1);
+        size += (size_t)w * h;
+    }
+    return size;
+}
+
+SINM_DEF int
+sinm_mip_chain_mt(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_mip_type type, float toksvigPower, int32_t threadCount)
+{
+    assert(w > 0 && h > 0);
+    threadCount = sinm__thread_count(threadCount);
+
+    memcpy(out, in, (size_t)w * h * sizeof(uint32_t));
+    if (w == 1 && h == 1) {
+        return 1;
+    }
+
+    //NOTE: levels ping-pong between two sets of planes, the first one sized for level 1
+    int32_t w1 = sinm__max(1, w >> 1);
+    int32_t h1 = sinm__max(1, h >> 1);
+    size_t planeSize1 = (size_t)w1 * h1;
+    size_t planeSize2 = (size_t)sinm__max(1, w1 >> 1) * sinm__max(1, h1 >> 1);
+    float* memory = (float*)malloc(4 * (planeSize1 + planeSize2) * sizeof(float));
+    if (!memory) {
+        return 0;
+    }
+
+    float* planes[2][4];
+    for (int32_t i = 0; i < 4; ++i) {
+        planes[0][i] = memory + i * planeSize1;
+        planes[1][i] = memory + 4 * planeSize1 + i * planeSize2;
+    }
+
+    sinm__mip_job job;
+    job.in = in;
+    job.out = out + (size_t)w * h;
+    job.srcW = w;
+    job.srcH = h;
+    job.type = type;
+    job.toksvigPower = toksvigPower;
+
+    for (int32_t level = 1; job.srcW > 1 || job.srcH > 1; ++level) {
+        job.dstW = sinm__max(1, job.srcW >> 1);
+        job.dstH = sinm__max(1, job.srcH >> 1);
+        for (int32_t i = 0; i < 4; ++i) {
+            job.src[i] = planes[level & 1][i];
+            job.dst[i] = planes[(level & 1) ^ 1][i];
+        }
+
+        //NOTE: keep the bands at least a few rows tall so the small levels don't pay
+        //for waking up the pool
+        int32_t bandsPerThread = 4;
+        job.bandRows = (job.dstH + threadCount * bandsPerThread - 1) / (threadCount * bandsPerThread);
+        job.bandRows = sinm__max(job.bandRows, sinm__max(1, 16384 / job.dstW));
+        int32_t bandCount = (job.dstH + job.bandRows - 1) / job.bandRows;
+        sinm__parallel_for(sinm__mip_level_proc, &job, bandCount, threadCount);
+
+        job.in = NULL;
+        job.out += (size_t)job.dstW * job.dstH;
+        job.srcW = job.dstW;
+        job.srcH = job.dstH;
+    }
+
+    free(memory);
+    return 1;
+}
+
+SINM_DEF int
+sinm_mip_chain(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_mip_type type, float toksvigPower)
+{
+    return sinm_mip_chain_mt(in, out, w, h, type, toksvigPower, 1);
+}
+
+//NOTE: block compression, every job compresses a band of block rows
+typedef struct
+{
+    sinm__bc_row_proc* row;
+    const uint32_t* in;
+    uint8_t* out;
+    int32_t w, h;
+    int32_t bandRows;
+    size_t rowSize;
+    sinm_bc_quality quality;
+} sinm__bc_job;
+
+static void
+sinm__bc_band_proc(void* data, int32_t jobIndex, int32_t threadIndex)
+{
+    sinm__bc_job* job = (sinm__bc_job*)data;
+    int32_t blocksH = (job->h + 3) / 4;
+    int32_t y0 = jobIndex * job->bandRows;
+    int32_t y1 = sinm__min(blocksH, y0 + job->bandRows);
+    for (int32_t by = y0; by < y1; ++by) {
+        job->row(job->in, job->w, job->h, by, job->out + by * job->rowSize, job->quality);
+    }
+}
+
+static void
+sinm__bc_compress(sinm__bc_row_proc* row, int32_t blockSize, const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount)
+{
+    assert(w > 0 && h > 0);
+    threadCount = sinm__thread_count(threadCount);
+
+    sinm__bc_job job;
+    job.row = row;
+    job.in = in;
+    job.out = out;
+    job.w = w;
+    job.h = h;
+    job.rowSize = (size_t)((w + 3) / 4) * blockSize;
+    job.quality = quality;
+
+    int32_t blocksH = (h + 3) / 4;
+    int32_t bandsPerThread = 4;
+    job.bandRows = (blocksH + threadCount * bandsPerThread - 1) / (threadCount * bandsPerThread);
+    job.bandRows = sinm__max(job.bandRows, sinm__max(1, 1024 / ((w + 3) / 4)));
+    int32_t bandCount = (blocksH + job.bandRows - 1) / job.bandRows;
+    sinm__parallel_for(sinm__bc_band_proc, &job, bandCount, threadCount);
+}
+
+SINM_DEF size_t
+sinm_bc1_size(int32_t w, int32_t h)
+{
+    return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 8;
+}
+
+SINM_DEF void
+sinm_bc1_compress_mt(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount)
+{
+    sinm__bc_compress(sinm__kernels()->bc1_row, 8, in, out, w, h, quality, threadCount);
+}
+
+SINM_DEF void
+sinm_bc1_compress(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality)
+{
+    sinm_bc1_compress_mt(in, out, w, h, quality, 1);
+}
+
+SINM_DEF size_t
+sinm_bc5_size(int32_t w, int32_t h)
+{
+    return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 16;
+}
+
+SINM_DEF void
+sinm_bc5_compress_mt(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount)
+{
+    sinm__bc_compress(sinm__kernels()->bc5_row, 16, in, out, w, h, quality, threadCount);
+}
+
+SINM_DEF void
+sinm_bc5_compress(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality)
+{
+    sinm_bc5_compress_mt(in, out, w, h, quality, 1);
+}
+
+SINM_DEF size_t
+sinm_bc7_size(int32_t w, int32_t h)
+{
+    return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 16;
+}
+
+SINM_DEF void
+sinm_bc7_compress_mt(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount)
+{
+    sinm__bc_compress(sinm__kernels()->bc7_row, 16, in, out, w, h, quality, threadCount);
+}
+
+SINM_DEF void
+sinm_bc7_compress(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality)
+{
+    sinm_bc7_compress_mt(in, out, w, h, quality, 1);
+}
+
+#endif //ifndef SI_NORMALMAP_IMPLEMENTATION
+#elif !defined(SINM__HEIGHT_PASS)
+
+//NOTE: everything below is compiled once per instruction set. The implementation
+//includes this file again with SINM__KERNEL_PASS set to 1(SSE4.1), 2(AVX2) or
+//3(AVX-512) and every function gets the matching suffix through SINM__K.
+
+#if SINM__KERNEL_PASS == 1
+#define SINM__KERNEL_SUFFIX sse41
+#define SINM__KERNEL_LEVEL sinm_simd_sse41
+#define SINM__KERNEL_TARGET "sse4.1"
+#define simd_prefix_float(name) _mm_##name
+#define SINM_SIMD_WIDTH 4
+#define simd__int __m128i
+#define simd__float __m128
+#define simd__double __m128d
+#define simd__and_ix(a, b) _mm_and_si128(a, b)
+#define simd__or_ix(a, b) _mm_or_si128(a, b)
+#define simd__xor_ix(a, b) _mm_xor_si128(a, b)
+#define simd__loadu_ix(a) _mm_loadu_si128(a)
+#define simd__storeu_ix(ptr, v) _mm_storeu_si128(ptr, v)
+#elif SINM__KERNEL_PASS == 2
+#define SINM__KERNEL_SUFFIX avx2
+#define SINM__KERNEL_LEVEL sinm_simd_avx2
+#define SINM__KERNEL_TARGET "avx2"
+#define simd_prefix_float(name) _mm256_##name
+#define SINM_SIMD_WIDTH 8
+#define simd__int __m256i
+#define simd__float __m256
+#define simd__double __m256d
+#define simd__and_ix(a, b) _mm256_and_si256(a, b)
+#define simd__or_ix(a, b) _mm256_or_si256(a, b)
+#define simd__xor_ix(a, b) _mm256_xor_si256(a, b)
+#define simd__loadu_ix(a) _mm256_loadu_si256(a)
+#define simd__storeu_ix(ptr, v) _mm256_storeu_si256(ptr, v)
+#elif SINM__KERNEL_PASS == 3
+#define SINM__KERNEL_SUFFIX avx512
+#define SINM__KERNEL_LEVEL sinm_simd_avx512
+#define SINM__KERNEL_TARGET "avx512f,avx512bw"
+#define simd_prefix_float(name) _mm512_##name
+#define SINM_SIMD_WIDTH 16
+#define simd__int __m512i
+#define simd__float __m512
+#define simd__double __m512d
+#define simd__and_ix(a, b) _mm512_and_si512(a, b)
+#define simd__or_ix(a, b) _mm512_or_si512(a, b)
+#define simd__xor_ix(a, b) _mm512_xor_si512(a, b)
+#define simd__loadu_ix(a) _mm512_loadu_si512(a)
+#define simd__storeu_ix(ptr, v) _mm512_storeu_si512(ptr, v)
+#endif
+
+sinm__target_push(SINM__KERNEL_TARGET)
+
+sinm__inline static simd__float
+SINM__K(sinm__length_simd)(simd__float x, simd__float y, simd__float z)
+{
+    return simd__sqrt_ps(simd__add_ps(simd__add_ps(simd__mul_ps(x, x), simd__mul_ps(y, y)), simd__mul_ps(z, z)));
+}
+
+static sinm__inline void
+SINM__K(sinm__rgba_to_v3_simd)(simd__int c, simd__float* x, simd__float* y, simd__float* z)
+{
+    simd__int ff = simd__set1_epi32(0xFF);
+    simd__int v127 = simd__set1_epi32(127);
+    *x = simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 0), ff), v127));
+    *y = simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 8), ff), v127));
+    *z = simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 16), ff), v127));
+}
+
+static sinm__inline simd__int
+SINM__K(sinm__v3_to_rgba_simd)(simd__float x, simd__float y, simd__float z)
+{
+    simd__float one = simd__set1_ps(1.0f);
+    simd__float v127 = simd__set1_ps(127.0f);
+    simd__int a = simd__set1_epi32(255u << 24u);
+    simd__int r = simd__cvtps_epi32(simd__mul_ps(simd__add_ps(one, x), v127));
+    simd__int g = simd__cvtps_epi32(simd__mul_ps(simd__add_ps(one, y), v127));
+    simd__int b = simd__cvtps_epi32(simd__mul_ps(simd__add_ps(one, z), v127));
+    simd__int c = simd__or_ix(simd__or_ix(simd__or_ix(r, simd__slli_epi32(g, 8)), simd__slli_epi32(b, 16)), a);
+    return c;
+}
+
+//Transposes a SINM_SIMD_WIDTH x SINM_SIMD_WIDTH block of 32 bit values held in "v"
+static sinm__forceinline void
+SINM__K(sinm__transpose_simd)(simd__int* v)
+{
+#if SINM__KERNEL_PASS == 3
+    __m512i t[16];
+    sinm__unroll
+    for (int i = 0; i < 16; i += 2) {
+        t[i] = _mm512_unpacklo_epi32(v[i], v[i + 1]);
+        t[i + 1] = _mm512_unpackhi_epi32(v[i], v[i + 1]);
+    }
+    sinm__unroll
+    for (int i = 0; i < 16; i += 4) {
+        v[i] = _mm512_unpacklo_epi64(t[i], t[i + 2]);
+        v[i + 1] = _mm512_unpackhi_epi64(t[i], t[i + 2]);
+        v[i + 2] = _mm512_unpacklo_epi64(t[i + 1], t[i + 3]);
+        v[i + 3] = _mm512_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    sinm__unroll
+    for (int i = 0; i < 4; ++i) {
+        t[i] = _mm512_shuffle_i32x4(v[i], v[i + 4], 0x88);
+        t[i + 4] = _mm512_shuffle_i32x4(v[i], v[i + 4], 0xDD);
+        t[i + 8] = _mm512_shuffle_i32x4(v[i + 8], v[i + 12], 0x88);
+        t[i + 12] = _mm512_shuffle_i32x4(v[i + 8], v[i + 12], 0xDD);
+    }
+    sinm__unroll
+    for (int i = 0; i < 8; ++i) {
+        v[i] = _mm512_shuffle_i32x4(t[i], t[i + 8], 0x88);
+        v[i + 8] = _mm512_shuffle_i32x4(t[i], t[i + 8], 0xDD);
+    }
+#elif SINM__KERNEL_PASS == 2
+    __m256 t[8];
+    __m256 u[8];
+    sinm__unroll
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_ps(_mm256_castsi256_ps(v[i]), _mm256_castsi256_ps(v[i + 1]));
+        t[i + 1] = _mm256_unpackhi_ps(_mm256_castsi256_ps(v[i]), _mm256_castsi256_ps(v[i + 1]));
+    }
+    sinm__unroll
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    sinm__unroll
+    for (int i = 0; i < 4; ++i) {
+        v[i] = _mm256_castps_si256(_mm256_permute2f128_ps(u[i], u[i + 4], 0x20));
+        v[i + 4] = _mm256_castps_si256(_mm256_permute2f128_ps(u[i], u[i + 4], 0x31));
+    }
+#else
+    __m128 r0 = _mm_castsi128_ps(v[0]);
+    __m128 r1 = _mm_castsi128_ps(v[1]);
+    __m128 r2 = _mm_castsi128_ps(v[2]);
+    __m128 r3 = _mm_castsi128_ps(v[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    v[0] = _mm_castps_si128(r0);
+    v[1] = _mm_castps_si128(r1);
+    v[2] = _mm_castps_si128(r2);
+    v[3] = _mm_castps_si128(r3);
+#endif
+}
+
+//Widens the SINM_SIMD_WIDTH 32 bit lanes of "v" to doubles, the first half goes to d[0]
+static sinm__forceinline void
+SINM__K(sinm__cvtepi32_pd_simd)(simd__int v, simd__double* d)
+{
+#if SINM__KERNEL_PASS == 3
+    d[0] = _mm512_cvtepi32_pd(_mm512_castsi512_si256(v));
+    d[1] = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v, 1));
+#elif SINM__KERNEL_PASS == 2
+    d[0] = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+    d[1] = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+#else
+    d[0] = _mm_cvtepi32_pd(v);
+    d[1] = _mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v));
+#endif
+}
+
+//Rounds two double vectors to the nearest integer and packs them into one vector of
+//SINM_SIMD_WIDTH 32 bit lanes, the reverse of sinm__cvtepi32_pd_simd
+static sinm__forceinline simd__int
+SINM__K(sinm__cvtpd_epi32_simd)(simd__double lo, simd__double hi)
+{
+#if SINM__KERNEL_PASS == 3
+    return _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtpd_epi32(lo)), _mm512_cvtpd_epi32(hi), 1);
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_cvtpd_epi32(lo)), _mm256_cvtpd_epi32(hi), 1);
+#else
+    return _mm_unpacklo_epi64(_mm_cvtpd_epi32(lo), _mm_cvtpd_epi32(hi));
+#endif
+}
+
+//Widens the 2 * SINM_SIMD_WIDTH signed 16 bit lanes of "v" to floats, the first half goes to f[0]
+static sinm__forceinline void
+SINM__K(sinm__cvtepi16_ps_simd)(simd__int v, simd__float* f)
+{
+#if SINM__KERNEL_PASS == 3
+    f[0] = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm512_castsi512_si256(v)));
+    f[1] = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(v, 1)));
+#elif SINM__KERNEL_PASS == 2
+    f[0] = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+    f[1] = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+#else
+    f[0] = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(v));
+    f[1] = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_unpackhi_epi64(v, v)));
+#endif
+}
+
+//One step of the recursive gaussian(see sinm__recursive_gaussian). "p" holds the last
+//three results and is shifted, "c" is b, a[0], a[1] and a[2].
+static sinm__forceinline simd__double
+SINM__K(sinm__recursive_step_simd)(simd__double x, simd__double* p, const simd__double* c)
+{
+    simd__double y = simd__add_pd(simd__mul_pd(c[0], x), simd__mul_pd(c[1], p[0]));
+    y = simd__add_pd(y, simd__mul_pd(c[2], p[1]));
+    y = simd__add_pd(y, simd__mul_pd(c[3], p[2]));
+    p[2] = p[1];
+    p[1] = p[0];
+    p[0] = y;
+    return y;
+}
+
+//Turns the last three results of the forward pass in "p" into the first three of the
+//backward pass, "last" is the last input of the row or column
+static sinm__forceinline void
+SINM__K(sinm__recursive_edge_simd)(simd__double* p, simd__double last, const sinm__recursive_gaussian* g)
+{
+    simd__double u[3];
+    for (int32_t i = 0; i < 3; ++i) {
+        u[i] = simd__sub_pd(p[i], last);
+    }
+    simd__double b = simd__set1_pd(g->b);
+    for (int32_t i = 0; i < 3; ++i) {
+        simd__double v = simd__mul_pd(simd__set1_pd(g->m[i * 3]), u[0]);
+        v = simd__add_pd(v, simd__mul_pd(simd__set1_pd(g->m[i * 3 + 1]), u[1]));
+        v = simd__add_pd(v, simd__mul_pd(simd__set1_pd(g->m[i * 3 + 2]), u[2]));
+        p[i] = simd__add_pd(simd__mul_pd(b, v), last);
+    }
+}
+
+#define SINM__HEIGHT_PASS 1
+#include "si_normalmap.h"
+#undef SINM__HEIGHT_PASS
+#define SINM__HEIGHT_PASS 2
+#include "si_normalmap.h"
+#undef SINM__HEIGHT_PASS
+
+static void
+SINM__K(sinm__normalize_simd)(uint32_t* in, int32_t w, int32_t h, float scale, int flipY)
+{
+    simd__float yDir = simd__set1_ps((flipY) ? -1.0f : 1.0f);
+    simd__float invScale = simd__set1_ps(1.0f / scale);
+    //NOTE: clamped so a zero vector stays zero instead of turning into NaN
+    simd__float minLen = simd__set1_ps(1e-04f);
+
+    int32_t count = w * h - (w * h) % SINM_SIMD_WIDTH;
+    for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
+        simd__int pixel = simd__loadu_ix((simd__int*)&in[i]);
+        simd__float x, y, z;
+        SINM__K(sinm__rgba_to_v3_simd)(pixel, &x, &y, &z);
+        y = simd__mul_ps(y, yDir);
+        z = simd__mul_ps(z, invScale);
+        simd__float len = simd__max_ps(SINM__K(sinm__length_simd)(x, y, z), minLen);
+        simd__float invLen = simd__div_ps(simd__set1_ps(1.0f), len);
+        x = simd__mul_ps(x, invLen);
+        y = simd__mul_ps(y, invLen);
+        z = simd__mul_ps(z, invLen);
+        simd__storeu_ix((simd__int*)&in[i], SINM__K(sinm__v3_to_rgba_simd)(x, y, z));
+    }
+
+    int32_t remaining = w * h - count;
+    if (remaining > 0) {
+        sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH] = { 0 };
+        memcpy(tail, in + count, remaining * sizeof(uint32_t));
+        SINM__K(sinm__normalize_simd)(tail, SINM_SIMD_WIDTH, 1, scale, flipY);
+        memcpy(in + count, tail, remaining * sizeof(uint32_t));
+    }
+}
+
+static void
+SINM__K(sinm__composite_simd)(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h)
+{
+    simd__int ff = simd__set1_epi32(0xFF);
+    simd__int alpha = simd__slli_epi32(ff, 24);
+
+    int32_t count = w * h - (w * h) % SINM_SIMD_WIDTH;
+    for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
+        simd__int c1 = simd__loadu_ix((simd__int*)&in1[i]);
+        simd__int c2 = simd__loadu_ix((simd__int*)&in2[i]);
+
+        simd__int r1 = simd__and_ix(c1, ff);
+        simd__int r2 = simd__and_ix(c2, ff);
+        simd__int g1 = simd__and_ix(simd__srli_epi32(c1, 8), ff);
+        simd__int g2 = simd__and_ix(simd__srli_epi32(c2, 8), ff);
+        simd__int b1 = simd__and_ix(simd__srli_epi32(c1, 16), ff);
+        simd__int b2 = simd__and_ix(simd__srli_epi32(c2, 16), ff);
+
+        simd__int r = simd__srli_epi32(simd__add_epi32(r1, r2), 1);
+        simd__int g = simd__srli_epi32(simd__add_epi32(g1, g2), 1);
+        simd__int b = simd__srli_epi32(simd__add_epi32(b1, b2), 1);
+
+        simd__int final = simd__or_ix(simd__or_ix(simd__or_ix(r, simd__slli_epi32(g, 8)), simd__slli_epi32(b, 16)), alpha);
+
+        simd__storeu_ix((simd__int*)&out[i], final);
+    }
+    int32_t remaining = w * h - count;
+    if (remaining > 0) {
+        sinm__aligned_var(uint32_t, 64) tail1[SINM_SIMD_WIDTH] = { 0 };
+        sinm__aligned_var(uint32_t, 64) tail2[SINM_SIMD_WIDTH] = { 0 };
+        memcpy(tail1, in1 + count, remaining * sizeof(uint32_t));
+        memcpy(tail2, in2 + count, remaining * sizeof(uint32_t));
+        SINM__K(sinm__composite_simd)(tail1, tail2, tail1, SINM_SIMD_WIDTH, 1);
+        memcpy(out + count, tail1, remaining * sizeof(uint32_t));
+    }
+}
+
+static sinm__forceinline void
+SINM__K(sinm__normalize_v3_simd)(simd__float* v)
+{
+    //NOTE: clamped like sinm__normalize_simd
+    simd__float len = simd__max_ps(SINM__K(sinm__length_simd)(v[0], v[1], v[2]), simd__set1_ps(1e-04f));
+    simd__float invLen = simd__div_ps(simd__set1_ps(1.0f), len);
+    v[0] = simd__mul_ps(v[0], invLen);
+    v[1] = simd__mul_ps(v[1], invLen);
+    v[2] = simd__mul_ps(v[2], invLen);
+}
+
+//Decodes SINM_SIMD_WIDTH pixels of a layer starting at "i", only the first "n" are read,
+//and applies its weight
+static sinm__forceinline void
+SINM__K(sinm__composite_layer_simd)(const uint32_t* in, size_t i, int32_t n, float weight, sinm_blend_type type, simd__float* v)
+{
+    simd__int pixel;
+    if (n == SINM_SIMD_WIDTH) {
+        pixel = simd__loadu_ix((const simd__int*)&in[i]);
+    } else {
+        sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH] = { 0 };
+        memcpy(tail, &in[i], n * sizeof(uint32_t));
+        pixel = simd__loadu_ix((const simd__int*)tail);
+    }
+
+    simd__float scale = simd__mul_ps(simd__set1_ps(1.0f / 127.0f), simd__set1_ps(weight));
+    SINM__K(sinm__rgba_to_v3_simd)(pixel, &v[0], &v[1], &v[2]);
+    v[0] = simd__mul_ps(v[0], scale);
+    v[1] = simd__mul_ps(v[1], scale);
+    if (type == sinm_blend_linear) {
+        v[2] = simd__mul_ps(v[2], scale);
+    } else {
+        //NOTE: a weight of 0 turns the layer into (0, 0, 1) which leaves the others as they are
+        v[2] = simd__add_ps(simd__set1_ps(1.0f), simd__mul_ps(simd__sub_ps(v[2], simd__set1_ps(127.0f)), scale));
+    }
+}
+
+//Blends SINM_SIMD_WIDTH pixels starting at "i" of all layers in registers
+static sinm__forceinline simd__int
+SINM__K(sinm__composite_pixels_simd)(const uint32_t* const* in, const float* weights, int32_t count, size_t i, int32_t n, sinm_blend_type type)
+{
+    simd__float acc[3];
+    SINM__K(sinm__composite_layer_simd)(in[0], i, n, (weights) ? weights[0] : 1.0f, type, acc);
+    for (int32_t l = 1; l < count; ++l) {
+        simd__float v[3];
+        SINM__K(sinm__composite_layer_simd)(in[l], i, n, (weights) ? weights[l] : 1.0f, type, v);
+        if (type == sinm_blend_rnm) {
+            //NOTE: with a unit base t = base + (0, 0, 1), u = (-detail.x, -detail.y, detail.z)
+            //and result = t * dot(t, u) / t.z - u. Scaling t by the length of the base
+            //instead of normalizing it saves a division.
+            simd__float len = simd__max_ps(SINM__K(sinm__length_simd)(acc[0], acc[1], acc[2]), simd__set1_ps(1e-04f));
+            simd__float tz = simd__max_ps(simd__add_ps(acc[2], len), simd__mul_ps(len, simd__set1_ps(1e-04f)));
+            simd__float dot = simd__sub_ps(simd__mul_ps(tz, v[2]), simd__add_ps(simd__mul_ps(acc[0], v[0]), simd__mul_ps(acc[1], v[1])));
+            simd__float s = simd__div_ps(dot, simd__mul_ps(tz, len));
+            acc[0] = simd__add_ps(simd__mul_ps(acc[0], s), v[0]);
+            acc[1] = simd__add_ps(simd__mul_ps(acc[1], s), v[1]);
+            acc[2] = simd__sub_ps(simd__mul_ps(tz, s), v[2]);
+        } else {
+            //NOTE: udn and whiteout add up the slopes of all layers and are only normalized once
+            acc[0] = simd__add_ps(acc[0], v[0]);
+            acc[1] = simd__add_ps(acc[1], v[1]);
+            if (type == sinm_blend_linear) {
+                acc[2] = simd__add_ps(acc[2], v[2]);
+            } else if (type == sinm_blend_whiteout) {
+                acc[2] = simd__mul_ps(acc[2], v[2]);
+            }
+        }
+    }
+    SINM__K(sinm__normalize_v3_simd)(acc);
+    return SINM__K(sinm__v3_to_rgba_simd)(acc[0], acc[1], acc[2]);
+}
+
+static sinm__forceinline void
+SINM__K(sinm__composite_range_simd)(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, size_t start, size_t end, sinm_blend_type type)
+{
+    size_t i = start;
+    for (; i + SINM_SIMD_WIDTH <= end; i += SINM_SIMD_WIDTH) {
+        simd__int c = SINM__K(sinm__composite_pixels_simd)(in, weights, count, i, SINM_SIMD_WIDTH, type);
+        simd__storeu_ix((simd__int*)&out[i], c);
+    }
+    if (i < end) {
+        int32_t n = (int32_t)(end - i);
+        sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+        simd__storeu_ix((simd__int*)tail, SINM__K(sinm__composite_pixels_simd)(in, weights, count, i, n, type));
+        memcpy(&out[i], tail, n * sizeof(uint32_t));
+    }
+}
+
+//Pixels [start, end) of sinm_composite_layers. Every input is read and the output
+//written only once, the blend mode is a constant in each loop.
+static void
+SINM__K(sinm__composite_layers_simd)(const uint32_t* const* in, const float* weights, int32_t count, uint32_t* out, size_t start, size_t end, sinm_blend_type type)
+{
+    switch (type) {
+    case sinm_blend_linear: {
+        SINM__K(sinm__composite_range_simd)(in, weights, count, out, start, end, sinm_blend_linear);
+    } break;
+    case sinm_blend_udn: {
+        SINM__K(sinm__composite_range_simd)(in, weights, count, out, start, end, sinm_blend_udn);
+    } break;
+    case sinm_blend_whiteout: {
+        SINM__K(sinm__composite_range_simd)(in, weights, count, out, start, end, sinm_blend_whiteout);
+    } break;
+    default: {
+        SINM__K(sinm__composite_range_simd)(in, weights, count, out, start, end, sinm_blend_rnm);
+    } break;
+    }
+}
+
+//Grey value of every pixel in "c", one per 32 bit lane.
+//sinm_greyscale_none uses the red channel like the rest of the pipeline.
+static sinm__forceinline simd__int
+SINM__K(sinm__grey_simd)(simd__int c, sinm_greyscale_type type)
+{
+    simd__int ff = simd__set1_epi32(0xFF);
+    simd__int r = simd__and_ix(c, ff);
+    simd__int g = simd__and_ix(simd__srli_epi32(c, 8), ff);
+    simd__int b = simd__and_ix(simd__srli_epi32(c, 16), ff);
+
+    switch (type) {
+    case sinm_greyscale_none: {
+        return r;
+    }
+
+    case sinm_greyscale_lightness: {
+        simd__int max = simd__max_epi32(simd__max_epi32(r, g), b);
+        simd__int min = simd__min_epi32(simd__min_epi32(r, g), b);
+        return simd__srli_epi32(simd__add_epi32(min, max), 1);
+    }
+
+    case sinm_greyscale_average: {
+        simd__int s = simd__add_epi32(simd__add_epi32(r, g), b);
+        return simd__cvtps_epi32(simd__mul_ps(simd__cvtepi32_ps(s), simd__set1_ps(1.0f / 3.0f)));
+    }
+
+    case sinm_greyscale_luminance: {
+        simd__float rf = simd__mul_ps(simd__cvtepi32_ps(r), simd__set1_ps(0.21f));
+        simd__float gf = simd__mul_ps(simd__cvtepi32_ps(g), simd__set1_ps(0.72f));
+        simd__float bf = simd__mul_ps(simd__cvtepi32_ps(b), simd__set1_ps(0.07f));
+        return simd__cvtps_epi32(simd__add_ps(rf, simd__add_ps(gf, bf)));
+    }
+
+    default: {
+        //INVALID OPTION
+        assert(false);
+        return r;
+    }
+    }
+}
+
+static void
+SINM__K(sinm__simd_greyscale)(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+{
+    simd__int alpha = simd__set1_epi32(0xFF000000u);
+
+    //NOTE: a partial batch at the end is handled below
+    int32_t count = w * h - (w * h) % SINM_SIMD_WIDTH;
+    for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
+        simd__int l = SINM__K(sinm__grey_simd)(simd__loadu_ix((simd__int*)&in[i]), type);
+        l = simd__or_ix(simd__slli_epi32(l, 16),
+            simd__or_ix(simd__slli_epi32(l, 8),
+                simd__or_ix(l, alpha)));
+        simd__storeu_ix((simd__int*)&out[i], l);
+    }
+
+    int32_t remaining = w * h - count;
+    if (remaining > 0) {
+        //NOTE: run the leftover pixels through the same simd math using a padded copy
+        sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH] = { 0 };
+        memcpy(tail, in + count, remaining * sizeof(uint32_t));
+        SINM__K(sinm__simd_greyscale)(tail, tail, SINM_SIMD_WIDTH, 1, type);
+        memcpy(out + count, tail, remaining * sizeof(uint32_t));
+    }
+}
+
+//Same as sinm__simd_greyscale but writes a single channel height per pixel
+static void
+SINM__K(sinm__simd_heights)(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+{
+    int32_t count = w * h - (w * h) % SINM_SIMD_WIDTH;
+    for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
+        simd__int l = SINM__K(sinm__grey_simd)(simd__loadu_ix((simd__int*)&in[i]), type);
+        SINM__K(sinm__store_heights_simd_u8)(&out[i], l);
+    }
+
+    int32_t remaining = w * h - count;
+    if (remaining > 0) {
+        sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH] = { 0 };
+        memcpy(tail, in + count, remaining * sizeof(uint32_t));
+        simd__int l = SINM__K(sinm__grey_simd)(simd__loadu_ix((simd__int*)tail), type);
+        SINM__K(sinm__store_heights_partial_simd_u8)(&out[count], l, remaining);
+    }
+}
+
+//Inclusive prefix sum of the SINM_SIMD_WIDTH 32 bit lanes of "v"
+static sinm__forceinline simd__int
+SINM__K(sinm__prefix_sum_simd)(simd__int v)
+{
+#if SINM__KERNEL_PASS == 3
+    __m512i zero = _mm512_setzero_si512();
+    v = _mm512_add_epi32(v, _mm512_alignr_epi32(v, zero, 15));
+    v = _mm512_add_epi32(v, _mm512_alignr_epi32(v, zero, 14));
+    v = _mm512_add_epi32(v, _mm512_alignr_epi32(v, zero, 12));
+    v = _mm512_add_epi32(v, _mm512_alignr_epi32(v, zero, 8));
+#elif SINM__KERNEL_PASS == 2
+    v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+    v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+    //NOTE: the byte shifts stay inside the 128 bit halves, the upper half still needs
+    //the total of the lower one
+    v = _mm256_add_epi32(v, _mm256_shuffle_epi32(_mm256_permute2x128_si256(v, v, 0x08), 0xFF));
+#else
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+#endif
+    return v;
+}
+
+//Copies the last lane of "v" to every lane
+static sinm__forceinline simd__int
+SINM__K(sinm__broadcast_last_simd)(simd__int v)
+{
+#if SINM__KERNEL_PASS == 3
+    return _mm512_permutexvar_epi32(_mm512_set1_epi32(15), v);
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(7));
+#else
+    return _mm_shuffle_epi32(v, 0xFF);
+#endif
+}
+
+//Loads base[offsets[i]] into lane i
+static sinm__forceinline simd__int
+SINM__K(sinm__gather_epi32_simd)(const uint32_t* base, simd__int offsets)
+{
+#if SINM__KERNEL_PASS == 3
+    return _mm512_i32gather_epi32(offsets, base, 4);
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_i32gather_epi32((const int*)base, offsets, 4);
+#else
+    sinm__aligned_var(int32_t, 16) o[4];
+    _mm_store_si128((__m128i*)o, offsets);
+    return _mm_setr_epi32((int)base[o[0]], (int)base[o[1]], (int)base[o[2]], (int)base[o[3]]);
+#endif
+}
+
+//Horizontal prefix sums of the rows in [ys, ye) of "in" into rows ys + 1 to ye of the
+//summed area table(see sinm__sat_job)
+static void
+SINM__K(sinm__sat_rows_simd)(const uint8_t* in, uint32_t* sat, int32_t w, int32_t ys, int32_t ye)
+{
+    size_t stride = (size_t)w + 1;
+    for (int32_t y = ys; y < ye; ++y) {
+        const uint8_t* row = in + (size_t)y * w;
+        uint32_t* dst = sat + (y + 1) * stride + 1;
+        dst[-1] = 0;
+
+        simd__int carry = simd__set1_epi32(0);
+        for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+            int32_t count = w - x;
+            simd__int v = SINM__K(sinm__load_heights_partial_simd_u8)(row + x, count);
+            v = simd__add_epi32(SINM__K(sinm__prefix_sum_simd)(v), carry);
+            carry = SINM__K(sinm__broadcast_last_simd)(v);
+            if (count >= SINM_SIMD_WIDTH) {
+                simd__storeu_ix((simd__int*)(dst + x), v);
+            } else {
+                sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+                simd__storeu_ix((simd__int*)tail, v);
+                memcpy(dst + x, tail, count * sizeof(uint32_t));
+            }
+        }
+    }
+}
+
+//Vertical prefix sums of the columns in [xs, xe) of the summed area table after
+//sinm__sat_rows_simd. Strips of columns keep their sums in registers like
+//sinm__box_blur_v_simd.
+static void
+SINM__K(sinm__sat_columns_simd)(uint32_t* sat, int32_t w, int32_t h, int32_t xs, int32_t xe)
+{
+    size_t stride = (size_t)w + 1;
+    int32_t x = xs;
+    while (xe - x >= SINM_SIMD_WIDTH) {
+        int32_t vectors = sinm__min(SINM__BLUR_STRIP_VECTORS, (xe - x) / SINM_SIMD_WIDTH);
+        simd__int sums[SINM__BLUR_STRIP_VECTORS];
+        for (int32_t v = 0; v < vectors; ++v) {
+            sums[v] = simd__set1_epi32(0);
+        }
+        for (int32_t y = 1; y <= h; ++y) {
+            uint32_t* row = sat + y * stride + 1 + x;
+            for (int32_t v = 0; v < vectors; ++v) {
+                simd__int* p = (simd__int*)(row + v * SINM_SIMD_WIDTH);
+                sums[v] = simd__add_epi32(sums[v], simd__loadu_ix(p));
+                simd__storeu_ix(p, sums[v]);
+            }
+        }
+        x += vectors * SINM_SIMD_WIDTH;
+    }
+
+    for (; x < xe; ++x) {
+        uint32_t sum = 0;
+        for (int32_t y = 1; y <= h; ++y) {
+            uint32_t* p = sat + y * stride + 1 + x;
+            sum += *p;
+            *p = sum;
+        }
+    }
+}
+
+//Average of the box of "radius" around every lane's pixel("px", row "y"), clipped to the
+//image. "base" is the table entry of the first pixel of the block at "bx".
+//NOTE: the table wraps around past 2^32 but box sums stay below 2^31(see
+//sinm__sat_job) so the differences are still exact
+static sinm__forceinline simd__float
+SINM__K(sinm__sat_box_simd)(const uint32_t* base, simd__int px, simd__int radius, int32_t bx, int32_t y, int32_t w, int32_t h)
+{
+    simd__int zero = simd__set1_epi32(0);
+    simd__int one = simd__set1_epi32(1);
+    simd__int stride = simd__set1_epi32(w + 1);
+    simd__int vy = simd__set1_epi32(y);
+    simd__int x0 = simd__max_epi32(simd__sub_epi32(px, radius), zero);
+    simd__int x1 = simd__add_epi32(simd__min_epi32(simd__add_epi32(px, radius), simd__set1_epi32(w - 1)), one);
+    simd__int y0 = simd__max_epi32(simd__sub_epi32(vy, radius), zero);
+    simd__int y1 = simd__add_epi32(simd__min_epi32(simd__add_epi32(vy, radius), simd__set1_epi32(h - 1)), one);
+    simd__float area = simd__cvtepi32_ps(simd__mullo_epi32(simd__sub_epi32(x1, x0), simd__sub_epi32(y1, y0)));
+
+    simd__int top = simd__mullo_epi32(simd__sub_epi32(y0, vy), stride);
+    simd__int bottom = simd__mullo_epi32(simd__sub_epi32(y1, vy), stride);
+    simd__int left = simd__sub_epi32(x0, simd__set1_epi32(bx));
+    simd__int right = simd__sub_epi32(x1, simd__set1_epi32(bx));
+    simd__int sum = SINM__K(sinm__gather_epi32_simd)(base, simd__add_epi32(bottom, right));
+    sum = simd__sub_epi32(sum, SINM__K(sinm__gather_epi32_simd)(base, simd__add_epi32(top, right)));
+    sum = simd__sub_epi32(sum, SINM__K(sinm__gather_epi32_simd)(base, simd__add_epi32(bottom, left)));
+    sum = simd__add_epi32(sum, SINM__K(sinm__gather_epi32_simd)(base, simd__add_epi32(top, left)));
+    return simd__div_ps(simd__cvtepi32_ps(sum), area);
+}
+
+//Blurs row "y" with a box per pixel(see sinm_normal_map_masked_buffer). The result is
+//blended between the two integer radii around the exact one so the blur follows
+//smooth changes in the mask without steps.
+static void
+SINM__K(sinm__sat_blur_row_simd)(const uint32_t* sat, const uint8_t* mask, uint8_t* out, int32_t w, int32_t h, int32_t y, float sigmaScale)
+{
+    const uint32_t* row = sat + (size_t)y * (w + 1);
+    const uint8_t* maskRow = mask + (size_t)y * w;
+    uint8_t* outRow = out + (size_t)y * w;
+
+    sinm__aligned_var(int32_t, 64) lanes[SINM_SIMD_WIDTH];
+    for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+        lanes[i] = i;
+    }
+    simd__int lane = simd__loadu_ix((simd__int*)lanes);
+    simd__int one = simd__set1_epi32(1);
+    simd__int lastX = simd__set1_epi32(w - 1);
+    simd__float half = simd__set1_ps(0.5f);
+
+    for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+        int32_t count = w - x;
+        //NOTE: radius of the box with the variance of a gaussian of "sigma"
+        simd__int m = SINM__K(sinm__load_heights_partial_simd_u8)(maskRow + x, count);
+        simd__float sigma = simd__mul_ps(simd__cvtepi32_ps(m), simd__set1_ps(sigmaScale));
+        simd__float variance = simd__mul_ps(simd__mul_ps(sigma, sigma), simd__set1_ps(12.0f));
+        simd__float box = simd__mul_ps(simd__sub_ps(simd__sqrt_ps(simd__add_ps(variance, simd__set1_ps(1.0f))), simd__set1_ps(1.0f)), half);
+        box = simd__min_ps(box, simd__set1_ps((float)SINM__SAT_MAX_RADIUS));
+        simd__int radius = simd__cvttps_epi32(box);
+        simd__float t = simd__sub_ps(box, simd__cvtepi32_ps(radius));
+
+        //NOTE: lanes past the end of the row repeat the last pixel so the lookups stay inside the table
+        simd__int px = simd__min_epi32(simd__add_epi32(simd__set1_epi32(x), lane), lastX);
+        simd__float a = SINM__K(sinm__sat_box_simd)(row + x, px, radius, x, y, w, h);
+        simd__float b = SINM__K(sinm__sat_box_simd)(row + x, px, simd__add_epi32(radius, one), x, y, w, h);
+        simd__float v = simd__add_ps(a, simd__mul_ps(t, simd__sub_ps(b, a)));
+        SINM__K(sinm__store_heights_partial_simd_u8)(outRow + x, simd__cvtps_epi32(v), count);
+    }
+}
+
+//Adds "v" to the lanes of "sum" where "a" > "b"
+static sinm__forceinline simd__float
+SINM__K(sinm__add_if_greater_simd)(simd__float sum, simd__float a, simd__float b, simd__float v)
+{
+#if SINM__KERNEL_PASS == 3
+    return _mm512_mask_add_ps(sum, _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ), sum, v);
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_add_ps(sum, _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ), v));
+#else
+    return _mm_add_ps(sum, _mm_and_ps(_mm_cmpgt_ps(a, b), v));
+#endif
+}
+
+//Brute force horizon of a row for one direction(see sinm__horizons). "heights" points at
+//the first pixel of the row inside the padded height field, "offsets" and "invDist" are
+//the texel offset and height scale / distance of every step.
+static void
+SINM__K(sinm__horizon_row_simd)(const uint8_t* heights, const int32_t* offsets, const float* invDist, int32_t steps, float* horizon, int32_t w)
+{
+    for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+        const uint8_t* p = heights + x;
+        simd__float h0 = simd__cvtepi32_ps(SINM__K(sinm__load_heights_simd_u8)(p));
+
+        //NOTE: the ground plane is the lowest possible horizon
+        simd__float slope = simd__setzero_ps();
+        for (int32_t k = 0; k < steps; ++k) {
+            simd__float rise = simd__sub_ps(simd__cvtepi32_ps(SINM__K(sinm__load_heights_simd_u8)(p + offsets[k])), h0);
+            slope = simd__max_ps(slope, simd__mul_ps(rise, simd__set1_ps(invDist[k])));
+        }
+
+        int32_t count = w - x;
+        if (count >= SINM_SIMD_WIDTH) {
+            simd__storeu_ps(horizon + x, slope);
+        } else {
+            sinm__aligned_var(float, 64) tail[SINM_SIMD_WIDTH];
+            simd__storeu_ps(tail, slope);
+            memcpy(horizon + x, tail, count * sizeof(float));
+        }
+    }
+}
+
+//Adds the light "w" texels get from "direction" to the three light planes
+static void
+SINM__K(sinm__ssbump_accumulate_simd)(const float* horizon, float* light, int32_t w, size_t planeSize, const sinm__ssbump_setup* setup, int32_t direction)
+{
+    int32_t count = w - w % SINM_SIMD_WIDTH;
+    for (int32_t x = 0; x < count; x += SINM_SIMD_WIDTH) {
+        simd__float slope = simd__loadu_ps(horizon + x);
+        simd__float sum[3];
+        sinm__unroll
+        for (int32_t i = 0; i < 3; ++i) {
+            sum[i] = simd__loadu_ps(light + i * planeSize + x);
+        }
+
+        sinm__unroll
+        for (int32_t e = 0; e < SINM__SSBUMP_ELEVATIONS; ++e) {
+            simd__float tanElevation = simd__set1_ps(setup->tanElevation[e]);
+            sinm__unroll
+            for (int32_t i = 0; i < 3; ++i) {
+                sum[i] = SINM__K(sinm__add_if_greater_simd)(sum[i], tanElevation, slope, simd__set1_ps(setup->weights[direction][e][i]));
+            }
+        }
+
+        sinm__unroll
+        for (int32_t i = 0; i < 3; ++i) {
+            simd__storeu_ps(light + i * planeSize + x, sum[i]);
+        }
+    }
+
+    int32_t remaining = w - count;
+    if (remaining > 0) {
+        //NOTE: the next row's light can belong to another thread so the tail goes through a padded copy
+        sinm__aligned_var(float, 64) tail[4][SINM_SIMD_WIDTH] = { { 0 } };
+        memcpy(tail[3], horizon + count, remaining * sizeof(float));
+        for (int32_t i = 0; i < 3; ++i) {
+            memcpy(tail[i], light + i * planeSize + count, remaining * sizeof(float));
+        }
+        SINM__K(sinm__ssbump_accumulate_simd)(tail[3], tail[0], SINM_SIMD_WIDTH, SINM_SIMD_WIDTH, setup, direction);
+        for (int32_t i = 0; i < 3; ++i) {
+            memcpy(light + i * planeSize + count, tail[i], remaining * sizeof(float));
+        }
+    }
+}
 
-        GLuint vShader = glsys::create_shader(GL_VERTEX_SHADER, sinm__gaussian_blur_vert_shader_source);
+//NOTE: SINM_SIMD_WIDTH texels of a row at once. "heights" points at the first pixel of
+//the row inside the padded height field and "light" at the row in the first light plane
+//so every load stays in bounds, even past the end of the row.
+static void
+SINM__K(sinm__ssbump_row_simd)(const uint8_t* heights, int32_t stride, const float* light, size_t planeSize, uint32_t* out, int32_t w, const sinm__ssbump_setup* setup)
+{
+    simd__float zero = simd__setzero_ps();
+    simd__float one = simd__set1_ps(1.0f);
+    simd__float two = simd__set1_ps(2.0f);
+    simd__float gradientScale = simd__set1_ps(-setup->gradientScale);
+    simd__float gradientScaleY = simd__set1_ps(-setup->gradientScaleY);
+
+    for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+        const uint8_t* p = heights + x;
+
+#define sinm__load_height(ptr) simd__cvtepi32_ps(SINM__K(sinm__load_heights_simd_u8)(ptr))
+        simd__float a0 = sinm__load_height(p - stride - 1);
+        simd__float a1 = sinm__load_height(p - stride);
+        simd__float a2 = sinm__load_height(p - stride + 1);
+        simd__float b0 = sinm__load_height(p - 1);
+        simd__float b2 = sinm__load_height(p + 1);
+        simd__float c0 = sinm__load_height(p + stride - 1);
+        simd__float c1 = sinm__load_height(p + stride);
+        simd__float c2 = sinm__load_height(p + stride + 1);
+#undef sinm__load_height
+
+        simd__float gx = simd__add_ps(simd__add_ps(simd__sub_ps(a2, a0), simd__mul_ps(simd__sub_ps(b2, b0), two)), simd__sub_ps(c2, c0));
+        simd__float top = simd__add_ps(simd__add_ps(a0, simd__mul_ps(a1, two)), a2);
+        simd__float bottom = simd__add_ps(simd__add_ps(c0, simd__mul_ps(c1, two)), c2);
+        simd__float gy = simd__sub_ps(bottom, top);
+
+        simd__float nx = simd__mul_ps(gx, gradientScale);
+        simd__float ny = simd__mul_ps(gy, gradientScaleY);
+        simd__float invLen = simd__div_ps(one, SINM__K(sinm__length_simd)(nx, ny, one));
+        nx = simd__mul_ps(nx, invLen);
+        ny = simd__mul_ps(ny, invLen);
+        simd__float nz = invLen;
+
+        simd__int channels[3];
+        for (int32_t i = 0; i < 3; ++i) {
+            simd__float cosine = simd__add_ps(simd__add_ps(simd__mul_ps(nx, simd__set1_ps(sinm__ssbump_basis[i][0])),
+                                                  simd__mul_ps(ny, simd__set1_ps(sinm__ssbump_basis[i][1]))),
+                simd__mul_ps(nz, simd__set1_ps(sinm__ssbump_basis[i][2])));
+            simd__float v = simd__mul_ps(simd__min_ps(one, simd__max_ps(zero, cosine)), simd__loadu_ps(light + i * planeSize + x));
+            channels[i] = simd__cvtps_epi32(simd__mul_ps(v, simd__set1_ps(255.0f)));
+        }
+        simd__int c = simd__or_ix(simd__or_ix(channels[0], simd__slli_epi32(channels[1], 8)),
+            simd__or_ix(simd__slli_epi32(channels[2], 16), simd__set1_epi32(255u << 24u)));
 
-        {
-            std::string fCode = fsys::read_file<std::string>("shaders/greyscale_average.frag");
-            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
-            GLuint program = glsys::create_program(vShader, fShader);
-            assert(program != 0);
-            sinm__glCtx.greyscaleAverageShader = program;
+        int32_t count = w - x;
+        if (count >= SINM_SIMD_WIDTH) {
+            simd__storeu_ix((simd__int*)&out[x], c);
+        } else {
+            sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+            simd__storeu_ix((simd__int*)tail, c);
+            memcpy(out + x, tail, count * sizeof(uint32_t));
+        }
+    }
+}
+
+//Adds the unblocked sky of a direction to "occlusion". If "out" isn't NULL this is
+//the last direction and the sums times "scale" are written to it as grey pixels.
+static void
+SINM__K(sinm__ao_accumulate_simd)(const float* horizon, float* occlusion, uint32_t* out, int32_t w, float scale)
+{
+    simd__float one = simd__set1_ps(1.0f);
+    simd__float toByte = simd__set1_ps(scale * 255.0f);
+
+    int32_t count = w - w % SINM_SIMD_WIDTH;
+    for (int32_t x = 0; x < count; x += SINM_SIMD_WIDTH) {
+        simd__float slope = simd__loadu_ps(horizon + x);
+        simd__float sum = simd__add_ps(simd__loadu_ps(occlusion + x), simd__div_ps(one, simd__add_ps(one, simd__mul_ps(slope, slope))));
+        simd__storeu_ps(occlusion + x, sum);
+
+        if (out) {
+            simd__int l = simd__cvtps_epi32(simd__mul_ps(sum, toByte));
+            l = simd__or_ix(simd__or_ix(l, simd__slli_epi32(l, 8)), simd__or_ix(simd__slli_epi32(l, 16), simd__set1_epi32(255u << 24u)));
+            simd__storeu_ix((simd__int*)&out[x], l);
+        }
+    }
+
+    int32_t remaining = w - count;
+    if (remaining > 0) {
+        sinm__aligned_var(float, 64) tailHorizon[SINM_SIMD_WIDTH] = { 0 };
+        sinm__aligned_var(float, 64) tailOcclusion[SINM_SIMD_WIDTH] = { 0 };
+        sinm__aligned_var(uint32_t, 64) tailOut[SINM_SIMD_WIDTH];
+        memcpy(tailHorizon, horizon + count, remaining * sizeof(float));
+        memcpy(tailOcclusion, occlusion + count, remaining * sizeof(float));
+        SINM__K(sinm__ao_accumulate_simd)(tailHorizon, tailOcclusion, (out) ? tailOut : NULL, SINM_SIMD_WIDTH, scale);
+        memcpy(occlusion + count, tailOcclusion, remaining * sizeof(float));
+        if (out) {
+            memcpy(out + count, tailOut, remaining * sizeof(uint32_t));
+        }
+    }
+}
+
+//NOTE: mip levels are kept as four float planes, the average vector of every texel's
+//footprint and the average length of the vectors in it. An average of averages is
+//still exact so every level sees the whole level 0 footprint.
+
+//Adds up neighbouring lanes, (a0 + a1, a2 + a3, ..., b0 + b1, b2 + b3, ...)
+static sinm__forceinline simd__float
+SINM__K(sinm__pair_add_simd)(simd__float a, simd__float b)
+{
+#if SINM__KERNEL_PASS == 3
+    __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    return _mm512_add_ps(_mm512_permutex2var_ps(a, even, b), _mm512_permutex2var_ps(a, odd, b));
+#elif SINM__KERNEL_PASS == 2
+    //NOTE: hadd works within 128 bit lanes, put the halves of "a" and "b" back together
+    __m256d t = _mm256_castps_pd(_mm256_hadd_ps(a, b));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(t, _MM_SHUFFLE(3, 1, 2, 0)));
+#else
+    return _mm_hadd_ps(a, b);
+#endif
+}
+
+//Decodes pixels into vectors(v[0..2]) and their lengths(v[3]). Colors are squared as a
+//cheap stand in for sRGB to linear and v[3] is their alpha.
+static sinm__forceinline void
+SINM__K(sinm__mip_decode_simd)(simd__int c, sinm_mip_type type, simd__float* v)
+{
+    simd__int ff = simd__set1_epi32(0xFF);
+    if (type == sinm_mip_color_map) {
+        simd__float scale = simd__set1_ps(1.0f / 255.0f);
+        v[0] = simd__mul_ps(simd__cvtepi32_ps(simd__and_ix(c, ff)), scale);
+        v[1] = simd__mul_ps(simd__cvtepi32_ps(simd__and_ix(simd__srli_epi32(c, 8), ff)), scale);
+        v[2] = simd__mul_ps(simd__cvtepi32_ps(simd__and_ix(simd__srli_epi32(c, 16), ff)), scale);
+        v[3] = simd__mul_ps(simd__cvtepi32_ps(simd__srli_epi32(c, 24)), scale);
+        v[0] = simd__mul_ps(v[0], v[0]);
+        v[1] = simd__mul_ps(v[1], v[1]);
+        v[2] = simd__mul_ps(v[2], v[2]);
+        return;
+    }
+    simd__int bias = simd__set1_epi32((type == sinm_mip_normal_map) ? 127 : 0);
+    simd__float scale = simd__set1_ps((type == sinm_mip_normal_map) ? 1.0f / 127.0f : 1.0f / 255.0f);
+    v[0] = simd__mul_ps(simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(c, ff), bias)), scale);
+    v[1] = simd__mul_ps(simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 8), ff), bias)), scale);
+    v[2] = simd__mul_ps(simd__cvtepi32_ps(simd__sub_epi32(simd__and_ix(simd__srli_epi32(c, 16), ff), bias)), scale);
+    v[3] = SINM__K(sinm__length_simd)(v[0], v[1], v[2]);
+}
+
+//Writes one vector of each plane at column "x" of rows that are "w" long
+static sinm__forceinline void
+SINM__K(sinm__mip_store_simd)(float* const planes[4], int32_t x, int32_t w, const simd__float* v)
+{
+    int32_t count = w - x;
+    sinm__unroll
+    for (int32_t i = 0; i < 4; ++i) {
+        if (count >= SINM_SIMD_WIDTH) {
+            simd__storeu_ps(planes[i] + x, v[i]);
+        } else {
+            sinm__aligned_var(float, 64) tail[SINM_SIMD_WIDTH];
+            simd__storeu_ps(tail, v[i]);
+            memcpy(planes[i] + x, tail, count * sizeof(float));
+        }
+    }
+}
+
+//Averages the 2x2 blocks of pixel rows "row0" and "row1" into a row of level 1 planes
+static void
+SINM__K(sinm__mip_first_row_simd)(const uint32_t* row0, const uint32_t* row1, int32_t srcW, float* const dst[4], int32_t dstW, sinm_mip_type type)
+{
+    simd__float quarter = simd__set1_ps(0.25f);
+
+    for (int32_t x = 0; x < dstW; x += SINM_SIMD_WIDTH) {
+        const uint32_t* a = row0 + 2 * x;
+        const uint32_t* b = row1 + 2 * x;
+        sinm__aligned_var(uint32_t, 64) edge[2][2 * SINM_SIMD_WIDTH];
+        if (2 * x + 2 * SINM_SIMD_WIDTH > srcW) {
+            //NOTE: the tail(and a 1 pixel wide source) reads clamped columns
+            for (int32_t i = 0; i < 2 * SINM_SIMD_WIDTH; ++i) {
+                int32_t column = sinm__min(2 * x + i, srcW - 1);
+                edge[0][i] = row0[column];
+                edge[1][i] = row1[column];
+            }
+            a = edge[0];
+            b = edge[1];
+        }
+
+        simd__float lo[4], hi[4], t[4];
+        SINM__K(sinm__mip_decode_simd)(simd__loadu_ix((const simd__int*)a), type, lo);
+        SINM__K(sinm__mip_decode_simd)(simd__loadu_ix((const simd__int*)b), type, t);
+        sinm__unroll
+        for (int32_t i = 0; i < 4; ++i) {
+            lo[i] = simd__add_ps(lo[i], t[i]);
+        }
+        SINM__K(sinm__mip_decode_simd)(simd__loadu_ix((const simd__int*)(a + SINM_SIMD_WIDTH)), type, hi);
+        SINM__K(sinm__mip_decode_simd)(simd__loadu_ix((const simd__int*)(b + SINM_SIMD_WIDTH)), type, t);
+        sinm__unroll
+        for (int32_t i = 0; i < 4; ++i) {
+            hi[i] = simd__add_ps(hi[i], t[i]);
+            lo[i] = simd__mul_ps(SINM__K(sinm__pair_add_simd)(lo[i], hi[i]), quarter);
+        }
+        SINM__K(sinm__mip_store_simd)(dst, x, dstW, lo);
+    }
+}
+
+//Averages the 2x2 blocks of two rows of planes into a row of the next level
+static void
+SINM__K(sinm__mip_reduce_row_simd)(const float* const row0[4], const float* const row1[4], int32_t srcW, float* const dst[4], int32_t dstW)
+{
+    simd__float quarter = simd__set1_ps(0.25f);
+
+    for (int32_t x = 0; x < dstW; x += SINM_SIMD_WIDTH) {
+        simd__float v[4];
+        for (int32_t i = 0; i < 4; ++i) {
+            const float* a = row0[i] + 2 * x;
+            const float* b = row1[i] + 2 * x;
+            sinm__aligned_var(float, 64) edge[2][2 * SINM_SIMD_WIDTH];
+            if (2 * x + 2 * SINM_SIMD_WIDTH > srcW) {
+                for (int32_t j = 0; j < 2 * SINM_SIMD_WIDTH; ++j) {
+                    int32_t column = sinm__min(2 * x + j, srcW - 1);
+                    edge[0][j] = row0[i][column];
+                    edge[1][j] = row1[i][column];
+                }
+                a = edge[0];
+                b = edge[1];
+            }
+            simd__float lo = simd__add_ps(simd__loadu_ps(a), simd__loadu_ps(b));
+            simd__float hi = simd__add_ps(simd__loadu_ps(a + SINM_SIMD_WIDTH), simd__loadu_ps(b + SINM_SIMD_WIDTH));
+            v[i] = simd__mul_ps(SINM__K(sinm__pair_add_simd)(lo, hi), quarter);
+        }
+        SINM__K(sinm__mip_store_simd)(dst, x, dstW, v);
+    }
+}
+
+//Encodes a row of planes as pixels. Normals are renormalized to unit length and ssbump
+//vectors to the average length of their footprint. The ratio between the length of the
+//average and the average length is what the Toksvig factor is made from.
+static void
+SINM__K(sinm__mip_encode_row_simd)(const float* const planes[4], uint32_t* out, int32_t w, sinm_mip_type type, float toksvigPower)
+{
+    simd__float one = simd__set1_ps(1.0f);
+    simd__float epsilon = simd__set1_ps(1e-6f);
+    simd__float power = simd__set1_ps(toksvigPower);
+    simd__float v255 = simd__set1_ps(255.0f);
+    simd__int rgbMask = simd__set1_epi32(0x00FFFFFF);
+
+    for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+        int32_t count = w - x;
+        simd__float v[4];
+        for (int32_t i = 0; i < 4; ++i) {
+            if (count >= SINM_SIMD_WIDTH) {
+                v[i] = simd__loadu_ps(planes[i] + x);
+            } else {
+                sinm__aligned_var(float, 64) tail[SINM_SIMD_WIDTH] = { 0 };
+                memcpy(tail, planes[i] + x, count * sizeof(float));
+                v[i] = simd__loadu_ps(tail);
+            }
+        }
+
+        simd__float len = SINM__K(sinm__length_simd)(v[0], v[1], v[2]);
+        simd__float target = (type == sinm_mip_normal_map) ? one : v[3];
+        simd__float s = simd__div_ps(target, simd__max_ps(len, epsilon));
+        simd__float nx = simd__mul_ps(v[0], s);
+        simd__float ny = simd__mul_ps(v[1], s);
+        simd__float nz = simd__mul_ps(v[2], s);
+        if (type == sinm_mip_color_map) {
+            nx = simd__sqrt_ps(v[0]);
+            ny = simd__sqrt_ps(v[1]);
+            nz = simd__sqrt_ps(v[2]);
+        }
+
+        simd__int c;
+        if (type == sinm_mip_normal_map) {
+            c = SINM__K(sinm__v3_to_rgba_simd)(nx, ny, nz);
+        } else {
+            simd__int zero = simd__set1_epi32(0);
+            simd__int ff = simd__set1_epi32(0xFF);
+            simd__int r = simd__min_epi32(ff, simd__max_epi32(zero, simd__cvtps_epi32(simd__mul_ps(nx, v255))));
+            simd__int g = simd__min_epi32(ff, simd__max_epi32(zero, simd__cvtps_epi32(simd__mul_ps(ny, v255))));
+            simd__int b = simd__min_epi32(ff, simd__max_epi32(zero, simd__cvtps_epi32(simd__mul_ps(nz, v255))));
+            c = simd__or_ix(r, simd__or_ix(simd__slli_epi32(g, 8), simd__slli_epi32(b, 16)));
+        }
+
+        simd__int alpha;
+        if (type == sinm_mip_color_map) {
+            alpha = simd__slli_epi32(simd__cvtps_epi32(simd__mul_ps(v[3], v255)), 24);
+        } else if (toksvigPower > 0.0f) {
+            //NOTE: ft = r / (r + power * (1 - r)), an empty footprint counts as flat
+            simd__float r = simd__min_ps(one, simd__div_ps(simd__add_ps(len, epsilon), simd__add_ps(v[3], epsilon)));
+            simd__float ft = simd__div_ps(r, simd__add_ps(r, simd__mul_ps(power, simd__sub_ps(one, r))));
+            alpha = simd__slli_epi32(simd__cvtps_epi32(simd__mul_ps(ft, v255)), 24);
+        } else {
+            alpha = simd__set1_epi32(255u << 24u);
+        }
+        c = simd__or_ix(simd__and_ix(c, rgbMask), alpha);
+
+        if (count >= SINM_SIMD_WIDTH) {
+            simd__storeu_ix((simd__int*)&out[x], c);
+        } else {
+            sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+            simd__storeu_ix((simd__int*)tail, c);
+            memcpy(out + x, tail, count * sizeof(uint32_t));
+        }
+    }
+}
+
+//NOTE: block compression runs one block per lane. The texels of SINM_SIMD_WIDTH blocks
+//are loaded a row at a time and turned around with 4x4 transposes inside every 128 bit
+//lane, which leaves lane i holding block sinm__bc_lane_block(i) of the group.
+#define sinm__bc_lane_block(i) ((SINM_SIMD_WIDTH / 4) * ((i) % 4) + (i) / 4)
+
+//Transposes the 4x4 blocks of 32 bit values inside every 128 bit lane of v[0..3]
+static sinm__forceinline void
+SINM__K(sinm__transpose4_simd)(simd__int* v)
+{
+    simd__int t0 = simd__unpacklo_epi32(v[0], v[1]);
+    simd__int t1 = simd__unpackhi_epi32(v[0], v[1]);
+    simd__int t2 = simd__unpacklo_epi32(v[2], v[3]);
+    simd__int t3 = simd__unpackhi_epi32(v[2], v[3]);
+    v[0] = simd__unpacklo_epi64(t0, t2);
+    v[1] = simd__unpackhi_epi64(t0, t2);
+    v[2] = simd__unpacklo_epi64(t1, t3);
+    v[3] = simd__unpackhi_epi64(t1, t3);
+}
+
+//Pixel rows of block row "by", the bottom edge repeats the last row
+static sinm__inline void
+SINM__K(sinm__bc_rows)(const uint32_t* in, int32_t w, int32_t h, int32_t by, const uint32_t** rows)
+{
+    for (int32_t ty = 0; ty < 4; ++ty) {
+        rows[ty] = in + (size_t)sinm__min(by * 4 + ty, h - 1) * w;
+    }
+}
+
+//Loads the SINM_SIMD_WIDTH blocks starting at column "x", texels[t] holds texel t(row
+//major) of every lane's block. Columns past "w" repeat the last one.
+static sinm__forceinline void
+SINM__K(sinm__bc_load_simd)(const uint32_t* const* rows, int32_t x, int32_t w, simd__int* texels)
+{
+    for (int32_t ty = 0; ty < 4; ++ty) {
+        const uint32_t* row = rows[ty] + x;
+        sinm__aligned_var(uint32_t, 64) edge[4 * SINM_SIMD_WIDTH];
+        if (x + 4 * SINM_SIMD_WIDTH > w) {
+            for (int32_t i = 0; i < 4 * SINM_SIMD_WIDTH; ++i) {
+                edge[i] = rows[ty][sinm__min(x + i, w - 1)];
+            }
+            row = edge;
+        }
+        simd__int* v = texels + ty * 4;
+        sinm__unroll
+        for (int32_t k = 0; k < 4; ++k) {
+            v[k] = simd__loadu_ix((const simd__int*)(row + k * SINM_SIMD_WIDTH));
+        }
+        SINM__K(sinm__transpose4_simd)(v);
+    }
+}
+
+//"x < y ? b : a" per lane
+static sinm__forceinline simd__float
+SINM__K(sinm__select_lt_ps)(simd__float a, simd__float b, simd__float x, simd__float y)
+{
+#if SINM__KERNEL_PASS == 3
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, y, _CMP_LT_OQ), a, b);
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_blendv_ps(a, b, _mm256_cmp_ps(x, y, _CMP_LT_OQ));
+#else
+    return _mm_blendv_ps(a, b, _mm_cmplt_ps(x, y));
+#endif
+}
+
+static sinm__forceinline simd__int
+SINM__K(sinm__select_lt_epi32)(simd__int a, simd__int b, simd__float x, simd__float y)
+{
+#if SINM__KERNEL_PASS == 3
+    return _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(x, y, _CMP_LT_OQ), a, b);
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _mm256_cmp_ps(x, y, _CMP_LT_OQ)));
+#else
+    return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _mm_cmplt_ps(x, y)));
+#endif
+}
+
+//Squared error of encoding the texels "v" with endpoints "lo" and "hi". "steps" gets
+//the picked interpolation steps, 0 is "lo" and 7 is "hi". Endpoints that can't be used
+//in the 8 value mode(hi <= lo) get an infinite error unless every texel is "lo".
+static sinm__forceinline simd__float
+SINM__K(sinm__bc4_error_simd)(const simd__float* v, simd__float lo, simd__float hi, simd__int* steps)
+{
+    simd__float one = simd__set1_ps(1.0f);
+    simd__float range = simd__sub_ps(hi, lo);
+    simd__float toStep = simd__div_ps(simd__set1_ps(7.0f), simd__max_ps(range, one));
+    simd__float toValue = simd__mul_ps(range, simd__set1_ps(1.0f / 7.0f));
+    simd__int zero = simd__set1_epi32(0);
+    simd__int seven = simd__set1_epi32(7);
+
+    simd__float error = simd__setzero_ps();
+    sinm__unroll
+    for (int32_t t = 0; t < 16; ++t) {
+        simd__int s = simd__cvtps_epi32(simd__mul_ps(simd__sub_ps(v[t], lo), toStep));
+        s = simd__min_epi32(seven, simd__max_epi32(zero, s));
+        steps[t] = s;
+        simd__float d = simd__sub_ps(v[t], simd__add_ps(lo, simd__mul_ps(simd__cvtepi32_ps(s), toValue)));
+        error = simd__add_ps(error, simd__mul_ps(d, d));
+    }
+    //NOTE: equal endpoints switch to the 6 value mode where steps 6 and 7 decode to 0 and 255
+    simd__float invalid = SINM__K(sinm__select_lt_ps)(simd__setzero_ps(), simd__set1_ps(3.0e38f), range, one);
+    return SINM__K(sinm__select_lt_ps)(error, simd__add_ps(error, invalid), simd__setzero_ps(), error);
+}
+
+//Encodes one BC4 block per lane from the 16 texels in "v"(0-255). "endpoints" gets the
+//first two bytes of every block and "bits" the 48 bits of indices as two 32 bit halves.
+static sinm__forceinline void
+SINM__K(sinm__bc4_encode_simd)(const simd__float* v, sinm_bc_quality quality, simd__int* endpoints, simd__int* bits)
+{
+    simd__float zero = simd__setzero_ps();
+    simd__float v255 = simd__set1_ps(255.0f);
+    simd__float lo = v[0];
+    simd__float hi = v[0];
+    for (int32_t t = 1; t < 16; ++t) {
+        lo = simd__min_ps(lo, v[t]);
+        hi = simd__max_ps(hi, v[t]);
+    }
+    simd__int steps[16];
+    simd__float error = SINM__K(sinm__bc4_error_simd)(v, lo, hi, steps);
+
+    if (quality >= sinm_bc_balanced) {
+        //NOTE: least squares endpoints for the picked steps, v = lo * (1 - s) + hi * s
+        simd__float one = simd__set1_ps(1.0f);
+        simd__float aa = zero, ab = zero, bb = zero, av = zero, bv = zero;
+        for (int32_t t = 0; t < 16; ++t) {
+            simd__float b = simd__mul_ps(simd__cvtepi32_ps(steps[t]), simd__set1_ps(1.0f / 7.0f));
+            simd__float a = simd__sub_ps(one, b);
+            aa = simd__add_ps(aa, simd__mul_ps(a, a));
+            ab = simd__add_ps(ab, simd__mul_ps(a, b));
+            bb = simd__add_ps(bb, simd__mul_ps(b, b));
+            av = simd__add_ps(av, simd__mul_ps(a, v[t]));
+            bv = simd__add_ps(bv, simd__mul_ps(b, v[t]));
         }
+        simd__float det = simd__sub_ps(simd__mul_ps(aa, bb), simd__mul_ps(ab, ab));
+        simd__float invDet = simd__div_ps(one, simd__max_ps(det, simd__set1_ps(1e-6f)));
+        simd__float fitLo = simd__mul_ps(simd__sub_ps(simd__mul_ps(av, bb), simd__mul_ps(bv, ab)), invDet);
+        simd__float fitHi = simd__mul_ps(simd__sub_ps(simd__mul_ps(bv, aa), simd__mul_ps(av, ab)), invDet);
+        fitLo = simd__min_ps(v255, simd__max_ps(zero, simd__cvtepi32_ps(simd__cvtps_epi32(fitLo))));
+        fitHi = simd__min_ps(v255, simd__max_ps(zero, simd__cvtepi32_ps(simd__cvtps_epi32(fitHi))));
+        //NOTE: every texel on the same step leaves nothing to fit
+        fitLo = SINM__K(sinm__select_lt_ps)(lo, fitLo, simd__set1_ps(1e-6f), det);
+        fitHi = SINM__K(sinm__select_lt_ps)(hi, fitHi, simd__set1_ps(1e-6f), det);
+
+        simd__int fitSteps[16];
+        simd__float fitError = SINM__K(sinm__bc4_error_simd)(v, fitLo, fitHi, fitSteps);
+        lo = SINM__K(sinm__select_lt_ps)(lo, fitLo, fitError, error);
+        hi = SINM__K(sinm__select_lt_ps)(hi, fitHi, fitError, error);
+        for (int32_t t = 0; t < 16; ++t) {
+            steps[t] = SINM__K(sinm__select_lt_epi32)(steps[t], fitSteps[t], fitError, error);
+        }
+        error = simd__min_ps(error, fitError);
+    }
+
+    if (quality >= sinm_bc_high) {
+        simd__float centerLo = lo;
+        simd__float centerHi = hi;
+        for (int32_t i = 0; i < 9; ++i) {
+            if (i == 4) {
+                continue;
+            }
+            simd__float tryLo = simd__max_ps(zero, simd__add_ps(centerLo, simd__set1_ps((float)(i % 3 - 1))));
+            simd__float tryHi = simd__min_ps(v255, simd__add_ps(centerHi, simd__set1_ps((float)(i / 3 - 1))));
+            simd__int trySteps[16];
+            simd__float tryError = SINM__K(sinm__bc4_error_simd)(v, tryLo, tryHi, trySteps);
+            lo = SINM__K(sinm__select_lt_ps)(lo, tryLo, tryError, error);
+            hi = SINM__K(sinm__select_lt_ps)(hi, tryHi, tryError, error);
+            for (int32_t t = 0; t < 16; ++t) {
+                steps[t] = SINM__K(sinm__select_lt_epi32)(steps[t], trySteps[t], tryError, error);
+            }
+            error = simd__min_ps(error, tryError);
+        }
+    }
+
+    //NOTE: red_0 = hi and red_1 = lo so step s is index 8 - s, except 7 -> 0 and 0 -> 1
+    simd__int one = simd__set1_epi32(1);
+    simd__int seven = simd__set1_epi32(7);
+    simd__int eight = simd__set1_epi32(8);
+    bits[0] = simd__set1_epi32(0);
+    bits[1] = simd__set1_epi32(0);
+    sinm__unroll
+    for (int32_t t = 0; t < 16; ++t) {
+        simd__int index = simd__and_ix(simd__sub_epi32(eight, steps[t]), seven);
+        simd__int low = simd__sub_epi32(one, simd__min_epi32(one, simd__srli_epi32(index, 1)));
+        index = simd__xor_ix(index, low);
+        //NOTE: multiplies instead of shifts since the shift counts have to be immediates
+        int32_t bit = 3 * t;
+        if (bit < 32) {
+            bits[0] = simd__or_ix(bits[0], simd__mullo_epi32(index, simd__set1_epi32((int32_t)(1u << bit))));
+        }
+        if (bit + 3 > 32) {
+            bits[1] = simd__or_ix(bits[1], (bit >= 32) ? simd__mullo_epi32(index, simd__set1_epi32(1 << (bit - 32))) : simd__srli_epi32(index, 2));
+        }
+    }
+    *endpoints = simd__or_ix(simd__cvtps_epi32(hi), simd__slli_epi32(simd__cvtps_epi32(lo), 8));
+}
+
+//Compresses block row "by" of the image to BC5, 16 bytes per block
+static void
+SINM__K(sinm__bc5_row_simd)(const uint32_t* in, int32_t w, int32_t h, int32_t by, uint8_t* out, sinm_bc_quality quality)
+{
+    int32_t blocksW = (w + 3) / 4;
+    const uint32_t* rows[4];
+    SINM__K(sinm__bc_rows)(in, w, h, by, rows);
+
+    simd__int ff = simd__set1_epi32(0xFF);
+    for (int32_t bx = 0; bx < blocksW; bx += SINM_SIMD_WIDTH) {
+        simd__int texels[16];
+        SINM__K(sinm__bc_load_simd)(rows, bx * 4, w, texels);
+
+        sinm__aligned_var(uint32_t, 64) endpoints[2][SINM_SIMD_WIDTH];
+        sinm__aligned_var(uint32_t, 64) bits[2][2][SINM_SIMD_WIDTH];
+        for (int32_t c = 0; c < 2; ++c) {
+            simd__float v[16];
+            sinm__unroll
+            for (int32_t t = 0; t < 16; ++t) {
+                simd__int channel = (c == 0) ? texels[t] : simd__srli_epi32(texels[t], 8);
+                v[t] = simd__cvtepi32_ps(simd__and_ix(channel, ff));
+            }
+            simd__int e, b[2];
+            SINM__K(sinm__bc4_encode_simd)(v, quality, &e, b);
+            simd__storeu_ix((simd__int*)endpoints[c], e);
+            simd__storeu_ix((simd__int*)bits[c][0], b[0]);
+            simd__storeu_ix((simd__int*)bits[c][1], b[1]);
+        }
+
+        for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+            int32_t block = bx + sinm__bc_lane_block(i);
+            if (block < blocksW) {
+                for (int32_t c = 0; c < 2; ++c) {
+                    uint64_t word = endpoints[c][i] | ((uint64_t)bits[c][0][i] << 16) | ((uint64_t)bits[c][1][i] << 48);
+                    memcpy(out + block * 16 + c * 8, &word, 8);
+                }
+            }
+        }
+    }
+}
+
+//NOTE: BC1 and BC7 share the endpoint search. "v" holds "channels" rows of the 16 texels
+//of every lane's block, 0-255.
+
+//Endpoints at the ends of the block's principal axis. The axis comes from a few power
+//iterations on the covariance, starting at the column of the widest channel.
+static sinm__forceinline void
+SINM__K(sinm__bc_principal_endpoints_simd)(simd__float (*v)[16], int32_t channels, simd__float* e0, simd__float* e1)
+{
+    simd__float zero = simd__setzero_ps();
+    simd__float v255 = simd__set1_ps(255.0f);
+    simd__float epsilon = simd__set1_ps(1e-6f);
+    simd__float mean[4];
+    for (int32_t a = 0; a < channels; ++a) {
+        simd__float sum = zero;
+        for (int32_t t = 0; t < 16; ++t) {
+            sum = simd__add_ps(sum, v[a][t]);
+        }
+        mean[a] = simd__mul_ps(sum, simd__set1_ps(1.0f / 16.0f));
+    }
+
+    simd__float cov[4][4];
+    for (int32_t a = 0; a < channels; ++a) {
+        for (int32_t b = 0; b <= a; ++b) {
+            simd__float sum = zero;
+            for (int32_t t = 0; t < 16; ++t) {
+                sum = simd__add_ps(sum, simd__mul_ps(simd__sub_ps(v[a][t], mean[a]), simd__sub_ps(v[b][t], mean[b])));
+            }
+            cov[a][b] = sum;
+            cov[b][a] = sum;
+        }
+    }
+
+    simd__float axis[4];
+    simd__float widest = cov[0][0];
+    for (int32_t a = 0; a < channels; ++a) {
+        axis[a] = cov[a][0];
+    }
+    for (int32_t k = 1; k < channels; ++k) {
+        for (int32_t a = 0; a < channels; ++a) {
+            axis[a] = SINM__K(sinm__select_lt_ps)(axis[a], cov[a][k], widest, cov[k][k]);
+        }
+        widest = simd__max_ps(widest, cov[k][k]);
+    }
+    for (int32_t i = 0; i < 4; ++i) {
+        simd__float next[4];
+        simd__float largest = epsilon;
+        for (int32_t a = 0; a < channels; ++a) {
+            next[a] = zero;
+            for (int32_t b = 0; b < channels; ++b) {
+                next[a] = simd__add_ps(next[a], simd__mul_ps(cov[a][b], axis[b]));
+            }
+            largest = simd__max_ps(largest, simd__max_ps(next[a], simd__sub_ps(zero, next[a])));
+        }
+        //NOTE: scaled by the largest component rather than normalized, only the direction matters
+        simd__float invLargest = simd__div_ps(simd__set1_ps(1.0f), largest);
+        for (int32_t a = 0; a < channels; ++a) {
+            axis[a] = simd__mul_ps(next[a], invLargest);
+        }
+    }
+
+    simd__float length2 = zero;
+    for (int32_t a = 0; a < channels; ++a) {
+        length2 = simd__add_ps(length2, simd__mul_ps(axis[a], axis[a]));
+    }
+    simd__float lo = simd__set1_ps(3.0e38f);
+    simd__float hi = simd__set1_ps(-3.0e38f);
+    for (int32_t t = 0; t < 16; ++t) {
+        simd__float p = zero;
+        for (int32_t a = 0; a < channels; ++a) {
+            p = simd__add_ps(p, simd__mul_ps(simd__sub_ps(v[a][t], mean[a]), axis[a]));
+        }
+        lo = simd__min_ps(lo, p);
+        hi = simd__max_ps(hi, p);
+    }
+    simd__float invLength2 = simd__div_ps(simd__set1_ps(1.0f), simd__max_ps(length2, epsilon));
+    lo = simd__mul_ps(lo, invLength2);
+    hi = simd__mul_ps(hi, invLength2);
+    for (int32_t a = 0; a < channels; ++a) {
+        e0[a] = simd__min_ps(v255, simd__max_ps(zero, simd__add_ps(mean[a], simd__mul_ps(axis[a], lo))));
+        e1[a] = simd__min_ps(v255, simd__max_ps(zero, simd__add_ps(mean[a], simd__mul_ps(axis[a], hi))));
+    }
+}
+
+//Picks the closest of "stepCount" evenly spaced colors from "e0" to "e1" for every texel
+//and returns the squared error. Step 0 is "e0".
+static sinm__forceinline simd__float
+SINM__K(sinm__bc_steps_simd)(simd__float (*v)[16], int32_t channels, const simd__float* e0, const simd__float* e1, int32_t stepCount, simd__int* steps)
+{
+    simd__float zero = simd__setzero_ps();
+    simd__float d[4];
+    simd__float length2 = zero;
+    for (int32_t a = 0; a < channels; ++a) {
+        d[a] = simd__sub_ps(e1[a], e0[a]);
+        length2 = simd__add_ps(length2, simd__mul_ps(d[a], d[a]));
+    }
+    simd__float toStep = simd__div_ps(simd__set1_ps((float)(stepCount - 1)), simd__max_ps(length2, simd__set1_ps(1e-6f)));
+    simd__float fromStep = simd__set1_ps(1.0f / (stepCount - 1));
+    simd__int lastStep = simd__set1_epi32(stepCount - 1);
+    simd__int zeroStep = simd__set1_epi32(0);
+
+    simd__float error = zero;
+    for (int32_t t = 0; t < 16; ++t) {
+        simd__float p = zero;
+        for (int32_t a = 0; a < channels; ++a) {
+            p = simd__add_ps(p, simd__mul_ps(simd__sub_ps(v[a][t], e0[a]), d[a]));
+        }
+        simd__int s = simd__min_epi32(lastStep, simd__max_epi32(zeroStep, simd__cvtps_epi32(simd__mul_ps(p, toStep))));
+        steps[t] = s;
+        simd__float f = simd__mul_ps(simd__cvtepi32_ps(s), fromStep);
+        for (int32_t a = 0; a < channels; ++a) {
+            simd__float diff = simd__sub_ps(v[a][t], simd__add_ps(e0[a], simd__mul_ps(d[a], f)));
+            error = simd__add_ps(error, simd__mul_ps(diff, diff));
+        }
+    }
+    return error;
+}
+
+//Least squares endpoints for the picked steps. Lanes where every texel is on the same
+//step keep "e0" and "e1".
+static sinm__forceinline void
+SINM__K(sinm__bc_refit_simd)(simd__float (*v)[16], int32_t channels, const simd__int* steps, int32_t stepCount, simd__float* e0, simd__float* e1)
+{
+    simd__float zero = simd__setzero_ps();
+    simd__float one = simd__set1_ps(1.0f);
+    simd__float v255 = simd__set1_ps(255.0f);
+    simd__float fromStep = simd__set1_ps(1.0f / (stepCount - 1));
+    simd__float aa = zero, ab = zero, bb = zero;
+    simd__float av[4], bv[4];
+    for (int32_t a = 0; a < channels; ++a) {
+        av[a] = zero;
+        bv[a] = zero;
+    }
+    for (int32_t t = 0; t < 16; ++t) {
+        simd__float b = simd__mul_ps(simd__cvtepi32_ps(steps[t]), fromStep);
+        simd__float a = simd__sub_ps(one, b);
+        aa = simd__add_ps(aa, simd__mul_ps(a, a));
+        ab = simd__add_ps(ab, simd__mul_ps(a, b));
+        bb = simd__add_ps(bb, simd__mul_ps(b, b));
+        for (int32_t c = 0; c < channels; ++c) {
+            av[c] = simd__add_ps(av[c], simd__mul_ps(a, v[c][t]));
+            bv[c] = simd__add_ps(bv[c], simd__mul_ps(b, v[c][t]));
+        }
+    }
+    simd__float det = simd__sub_ps(simd__mul_ps(aa, bb), simd__mul_ps(ab, ab));
+    simd__float minDet = simd__set1_ps(1e-6f);
+    simd__float invDet = simd__div_ps(one, simd__max_ps(det, minDet));
+    for (int32_t c = 0; c < channels; ++c) {
+        simd__float fit0 = simd__mul_ps(simd__sub_ps(simd__mul_ps(av[c], bb), simd__mul_ps(bv[c], ab)), invDet);
+        simd__float fit1 = simd__mul_ps(simd__sub_ps(simd__mul_ps(bv[c], aa), simd__mul_ps(av[c], ab)), invDet);
+        fit0 = simd__min_ps(v255, simd__max_ps(zero, fit0));
+        fit1 = simd__min_ps(v255, simd__max_ps(zero, fit1));
+        e0[c] = SINM__K(sinm__select_lt_ps)(e0[c], fit0, minDet, det);
+        e1[c] = SINM__K(sinm__select_lt_ps)(e1[c], fit1, minDet, det);
+    }
+}
+
+//Rounds endpoints to 565, "e" is replaced by the 8 bit colors the gpu expands them to.
+//Returns the packed 16 bit colors.
+static sinm__forceinline simd__int
+SINM__K(sinm__bc1_quantize_simd)(simd__float* e)
+{
+    simd__int r = simd__cvtps_epi32(simd__mul_ps(e[0], simd__set1_ps(31.0f / 255.0f)));
+    simd__int g = simd__cvtps_epi32(simd__mul_ps(e[1], simd__set1_ps(63.0f / 255.0f)));
+    simd__int b = simd__cvtps_epi32(simd__mul_ps(e[2], simd__set1_ps(31.0f / 255.0f)));
+    e[0] = simd__cvtepi32_ps(simd__or_ix(simd__slli_epi32(r, 3), simd__srli_epi32(r, 2)));
+    e[1] = simd__cvtepi32_ps(simd__or_ix(simd__slli_epi32(g, 2), simd__srli_epi32(g, 4)));
+    e[2] = simd__cvtepi32_ps(simd__or_ix(simd__slli_epi32(b, 3), simd__srli_epi32(b, 2)));
+    return simd__or_ix(simd__or_ix(simd__slli_epi32(r, 11), simd__slli_epi32(g, 5)), b);
+}
+
+//Number of least squares refits per quality level
+static sinm__inline int32_t
+SINM__K(sinm__bc_refits)(sinm_bc_quality quality)
+{
+    return (quality == sinm_bc_high) ? 3 : (quality == sinm_bc_balanced) ? 1 : 0;
+}
+
+//Compresses block row "by" of the image to BC1 without alpha, 8 bytes per block
+static void
+SINM__K(sinm__bc1_row_simd)(const uint32_t* in, int32_t w, int32_t h, int32_t by, uint8_t* out, sinm_bc_quality quality)
+{
+    int32_t blocksW = (w + 3) / 4;
+    const uint32_t* rows[4];
+    SINM__K(sinm__bc_rows)(in, w, h, by, rows);
+
+    simd__int ff = simd__set1_epi32(0xFF);
+    for (int32_t bx = 0; bx < blocksW; bx += SINM_SIMD_WIDTH) {
+        simd__int texels[16];
+        SINM__K(sinm__bc_load_simd)(rows, bx * 4, w, texels);
+        simd__float v[3][16];
+        sinm__unroll
+        for (int32_t t = 0; t < 16; ++t) {
+            v[0][t] = simd__cvtepi32_ps(simd__and_ix(texels[t], ff));
+            v[1][t] = simd__cvtepi32_ps(simd__and_ix(simd__srli_epi32(texels[t], 8), ff));
+            v[2][t] = simd__cvtepi32_ps(simd__and_ix(simd__srli_epi32(texels[t], 16), ff));
+        }
+
+        simd__float e0[3], e1[3];
+        SINM__K(sinm__bc_principal_endpoints_simd)(v, 3, e0, e1);
+        simd__int color0 = SINM__K(sinm__bc1_quantize_simd)(e0);
+        simd__int color1 = SINM__K(sinm__bc1_quantize_simd)(e1);
+        simd__int steps[16];
+        simd__float error = SINM__K(sinm__bc_steps_simd)(v, 3, e0, e1, 4, steps);
+
+        for (int32_t i = SINM__K(sinm__bc_refits)(quality); i > 0; --i) {
+            simd__float fit0[3] = { e0[0], e0[1], e0[2] };
+            simd__float fit1[3] = { e1[0], e1[1], e1[2] };
+            SINM__K(sinm__bc_refit_simd)(v, 3, steps, 4, fit0, fit1);
+            simd__int fitColor0 = SINM__K(sinm__bc1_quantize_simd)(fit0);
+            simd__int fitColor1 = SINM__K(sinm__bc1_quantize_simd)(fit1);
+            simd__int fitSteps[16];
+            simd__float fitError = SINM__K(sinm__bc_steps_simd)(v, 3, fit0, fit1, 4, fitSteps);
+            for (int32_t a = 0; a < 3; ++a) {
+                e0[a] = SINM__K(sinm__select_lt_ps)(e0[a], fit0[a], fitError, error);
+                e1[a] = SINM__K(sinm__select_lt_ps)(e1[a], fit1[a], fitError, error);
+            }
+            color0 = SINM__K(sinm__select_lt_epi32)(color0, fitColor0, fitError, error);
+            color1 = SINM__K(sinm__select_lt_epi32)(color1, fitColor1, fitError, error);
+            for (int32_t t = 0; t < 16; ++t) {
+                steps[t] = SINM__K(sinm__select_lt_epi32)(steps[t], fitSteps[t], fitError, error);
+            }
+            error = simd__min_ps(error, fitError);
+        }
+
+        //NOTE: color0 > color1 picks the 4 color mode, swap the endpoints where needed.
+        //Equal colors decode every index to color0 which is where all the steps already are.
+        simd__float c0 = simd__cvtepi32_ps(color0);
+        simd__float c1 = simd__cvtepi32_ps(color1);
+        simd__int three = simd__set1_epi32(3);
+        simd__int one = simd__set1_epi32(1);
+        simd__int indices = simd__set1_epi32(0);
+        sinm__unroll
+        for (int32_t t = 0; t < 16; ++t) {
+            simd__int s = SINM__K(sinm__select_lt_epi32)(steps[t], simd__sub_epi32(three, steps[t]), c0, c1);
+            //NOTE: steps 0, 1, 2, 3 are indices 0, 2, 3, 1
+            simd__int index = simd__and_ix(simd__add_epi32(s, one), three);
+            index = simd__xor_ix(index, simd__sub_epi32(one, simd__min_epi32(one, simd__srli_epi32(index, 1))));
+            indices = simd__or_ix(indices, simd__mullo_epi32(index, simd__set1_epi32((int32_t)(1u << (2 * t)))));
+        }
+        simd__int colors = simd__or_ix(simd__max_epi32(color0, color1), simd__slli_epi32(simd__min_epi32(color0, color1), 16));
+
+        sinm__aligned_var(uint32_t, 64) blockColors[SINM_SIMD_WIDTH];
+        sinm__aligned_var(uint32_t, 64) blockIndices[SINM_SIMD_WIDTH];
+        simd__storeu_ix((simd__int*)blockColors, colors);
+        simd__storeu_ix((simd__int*)blockIndices, indices);
+        for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+            int32_t block = bx + sinm__bc_lane_block(i);
+            if (block < blocksW) {
+                memcpy(out + block * 8, &blockColors[i], 4);
+                memcpy(out + block * 8 + 4, &blockIndices[i], 4);
+            }
+        }
+    }
+}
+
+//Rounds RGBA endpoints to 7 bits plus the p-bit with the smaller error, "e" is replaced
+//by the 8 bit values they decode to. "q" gets the 7 bit values, the p-bit is returned.
+static sinm__forceinline simd__int
+SINM__K(sinm__bc7_quantize_simd)(simd__float* e, simd__int* q)
+{
+    simd__float zero = simd__setzero_ps();
+    simd__float half = simd__set1_ps(0.5f);
+    simd__float maxQ = simd__set1_ps(127.0f);
+    simd__float q0[4], q1[4];
+    simd__float error0 = zero, error1 = zero;
+    for (int32_t a = 0; a < 4; ++a) {
+        q0[a] = simd__min_ps(maxQ, simd__cvtepi32_ps(simd__cvtps_epi32(simd__mul_ps(e[a], half))));
+        q1[a] = simd__max_ps(zero, simd__min_ps(maxQ, simd__cvtepi32_ps(simd__cvtps_epi32(simd__mul_ps(simd__sub_ps(e[a], simd__set1_ps(1.0f)), half)))));
+        simd__float d0 = simd__sub_ps(e[a], simd__add_ps(q0[a], q0[a]));
+        simd__float d1 = simd__sub_ps(e[a], simd__add_ps(simd__add_ps(q1[a], q1[a]), simd__set1_ps(1.0f)));
+        error0 = simd__add_ps(error0, simd__mul_ps(d0, d0));
+        error1 = simd__add_ps(error1, simd__mul_ps(d1, d1));
+    }
+    simd__int p = SINM__K(sinm__select_lt_epi32)(simd__set1_epi32(0), simd__set1_epi32(1), error1, error0);
+    simd__float pf = simd__cvtepi32_ps(p);
+    for (int32_t a = 0; a < 4; ++a) {
+        simd__float best = SINM__K(sinm__select_lt_ps)(q0[a], q1[a], error1, error0);
+        q[a] = simd__cvtps_epi32(best);
+        e[a] = simd__add_ps(simd__add_ps(best, best), pf);
+    }
+    return p;
+}
+
+//Compresses block row "by" of the image to BC7 mode 6, 16 bytes per block
+static void
+SINM__K(sinm__bc7_row_simd)(const uint32_t* in, int32_t w, int32_t h, int32_t by, uint8_t* out, sinm_bc_quality quality)
+{
+    int32_t blocksW = (w + 3) / 4;
+    const uint32_t* rows[4];
+    SINM__K(sinm__bc_rows)(in, w, h, by, rows);
+
+    simd__int ff = simd__set1_epi32(0xFF);
+    for (int32_t bx = 0; bx < blocksW; bx += SINM_SIMD_WIDTH) {
+        simd__int texels[16];
+        SINM__K(sinm__bc_load_simd)(rows, bx * 4, w, texels);
+        simd__float v[4][16];
+        sinm__unroll
+        for (int32_t t = 0; t < 16; ++t) {
+            v[0][t] = simd__cvtepi32_ps(simd__and_ix(texels[t], ff));
+            v[1][t] = simd__cvtepi32_ps(simd__and_ix(simd__srli_epi32(texels[t], 8), ff));
+            v[2][t] = simd__cvtepi32_ps(simd__and_ix(simd__srli_epi32(texels[t], 16), ff));
+            v[3][t] = simd__cvtepi32_ps(simd__srli_epi32(texels[t], 24));
+        }
+
+        simd__float e0[4], e1[4];
+        simd__int q0[4], q1[4];
+        SINM__K(sinm__bc_principal_endpoints_simd)(v, 4, e0, e1);
+        simd__int p0 = SINM__K(sinm__bc7_quantize_simd)(e0, q0);
+        simd__int p1 = SINM__K(sinm__bc7_quantize_simd)(e1, q1);
+        simd__int steps[16];
+        simd__float error = SINM__K(sinm__bc_steps_simd)(v, 4, e0, e1, 16, steps);
+
+        for (int32_t i = SINM__K(sinm__bc_refits)(quality); i > 0; --i) {
+            simd__float fit0[4] = { e0[0], e0[1], e0[2], e0[3] };
+            simd__float fit1[4] = { e1[0], e1[1], e1[2], e1[3] };
+            simd__int fitQ0[4], fitQ1[4];
+            SINM__K(sinm__bc_refit_simd)(v, 4, steps, 16, fit0, fit1);
+            simd__int fitP0 = SINM__K(sinm__bc7_quantize_simd)(fit0, fitQ0);
+            simd__int fitP1 = SINM__K(sinm__bc7_quantize_simd)(fit1, fitQ1);
+            simd__int fitSteps[16];
+            simd__float fitError = SINM__K(sinm__bc_steps_simd)(v, 4, fit0, fit1, 16, fitSteps);
+            for (int32_t a = 0; a < 4; ++a) {
+                e0[a] = SINM__K(sinm__select_lt_ps)(e0[a], fit0[a], fitError, error);
+                e1[a] = SINM__K(sinm__select_lt_ps)(e1[a], fit1[a], fitError, error);
+                q0[a] = SINM__K(sinm__select_lt_epi32)(q0[a], fitQ0[a], fitError, error);
+                q1[a] = SINM__K(sinm__select_lt_epi32)(q1[a], fitQ1[a], fitError, error);
+            }
+            p0 = SINM__K(sinm__select_lt_epi32)(p0, fitP0, fitError, error);
+            p1 = SINM__K(sinm__select_lt_epi32)(p1, fitP1, fitError, error);
+            for (int32_t t = 0; t < 16; ++t) {
+                steps[t] = SINM__K(sinm__select_lt_epi32)(steps[t], fitSteps[t], fitError, error);
+            }
+            error = simd__min_ps(error, fitError);
+        }
+
+        //NOTE: the first texel's index only has 3 bits, swap the endpoints if it needs the 4th
+        simd__float anchor = simd__cvtepi32_ps(steps[0]);
+        simd__float half = simd__set1_ps(7.5f);
+        simd__int fifteen = simd__set1_epi32(15);
+        for (int32_t a = 0; a < 4; ++a) {
+            simd__int t = q0[a];
+            q0[a] = SINM__K(sinm__select_lt_epi32)(q0[a], q1[a], half, anchor);
+            q1[a] = SINM__K(sinm__select_lt_epi32)(q1[a], t, half, anchor);
+        }
+        simd__int t = p0;
+        p0 = SINM__K(sinm__select_lt_epi32)(p0, p1, half, anchor);
+        p1 = SINM__K(sinm__select_lt_epi32)(p1, t, half, anchor);
+        for (int32_t i = 0; i < 16; ++i) {
+            steps[i] = SINM__K(sinm__select_lt_epi32)(steps[i], simd__sub_epi32(fifteen, steps[i]), half, anchor);
+        }
+
+        sinm__aligned_var(uint32_t, 64) endpoints[2][4][SINM_SIMD_WIDTH];
+        sinm__aligned_var(uint32_t, 64) pbits[2][SINM_SIMD_WIDTH];
+        sinm__aligned_var(uint32_t, 64) indices[16][SINM_SIMD_WIDTH];
+        for (int32_t a = 0; a < 4; ++a) {
+            simd__storeu_ix((simd__int*)endpoints[0][a], q0[a]);
+            simd__storeu_ix((simd__int*)endpoints[1][a], q1[a]);
+        }
+        simd__storeu_ix((simd__int*)pbits[0], p0);
+        simd__storeu_ix((simd__int*)pbits[1], p1);
+        for (int32_t i = 0; i < 16; ++i) {
+            simd__storeu_ix((simd__int*)indices[i], steps[i]);
+        }
+
+        for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+            int32_t block = bx + sinm__bc_lane_block(i);
+            if (block < blocksW) {
+                uint64_t bits[2] = { 0, 0 };
+                int32_t pos = 0;
+                sinm__put_bits(bits, &pos, 1u << 6, 7);
+                for (int32_t a = 0; a < 4; ++a) {
+                    sinm__put_bits(bits, &pos, endpoints[0][a][i], 7);
+                    sinm__put_bits(bits, &pos, endpoints[1][a][i], 7);
+                }
+                sinm__put_bits(bits, &pos, pbits[0][i], 1);
+                sinm__put_bits(bits, &pos, pbits[1][i], 1);
+                sinm__put_bits(bits, &pos, indices[0][i], 3);
+                for (int32_t t = 1; t < 16; ++t) {
+                    sinm__put_bits(bits, &pos, indices[t][i], 4);
+                }
+                memcpy(out + block * 16, bits, 16);
+            }
+        }
+    }
+}
+
+static const sinm__kernel_table SINM__K(sinm__kernels) = {
+    SINM__KERNEL_LEVEL,
+    SINM_SIMD_WIDTH,
+    SINM__K(sinm__simd_greyscale),
+    SINM__K(sinm__simd_heights),
+    SINM__K(sinm__box_blur_h_simd_u8),
+    SINM__K(sinm__box_blur_v_simd_u8),
+    SINM__K(sinm__box_blur_h_fixed_simd_u8),
+    SINM__K(sinm__box_blur_v_fixed_simd_u8),
+    SINM__K(sinm__recursive_blur_h_simd_u8),
+    SINM__K(sinm__recursive_blur_v_simd_u8),
+    SINM__K(sinm__sat_rows_simd),
+    SINM__K(sinm__sat_columns_simd),
+    SINM__K(sinm__sat_blur_row_simd),
+    {
+        SINM__K(sinm__sobel3x3_normals_row_simd_u8),
+        SINM__K(sinm__sobel5x5_normals_row_simd_u8),
+        SINM__K(sinm__scharr_normals_row_simd_u8),
+        SINM__K(sinm__prewitt_normals_row_simd_u8),
+        SINM__K(sinm__central_normals_row_simd_u8),
+    },
+    {
+        SINM__K(sinm__sobel3x3_normals_row_fixed_simd_u8),
+        SINM__K(sinm__sobel5x5_normals_row_fixed_simd_u8),
+        SINM__K(sinm__scharr_normals_row_fixed_simd_u8),
+        SINM__K(sinm__prewitt_normals_row_fixed_simd_u8),
+        SINM__K(sinm__central_normals_row_fixed_simd_u8),
+    },
+    {
+        SINM__K(sinm__sobel3x3_levels_row_simd_u8),
+        SINM__K(sinm__sobel5x5_levels_row_simd_u8),
+        SINM__K(sinm__scharr_levels_row_simd_u8),
+        SINM__K(sinm__prewitt_levels_row_simd_u8),
+        SINM__K(sinm__central_levels_row_simd_u8),
+    },
+    SINM__K(sinm__box_blur_h_simd_u16),
+    SINM__K(sinm__box_blur_v_simd_u16),
+    SINM__K(sinm__recursive_blur_h_simd_u16),
+    SINM__K(sinm__recursive_blur_v_simd_u16),
+    {
+        SINM__K(sinm__sobel3x3_normals_row_simd_u16),
+        SINM__K(sinm__sobel5x5_normals_row_simd_u16),
+        SINM__K(sinm__scharr_normals_row_simd_u16),
+        SINM__K(sinm__prewitt_normals_row_simd_u16),
+        SINM__K(sinm__central_normals_row_simd_u16),
+    },
+    SINM__K(sinm__normalize_simd),
+    SINM__K(sinm__composite_simd),
+    SINM__K(sinm__composite_layers_simd),
+    SINM__K(sinm__horizon_row_simd),
+    SINM__K(sinm__ssbump_accumulate_simd),
+    SINM__K(sinm__ssbump_row_simd),
+    SINM__K(sinm__ao_accumulate_simd),
+    SINM__K(sinm__mip_first_row_simd),
+    SINM__K(sinm__mip_reduce_row_simd),
+    SINM__K(sinm__mip_encode_row_simd),
+    SINM__K(sinm__bc1_row_simd),
+    SINM__K(sinm__bc5_row_simd),
+    SINM__K(sinm__bc7_row_simd),
+};
+
+sinm__target_pop()
+
+#undef SINM__KERNEL_SUFFIX
+#undef SINM__KERNEL_LEVEL
+#undef SINM__KERNEL_TARGET
+#undef simd_prefix_float
+#undef SINM_SIMD_WIDTH
+#undef simd__int
+#undef simd__float
+#undef simd__double
+#undef simd__and_ix
+#undef simd__or_ix
+#undef simd__xor_ix
+#undef simd__loadu_ix
+#undef simd__storeu_ix
+
+#else //SINM__HEIGHT_PASS
+
+//NOTE: the blur and sobel kernels are compiled once more per height type inside
+//every instruction set pass. SINM__HEIGHT_PASS is 1 for 8 bit and 2 for 16 bit
+//heights and SINM__H appends the matching suffix on top of SINM__K.
+
+#if SINM__HEIGHT_PASS == 2
+#define SINM__HEIGHT_SUFFIX u16
+#define SINM__HEIGHT_MAX 65535.0f
+#define sinm__height uint16_t
+#else
+#define SINM__HEIGHT_SUFFIX u8
+#define SINM__HEIGHT_MAX 255.0f
+#define sinm__height uint8_t
+#endif
+
+//Average of a box blur window
+static sinm__inline sinm__height
+SINM__H(sinm__box_average)(uint32_t sum, float invR, uint32_t reciprocal)
+{
+    if (reciprocal) {
+        return (sinm__height)(((uint64_t)sum * reciprocal) >> 32);
+    }
+    return (sinm__height)(sum * invR);
+}
+
+//NOTE: decently optimized box blur based on http://blog.ivank.net/fastest-gaussian-blur.html
+//"reciprocal" is the sinm__fixed_reciprocal of the box size for sinm_pipeline_fixed16, 0 for floats.
+static void
+SINM__H(sinm__box_blur_h)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, float r, uint32_t reciprocal)
+{
+    float invR = 1.0f / (r + r + 1);
+    int32_t ir = (int32_t)r;
 
-        {
-            std::string fCode = fsys::read_file<std::string>("shaders/greyscale_luminance.frag");
-            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
-            GLuint program = glsys::create_program(vShader, fShader);
-            assert(program != 0);
-            sinm__glCtx.greyscaleLuminanceShader = program;
-        }
+    //NOTE: reads past either end of the row are clamped to the first/last pixel
+    int32_t leftEnd = sinm__min(ir + 1, w);
+    int32_t rightStart = sinm__max(leftEnd, w - ir);
 
-        {
-            std::string fCode = fsys::read_file<std::string>("shaders/greyscale_lightness.frag");
-            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
-            GLuint program = glsys::create_program(vShader, fShader);
-            assert(program != 0);
-            sinm__glCtx.greyscaleLightnessShader = program;
-        }
+    for (int i = 0; i < h; ++i) {
+        const sinm__height* row = in + (size_t)i * w;
+        sinm__height* outRow = out + (size_t)i * w;
+        uint32_t fv = row[0];
+        uint32_t lv = row[w - 1];
+        uint32_t sum = (uint32_t)((r + 1.0f) * fv);
 
-        {
-            GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
-            glShaderSource(fShader, 1, &sinm__gaussian_blur_frag_shader_source, NULL);
-            glCompileShader(fShader);
-            GLuint program = glCreateProgram();
-            glAttachShader(program, vShader);
-            glAttachShader(program, fShader);
-            glLinkProgram(program);
-            sinm__glCtx.blurShader = program;
+        for (int j = 0; j < ir; ++j) {
+            sum += row[sinm__min(j, w - 1)];
         }
 
-        {
-            std::string fCode = fsys::read_file<std::string>("shaders/normal_map.frag");
-            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
-            GLuint program = glsys::create_program(vShader, fShader);
-            assert(program != 0);
-            sinm__glCtx.normalMapShader = program;
+        int j = 0;
+        for (; j < leftEnd; ++j) {
+            sum += row[sinm__min(j + ir, w - 1)] - fv;
+            outRow[j] = SINM__H(sinm__box_average)(sum, invR, reciprocal);
+        }
+        for (; j < rightStart; ++j) {
+            sum += row[j + ir] - row[j - ir - 1];
+            outRow[j] = SINM__H(sinm__box_average)(sum, invR, reciprocal);
         }
+        for (; j < w; ++j) {
+            sum += lv - row[j - ir - 1];
+            outRow[j] = SINM__H(sinm__box_average)(sum, invR, reciprocal);
+        }
+    }
+}
 
-        {
-            std::string fCode = fsys::read_file<std::string>("shaders/normalize.frag");
-            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
-            GLuint program = glsys::create_program(vShader, fShader);
-            assert(program != 0);
-            sinm__glCtx.normalizeShader = program;
+//NOTE: blurs the columns [xs, xe). Reads past the top or bottom are clamped to the first/last row.
+static void
+SINM__H(sinm__box_blur_v_columns)(const sinm__height* in, sinm__height* out, int32_t xs, int32_t xe, int32_t w, int32_t h, float r, uint32_t reciprocal)
+{
+    float invR = 1.0f / (r + r + 1);
+    int32_t ir = (int32_t)r;
+    int32_t topEnd = sinm__min(ir + 1, h);
+    int32_t bottomStart = sinm__max(topEnd, h - ir);
+
+    for (int i = xs; i < xe; ++i) {
+        uint32_t fv = in[i];
+        uint32_t lv = in[i + (size_t)w * (h - 1)];
+        uint32_t sum = (uint32_t)((r + 1) * fv);
+
+        for (int j = 0; j < ir; j++) {
+            sum += in[i + (size_t)sinm__min(j, h - 1) * w];
         }
 
-        {
-            std::string fCode = fsys::read_file<std::string>("shaders/composite.frag");
-            GLuint fShader = glsys::create_shader(GL_FRAGMENT_SHADER, fCode);
-            GLuint program = glsys::create_program(vShader, fShader);
-            assert(program != 0);
-            sinm__glCtx.compositeShader = program;
+        int j = 0;
+        for (; j < topEnd; j++) {
+            sum += in[i + (size_t)sinm__min(j + ir, h - 1) * w] - fv;
+            out[i + (size_t)j * w] = SINM__H(sinm__box_average)(sum, invR, reciprocal);
+        }
+        for (; j < bottomStart; j++) {
+            sum += in[i + (size_t)(j + ir) * w] - in[i + (size_t)(j - ir - 1) * w];
+            out[i + (size_t)j * w] = SINM__H(sinm__box_average)(sum, invR, reciprocal);
+        }
+        for (; j < h; j++) {
+            sum += lv - in[i + (size_t)(j - ir - 1) * w];
+            out[i + (size_t)j * w] = SINM__H(sinm__box_average)(sum, invR, reciprocal);
         }
-        sinm__glCtx.initialized = 1;
-        assert(!glsys::report_errors());
     }
 }
 
-//NOTE: GPU -> RAM copy is slow. Only use this function if you really need to(such as writing the data to a file)
-SINM_DEF void
-sinm_gpu_normal_map_to_buffer(uint32_t* out, uint32_t inFBO, int32_t w, int32_t h)
+//Loads SINM_SIMD_WIDTH heights widened to one per 32 bit lane
+static sinm__forceinline simd__int
+SINM__H(sinm__load_heights_simd)(const sinm__height* p)
 {
-    assert(inFBO != 0); //opengl context not initialized
-    assert(out);
-    assert(w > 0 && h > 0);
-
-    BEGIN_TIMER(gpu_to_buffer_copy)
-    glBindFramebuffer(GL_FRAMEBUFFER, inFBO);
-    glReadBuffer(GL_COLOR_ATTACHMENT0);
-    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, out);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    END_TIMER(gpu_to_buffer_copy)
+#if SINM__HEIGHT_PASS == 2
+#if SINM__KERNEL_PASS == 3
+    return _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p));
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+#else
+    return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)p));
+#endif
+#else
+#if SINM__KERNEL_PASS == 3
+    return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p));
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+#else
+    int32_t bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+#endif
+#endif
 }
 
-SINM_DEF void
-sinm_composite_gpu(sinm_gpu_buffer outBuffer, const sinm_gpu_buffer* inBuffers, int32_t count, int32_t w, int32_t h)
+//Stores SINM_SIMD_WIDTH 32 bit lanes(already in [0, SINM__HEIGHT_MAX]) as heights
+static sinm__forceinline void
+SINM__H(sinm__store_heights_simd)(sinm__height* p, simd__int v)
 {
-    assert(sinm__glCtx.initialized);
-    assert(inBuffers);
+#if SINM__HEIGHT_PASS == 2
+#if SINM__KERNEL_PASS == 3
+    _mm256_storeu_si256((__m256i*)p, _mm512_cvtepi32_epi16(v));
+#elif SINM__KERNEL_PASS == 2
+    _mm_storeu_si128((__m128i*)p, _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+#else
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi32(v, v));
+#endif
+#else
+#if SINM__KERNEL_PASS == 3
+    _mm_storeu_si128((__m128i*)p, _mm512_cvtepi32_epi8(v));
+#elif SINM__KERNEL_PASS == 2
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(words, words));
+#else
+    __m128i words = _mm_packus_epi32(v, v);
+    int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    memcpy(p, &bytes, sizeof(bytes));
+#endif
+#endif
+}
 
-    if (count <= 1) {
-        return;
+//Same as sinm__store_heights_simd but only writes the first "count" lanes
+static sinm__forceinline void
+SINM__H(sinm__store_heights_partial_simd)(sinm__height* p, simd__int v, int32_t count)
+{
+    if (count >= SINM_SIMD_WIDTH) {
+        SINM__H(sinm__store_heights_simd)(p, v);
+    } else {
+        sinm__height tail[SINM_SIMD_WIDTH];
+        SINM__H(sinm__store_heights_simd)(tail, v);
+        memcpy(p, tail, count * sizeof(sinm__height));
     }
+}
 
-    count = sinm__min(5, count);
-    glUseProgram(sinm__glCtx.compositeShader);
-    glViewport(0, 0, w, h);
-
-#define MAX_COMPOSITE_LAYERS 5
-    int texUnis[MAX_COMPOSITE_LAYERS] = {};
-    texUnis[0] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[0]");
-    texUnis[1] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[1]");
-    texUnis[2] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[2]");
-    texUnis[3] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[3]");
-    texUnis[4] = glGetUniformLocation(sinm__glCtx.compositeShader, "images[4]");
-    for (int i = 0; i < count; ++i) {
-        glUniform1i(texUnis[i], i);
+//Same as sinm__load_heights_simd but only reads the first "count" heights, the other
+//lanes are 0
+static sinm__forceinline simd__int
+SINM__H(sinm__load_heights_partial_simd)(const sinm__height* p, int32_t count)
+{
+    if (count >= SINM_SIMD_WIDTH) {
+        return SINM__H(sinm__load_heights_simd)(p);
     }
+    sinm__height tail[SINM_SIMD_WIDTH] = { 0 };
+    memcpy(tail, p, count * sizeof(sinm__height));
+    return SINM__H(sinm__load_heights_simd)(tail);
+}
 
-    glUniform1i(glGetUniformLocation(sinm__glCtx.compositeShader, "numImages"), count);
-    glBindVertexArray(sinm__glCtx.quadVAO);
-    glBindFramebuffer(GL_FRAMEBUFFER, outBuffer.fbo);
-    for (int i = 0; i < count; ++i) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        uint32_t buffer = inBuffers[i].buffer;
-        glBindTexture(GL_TEXTURE_2D, buffer);
+//Loads SINM_SIMD_WIDTH columns starting at "c" from SINM_SIMD_WIDTH rows and
+//transposes them so v[i] holds column c + i of every row. Columns outside the
+//row and rows past the first "rows" are clamped.
+static sinm__forceinline void
+SINM__H(sinm__load_columns_simd)(const sinm__height* in, int32_t w, int32_t rows, int32_t c, simd__int* v)
+{
+    if (c >= 0 && c + SINM_SIMD_WIDTH <= w && rows == SINM_SIMD_WIDTH) {
+        sinm__unroll
+        for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+            v[i] = SINM__H(sinm__load_heights_simd)(&in[(size_t)i * w + c]);
+        }
+    } else {
+        sinm__height clamped[SINM_SIMD_WIDTH];
+        for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+            for (int32_t t = 0; t < SINM_SIMD_WIDTH; ++t) {
+                clamped[t] = in[(size_t)sinm__min(i, rows - 1) * w + sinm__min(w - 1, sinm__max(0, c + t))];
+            }
+            v[i] = SINM__H(sinm__load_heights_simd)(clamped);
+        }
     }
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    SINM__K(sinm__transpose_simd)(v);
 }
 
-//TODO optimize
-SINM_DEF void
-sinm__normal_map_gpu(const uint32_t* inBuffer, uint32_t outFBO, int32_t w, int32_t h, float scale, int numBlurPasses, sinm_greyscale_type greyscaleType, int flipY = 0)
+//Same result as sinm__box_blur_h but SINM_SIMD_WIDTH rows are blurred in lockstep,
+//one row per lane. Blocks of columns are transposed in registers so the running
+//sum still costs one add and one subtract per pixel.
+//NOTE: "fixed" is a constant in every caller. The sums of sinm_pipeline_fixed16 fit the
+//low 16 bits of their lanes and so does the multiplier, a mulhi_epu16 and a shift replace
+//the float round trip.
+static sinm__forceinline void
+SINM__H(sinm__box_blur_rows_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, float r, int fixed)
 {
-    assert(sinm__glCtx.initialized);
-    assert(outFBO != 0);
-    assert(inBuffer);
+    simd__float invR = simd__set1_ps(1.0f / (r + r + 1));
+    int32_t ir = (int32_t)r;
+    int32_t shift = 0;
+    uint32_t reciprocal = 0;
+    simd__int multiplier = simd__set1_epi32(0);
+    if (fixed) {
+        multiplier = simd__set1_epi32(sinm__fixed_multiplier(ir * 2 + 1, &shift));
+        reciprocal = sinm__fixed_reciprocal(ir * 2 + 1);
+    }
+    __m128i shiftCount = _mm_cvtsi32_si128(shift);
+
+    int32_t y = 0;
+    for (; y + SINM_SIMD_WIDTH <= h; y += SINM_SIMD_WIDTH) {
+        const sinm__height* rows = in + (size_t)y * w;
+        sinm__height* outRows = out + (size_t)y * w;
+
+        //NOTE: running sum of the window centered one pixel left of the row
+        sinm__aligned_var(uint32_t, 64) first[SINM_SIMD_WIDTH];
+        for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+            const sinm__height* row = rows + (size_t)i * w;
+            first[i] = (ir + 1) * row[0];
+            for (int32_t j = 0; j < ir; ++j) {
+                first[i] += row[sinm__min(j, w - 1)];
+            }
+        }
+        simd__int sum = simd__loadu_ix((simd__int*)first);
+
+        for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+            simd__int add[SINM_SIMD_WIDTH];
+            simd__int sub[SINM_SIMD_WIDTH];
+            SINM__H(sinm__load_columns_simd)(rows, w, SINM_SIMD_WIDTH, x + ir, add);
+            SINM__H(sinm__load_columns_simd)(rows, w, SINM_SIMD_WIDTH, x - ir - 1, sub);
+
+            sinm__unroll
+            for (int32_t t = 0; t < SINM_SIMD_WIDTH; ++t) {
+                sum = simd__add_epi32(sum, simd__sub_epi32(add[t], sub[t]));
+                if (fixed) {
+                    add[t] = simd__srl_epi16(simd__mulhi_epu16(sum, multiplier), shiftCount);
+                } else {
+                    add[t] = simd__cvttps_epi32(simd__mul_ps(simd__cvtepi32_ps(sum), invR));
+                }
+            }
+            SINM__K(sinm__transpose_simd)(add);
 
-    glBindTexture(GL_TEXTURE_2D, sinm__glCtx.inTex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, inBuffer);
+            int32_t count = w - x;
+            sinm__unroll
+            for (int32_t i = 0; i < SINM_SIMD_WIDTH; ++i) {
+                SINM__H(sinm__store_heights_partial_simd)(&outRows[(size_t)i * w + x], add[i], count);
+            }
+        }
+    }
 
-    glGenFramebuffers(2, sinm__glCtx.pingpongFBO);
-    glGenTextures(2, sinm__glCtx.pingpongBuffers);
-    for (unsigned int i = 0; i < 2; i++) {
-        glBindFramebuffer(GL_FRAMEBUFFER, sinm__glCtx.pingpongFBO[i]);
-        glBindTexture(GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[i], 0);
+    if (y < h) {
+        SINM__H(sinm__box_blur_h)(in + (size_t)y * w, out + (size_t)y * w, w, h - y, r, reciprocal);
     }
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+static void
+SINM__H(sinm__box_blur_h_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, float r)
+{
+    SINM__H(sinm__box_blur_rows_simd)(in, out, w, h, r, 0);
+}
 
-    glViewport(0, 0, w, h);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(sinm__glCtx.quadVAO);
+//Walks down a strip of "vectors" * SINM_SIMD_WIDTH columns starting at "x" keeping a
+//running sum per column in registers.
+static sinm__forceinline void
+SINM__H(sinm__box_blur_v_strip_simd)(const sinm__height* in, sinm__height* out, int32_t x, int32_t vectors, int32_t w, int32_t h, int32_t r)
+{
+    simd__float invR = simd__set1_ps(1.0f / (r + r + 1));
+    simd__int sums[SINM__BLUR_STRIP_VECTORS];
 
-    if (greyscaleType != sinm_greyscale_none) {
-        switch (greyscaleType) {
-        case sinm_greyscale_average: {
-            glUseProgram(sinm__glCtx.greyscaleAverageShader);
-        } break;
-        case sinm_greyscale_luminance: {
-            glUseProgram(sinm__glCtx.greyscaleLuminanceShader);
-        } break;
-        case sinm_greyscale_lightness: {
-            glUseProgram(sinm__glCtx.greyscaleLightnessShader);
-        } break;
-        default: {
-            //INVALID OPTION
-            assert(false);
-        } break;
+    //NOTE: running sums of the window centered one row above the image
+    simd__int first = simd__set1_epi32(r + 1);
+    for (int32_t v = 0; v < vectors; ++v) {
+        sums[v] = simd__mullo_epi32(SINM__H(sinm__load_heights_simd)(&in[x + v * SINM_SIMD_WIDTH]), first);
+    }
+    for (int32_t j = 0; j < r; ++j) {
+        const sinm__height* row = in + (size_t)sinm__min(j, h - 1) * w + x;
+        for (int32_t v = 0; v < vectors; ++v) {
+            sums[v] = simd__add_epi32(sums[v], SINM__H(sinm__load_heights_simd)(&row[v * SINM_SIMD_WIDTH]));
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, sinm__glCtx.pingpongFBO[0]);
-        glBindTexture(GL_TEXTURE_2D, sinm__glCtx.inTex);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     }
 
-    { //Blur passes
-        glUseProgram(sinm__glCtx.blurShader);
-        GLint texUni = glGetUniformLocation(sinm__glCtx.blurShader, "image");
-        GLint horizontalUni = glGetUniformLocation(sinm__glCtx.blurShader, "horizontal");
-        glUniform1i(texUni, 0);
-
-        int blurPasses = sinm__max(2, numBlurPasses * 2);
-        int horizontal = 1;
-        int firstIteration = 1;
-        for (int i = 0; i < blurPasses; ++i) {
-            glBindFramebuffer(GL_FRAMEBUFFER, sinm__glCtx.pingpongFBO[horizontal]);
-            glUniform1i(horizontalUni, horizontal);
-            glBindTexture(GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[!horizontal]);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            horizontal = !horizontal;
-            firstIteration = false;
+    for (int32_t y = 0; y < h; ++y) {
+        const sinm__height* add = in + (size_t)sinm__min(y + r, h - 1) * w + x;
+        const sinm__height* sub = in + (size_t)sinm__max(y - r - 1, 0) * w + x;
+        sinm__height* dst = out + (size_t)y * w + x;
+        for (int32_t v = 0; v < vectors; ++v) {
+            simd__int a = SINM__H(sinm__load_heights_simd)(&add[v * SINM_SIMD_WIDTH]);
+            simd__int s = SINM__H(sinm__load_heights_simd)(&sub[v * SINM_SIMD_WIDTH]);
+            sums[v] = simd__add_epi32(sums[v], simd__sub_epi32(a, s));
+
+            simd__int c = simd__cvttps_epi32(simd__mul_ps(simd__cvtepi32_ps(sums[v]), invR));
+            SINM__H(sinm__store_heights_simd)(&dst[v * SINM_SIMD_WIDTH], c);
         }
     }
-    assert(!glsys::report_errors());
+}
 
-    { //Conversion to normal map
-        glUseProgram(sinm__glCtx.normalMapShader);
-        GLint texUni = glGetUniformLocation(sinm__glCtx.normalMapShader, "image");
-        GLint scaleUni = glGetUniformLocation(sinm__glCtx.normalMapShader, "scale");
-        GLint flipYUni = glGetUniformLocation(sinm__glCtx.normalMapShader, "flipY");
-        glUniform1i(texUni, 0);
-        glUniform1f(scaleUni, sinm__max(1.0f, scale));
-        float yDir = (flipY) ? -1.0f : 1.0f;
+//Same result as sinm__box_blur_v but walks strips of adjacent columns so every
+//cache line that is loaded gets fully used.
+static void
+SINM__H(sinm__box_blur_v_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, float r)
+{
+    int32_t x = 0;
+    for (; x + SINM__BLUR_STRIP_WIDTH <= w; x += SINM__BLUR_STRIP_WIDTH) {
+        SINM__H(sinm__box_blur_v_strip_simd)(in, out, x, SINM__BLUR_STRIP_VECTORS, w, h, (int32_t)r);
+    }
 
-        glUniform1f(flipYUni, yDir);
-        glBindFramebuffer(GL_FRAMEBUFFER, outFBO);
-        glBindTexture(GL_TEXTURE_2D, sinm__glCtx.pingpongBuffers[1]);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        assert(!glsys::report_errors());
+    int32_t vectors = (w - x) / SINM_SIMD_WIDTH;
+    if (vectors > 0) {
+        SINM__H(sinm__box_blur_v_strip_simd)(in, out, x, vectors, w, h, (int32_t)r);
+        x += vectors * SINM_SIMD_WIDTH;
     }
-    assert(!glsys::report_errors());
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glUseProgram(0);
+    if (x < w) {
+        SINM__H(sinm__box_blur_v_columns)(in, out, x, w, w, h, r, 0);
+    }
 }
 
-//Returns and opengl texture ID. To get the raw data use sinm_gpu_normal_map_to_buffer()
-//For best performance keep everything in GPU memory until you really need to access the data(such as writing it to a file)
+//NOTE: sinm_pipeline_fixed16 only covers 8 bit heights, 16 bit sums of 16 bit heights
+//would overflow
+#if SINM__HEIGHT_PASS == 1
 
-SINM_DEF sinm_gpu_buffer
-sinm_normal_map_gpu(const uint32_t* in, int32_t w, int32_t h, float scale, int numBlurPasses, sinm_greyscale_type greyscaleType, int flipY)
+//Loads 2 * SINM_SIMD_WIDTH heights widened to one per 16 bit lane
+static sinm__forceinline simd__int
+SINM__H(sinm__load_heights16_simd)(const sinm__height* p)
 {
-    assert(sinm__glCtx.initialized);
-    assert(w > 0 && h > 0);
-    assert(in);
-
-    scale = sinm__max(1.0f, scale);
-
-    sinm_gpu_buffer result = {};
-    glGenFramebuffers(1, &result.fbo);
-    glGenTextures(1, &result.buffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, result.fbo);
-    glBindTexture(GL_TEXTURE_2D, result.buffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, result.buffer, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#if SINM__KERNEL_PASS == 3
+    return _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)p));
+#elif SINM__KERNEL_PASS == 2
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p));
+#else
+    return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)p));
+#endif
+}
 
-    sinm__normal_map_gpu(in, result.fbo, w, h, scale, numBlurPasses, greyscaleType, flipY);
+//Stores 2 * SINM_SIMD_WIDTH 16 bit lanes(already in [0, 255]) as heights
+static sinm__forceinline void
+SINM__H(sinm__store_heights16_simd)(sinm__height* p, simd__int v)
+{
+#if SINM__KERNEL_PASS == 3
+    _mm256_storeu_si256((__m256i*)p, _mm512_cvtepi16_epi8(v));
+#elif SINM__KERNEL_PASS == 2
+    _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+#else
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v));
+#endif
+}
 
-    return result;
+//sinm_pipeline_fixed16 version of sinm__box_blur_h_simd
+static void
+SINM__H(sinm__box_blur_h_fixed_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, int32_t r)
+{
+    SINM__H(sinm__box_blur_rows_simd)(in, out, w, h, (float)r, 1);
 }
-#endif //SINM_NORMALMAP_GPU
 
-SINM_DEF void
-sinm__sobel3x3_normals_row_range(const uint32_t* in, uint32_t* out, int32_t xs, int32_t xe, int32_t w, int32_t h, float scale, int flipY)
+//Same as sinm__box_blur_v_strip_simd with "vectors" * 2 * SINM_SIMD_WIDTH columns
+//and a running sum per 16 bit lane. The sums of a box up to 257 pixels tall fit in 16
+//bits, the adds and subtracts that get there can wrap.
+static sinm__forceinline void
+SINM__H(sinm__box_blur_v_strip_fixed_simd)(const sinm__height* in, sinm__height* out, int32_t x, int32_t vectors, int32_t w, int32_t h, int32_t r)
 {
-    const float xk[3][3] = {
-        { -1, 0, 1 },
-        { -2, 0, 2 },
-        { -1, 0, 1 },
-    };
-    const float yk[3][3] = {
-        { -1, -2, -1 },
-        { 0, 0, 0 },
-        { 1, 2, 1 },
-    };
-
-    float yDir = (flipY) ? -1.0f : 1.0f;
+    const int32_t step = SINM_SIMD_WIDTH * 2;
+    int32_t shift;
+    simd__int multiplier = simd__set1_epi16((short)sinm__fixed_multiplier(r * 2 + 1, &shift));
+    __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    simd__int sums[SINM__BLUR_STRIP_VECTORS16];
+
+    simd__int first = simd__set1_epi16((short)(r + 1));
+    for (int32_t v = 0; v < vectors; ++v) {
+        sums[v] = simd__mullo_epi16(SINM__H(sinm__load_heights16_simd)(&in[x + v * step]), first);
+    }
+    for (int32_t j = 0; j < r; ++j) {
+        const sinm__height* row = in + (size_t)sinm__min(j, h - 1) * w + x;
+        for (int32_t v = 0; v < vectors; ++v) {
+            sums[v] = simd__add_epi16(sums[v], SINM__H(sinm__load_heights16_simd)(&row[v * step]));
+        }
+    }
 
     for (int32_t y = 0; y < h; ++y) {
-        for (int32_t x = xs; x < xe; ++x) {
-            float xmag = 0.0f;
-            float ymag = 0.0f;
-            for (int32_t a = 0; a < 3; ++a) {
-                for (int32_t b = 0; b < 3; ++b) {
-                    int32_t xIdx = sinm__min(w - 1, sinm__max(1, x + b - 1));
-                    int32_t yIdx = sinm__min(h - 1, sinm__max(1, y + a - 1));
-                    int32_t index = yIdx * w + xIdx;
-                    uint32_t pixel = in[index] & 0xFFu;
-                    xmag += pixel * xk[a][b];
-                    ymag += pixel * yk[a][b];
-                }
-            }
-            sinm__v3 color = sinm__normalized(xmag * scale, ymag * scale * yDir, 255.0f);
-            out[y * w + x] = sinm__unit_vector_to_rgba(color);
+        const sinm__height* add = in + (size_t)sinm__min(y + r, h - 1) * w + x;
+        const sinm__height* sub = in + (size_t)sinm__max(y - r - 1, 0) * w + x;
+        sinm__height* dst = out + (size_t)y * w + x;
+        for (int32_t v = 0; v < vectors; ++v) {
+            simd__int a = SINM__H(sinm__load_heights16_simd)(&add[v * step]);
+            simd__int s = SINM__H(sinm__load_heights16_simd)(&sub[v * step]);
+            sums[v] = simd__add_epi16(sums[v], simd__sub_epi16(a, s));
+            SINM__H(sinm__store_heights16_simd)(&dst[v * step], simd__srl_epi16(simd__mulhi_epu16(sums[v], multiplier), shiftCount));
         }
     }
 }
 
-static sinm__inline void
-sinm__sobel3x3_normals(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, int flipY)
+//sinm_pipeline_fixed16 version of sinm__box_blur_v_simd
+static void
+SINM__H(sinm__box_blur_v_fixed_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, int32_t r)
+{
+    const int32_t step = SINM_SIMD_WIDTH * 2;
+    int32_t x = 0;
+    for (; x + SINM__BLUR_STRIP_WIDTH <= w; x += SINM__BLUR_STRIP_WIDTH) {
+        SINM__H(sinm__box_blur_v_strip_fixed_simd)(in, out, x, SINM__BLUR_STRIP_VECTORS16, w, h, r);
+    }
+
+    int32_t vectors = (w - x) / step;
+    if (vectors > 0) {
+        SINM__H(sinm__box_blur_v_strip_fixed_simd)(in, out, x, vectors, w, h, r);
+        x += vectors * step;
+    }
+
+    if (x < w) {
+        SINM__H(sinm__box_blur_v_columns)(in, out, x, w, w, h, (float)r, sinm__fixed_reciprocal(r * 2 + 1));
+    }
+}
+#endif
+
+//Clamps two vectors of recursive gaussian results to the height range and packs them
+static sinm__forceinline simd__int
+SINM__H(sinm__recursive_heights_simd)(simd__double lo, simd__double hi)
 {
-    sinm__sobel3x3_normals_row_range(in, out, 0, w, w, h, scale, flipY);
+    simd__double zero = simd__set1_pd(0.0);
+    simd__double max = simd__set1_pd(SINM__HEIGHT_MAX);
+    lo = simd__min_pd(simd__max_pd(lo, zero), max);
+    hi = simd__min_pd(simd__max_pd(hi, zero), max);
+    return SINM__K(sinm__cvtpd_epi32_simd)(lo, hi);
 }
 
+//Recursive gaussian along the rows in [ys, ye). SINM_SIMD_WIDTH rows run in lockstep,
+//one row per lane and half of them in each double vector, blocks of columns are
+//transposed in registers like sinm__box_blur_h_simd. "scratch" holds the forward pass,
+//w * SINM_SIMD_WIDTH doubles. "in" and "out" can be the same.
 static void
-sinm__sobel3x3_normals_simd(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, int flipY)
+SINM__H(sinm__recursive_blur_h_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t ys, int32_t ye, const sinm__recursive_gaussian* g, double* scratch)
 {
-    const float xk[3][4] = {
-        { -1, 0, 1, 0 },
-        { -2, 0, 2, 0 },
-        { -1, 0, 1, 0 },
-    };
-    const float yk[3][4] = {
-        { -1, -2, -1, 0 },
-        { 0, 0, 0, 0 },
-        { 1, 2, 1, 0 },
-    };
+    const int32_t half = SINM_SIMD_WIDTH / 2;
+    simd__double c[4];
+    c[0] = simd__set1_pd(g->b);
+    for (int32_t i = 0; i < 3; ++i) {
+        c[i + 1] = simd__set1_pd(g->a[i]);
+    }
 
-    simd__float simdScale = simd__set1_ps(scale);
-    simd__float simdFlipY = simd__set1_ps((flipY) ? -1.0f : 1.0f);
-    simd__float simd1 = simd__set1_ps(1.0f);
-    simd__float simd127 = simd__set1_ps(127.0f);
+    for (int32_t y = ys; y < ye; y += SINM_SIMD_WIDTH) {
+        int32_t rows = sinm__min(SINM_SIMD_WIDTH, ye - y);
+        const sinm__height* src = in + (size_t)y * w;
+        simd__int v[SINM_SIMD_WIDTH];
+        simd__double x[2];
+        simd__double lo[3];
+        simd__double hi[3];
+
+        //NOTE: the rows start as if the first pixel went on forever
+        SINM__H(sinm__load_columns_simd)(src, w, rows, 0, v);
+        SINM__K(sinm__cvtepi32_pd_simd)(v[0], x);
+        for (int32_t i = 0; i < 3; ++i) {
+            lo[i] = x[0];
+            hi[i] = x[1];
+        }
 
-    int32_t batchCounter = 0;
-    sinm__aligned_var(float, SINM_SIMD_WIDTH) xBatch[SINM_SIMD_WIDTH];
-    sinm__aligned_var(float, SINM_SIMD_WIDTH) yBatch[SINM_SIMD_WIDTH];
+        for (int32_t c0 = 0; c0 < w; c0 += SINM_SIMD_WIDTH) {
+            SINM__H(sinm__load_columns_simd)(src, w, rows, c0, v);
+            int32_t count = sinm__min(SINM_SIMD_WIDTH, w - c0);
+            for (int32_t t = 0; t < count; ++t) {
+                double* dst = scratch + (size_t)(c0 + t) * SINM_SIMD_WIDTH;
+                SINM__K(sinm__cvtepi32_pd_simd)(v[t], x);
+                simd__storeu_pd(dst, SINM__K(sinm__recursive_step_simd)(x[0], lo, c));
+                simd__storeu_pd(dst + half, SINM__K(sinm__recursive_step_simd)(x[1], hi, c));
+            }
+        }
 
-    for (int32_t yIter = 0; yIter < h; ++yIter) {
-        for (int32_t xIter = SINM_SIMD_WIDTH; xIter < w - SINM_SIMD_WIDTH; ++xIter) {
-            __m128 xmag = _mm_set1_ps(0.0f);
-            __m128 ymag = _mm_set1_ps(0.0f);
+        //NOTE: "x" still holds the last column
+        SINM__K(sinm__recursive_edge_simd)(lo, x[0], g);
+        SINM__K(sinm__recursive_edge_simd)(hi, x[1], g);
 
-            for (int32_t a = 0; a < 3; ++a) {
-                int32_t xIdx = sinm__min(w - 1, sinm__max(1, xIter - 1));
-                int32_t yIdx = sinm__min(h - 1, sinm__max(1, yIter + a - 1));
-                int32_t index = yIdx * w + xIdx;
-
-                __m128i pixel = _mm_loadu_si128((__m128i*)&in[index]);
-                pixel = _mm_and_si128(pixel, _mm_set1_epi32(0xFFu));
-                __m128 pixelf = _mm_cvtepi32_ps(pixel);
-                __m128 kx = _mm_loadu_ps((float*)&xk[a]);
-                __m128 ky = _mm_loadu_ps((float*)&yk[a]);
-                xmag = _mm_add_ps(_mm_mul_ps(pixelf, kx), xmag);
-                ymag = _mm_add_ps(_mm_mul_ps(pixelf, ky), ymag);
+        for (int32_t c0 = (w - 1) / SINM_SIMD_WIDTH * SINM_SIMD_WIDTH; c0 >= 0; c0 -= SINM_SIMD_WIDTH) {
+            int32_t count = sinm__min(SINM_SIMD_WIDTH, w - c0);
+            for (int32_t t = count; t < SINM_SIMD_WIDTH; ++t) {
+                v[t] = simd__set1_epi32(0);
+            }
+            for (int32_t t = count - 1; t >= 0; --t) {
+                //NOTE: the edge already gave the result of the last column
+                if (c0 + t < w - 1) {
+                    const double* fwd = scratch + (size_t)(c0 + t) * SINM_SIMD_WIDTH;
+                    SINM__K(sinm__recursive_step_simd)(simd__loadu_pd(fwd), lo, c);
+                    SINM__K(sinm__recursive_step_simd)(simd__loadu_pd(fwd + half), hi, c);
+                }
+                v[t] = SINM__H(sinm__recursive_heights_simd)(lo[0], hi[0]);
             }
+            SINM__K(sinm__transpose_simd)(v);
 
-            __m128 xSum = _mm_hadd_ps(xmag, xmag);
-            __m128 ySum = _mm_hadd_ps(ymag, ymag);
-            float xn = _mm_cvtss_f32(_mm_hadd_ps(xSum, xSum));
-            float yn = _mm_cvtss_f32(_mm_hadd_ps(ySum, ySum));
-
-            xBatch[batchCounter] = xn;
-            yBatch[batchCounter++] = yn;
-            if (batchCounter == SINM_SIMD_WIDTH) {
-                batchCounter = 0;
-                simd__float x = simd__loadu_ps(xBatch);
-                simd__float y = simd__loadu_ps(yBatch);
-                simd__float z = simd__set1_ps(255.0f);
-
-                x = simd__mul_ps(simd__mul_ps(x, simdScale), simdFlipY);
-                y = simd__mul_ps(simd__mul_ps(y, simdScale), simdFlipY);
-
-                //normalize
-                simd__float len = sinm__length_simd(x, y, z);
-                simd__float invLen = simd__div_ps(simd__set1_ps(1.0f), len);
-                x = simd__mul_ps(x, invLen);
-                y = simd__mul_ps(y, invLen);
-                z = simd__mul_ps(z, invLen);
-
-                int index = yIter * w + (xIter - (SINM_SIMD_WIDTH - 1));
-                simd__storeu_ix((simd__int*)&out[index], sinm__v3_to_rgba_simd(x, y, z));
+            for (int32_t i = 0; i < rows; ++i) {
+                SINM__H(sinm__store_heights_partial_simd)(&out[(size_t)(y + i) * w + c0], v[i], count);
             }
         }
     }
-
-    sinm__sobel3x3_normals_row_range(in, out, 0, SINM_SIMD_WIDTH, w, h, scale, flipY);
-    sinm__sobel3x3_normals_row_range(in, out, w - SINM_SIMD_WIDTH, w, w, h, scale, flipY);
 }
 
-SINM_DEF void
-sinm__normalize(uint32_t* in, int32_t w, int32_t h, float scale, int flipY)
+//Recursive gaussian down the columns in [xs, xe), walked in strips of
+//SINM__BLUR_STRIP_WIDTH columns like sinm__box_blur_v_simd. "scratch" holds the forward
+//pass of a strip, h * SINM__BLUR_STRIP_WIDTH doubles. "in" and "out" can be the same.
+static void
+SINM__H(sinm__recursive_blur_v_simd)(const sinm__height* in, sinm__height* out, int32_t w, int32_t h, int32_t xs, int32_t xe, const sinm__recursive_gaussian* g, double* scratch)
 {
-    float invScale = 1.0f / scale;
-    float yDir = (flipY) ? -1.0f : 1.0f;
-    for (int32_t i = 0; i < w * h; ++i) {
-        sinm__v3 v = sinm__rgba_to_v3(in[i]);
-        in[i] = sinm__unit_vector_to_rgba(sinm__normalized(v.x, v.y * yDir, v.z * invScale));
+    const int32_t half = SINM_SIMD_WIDTH / 2;
+    simd__double c[4];
+    c[0] = simd__set1_pd(g->b);
+    for (int32_t i = 0; i < 3; ++i) {
+        c[i + 1] = simd__set1_pd(g->a[i]);
     }
-}
 
-SINM_DEF void
-sinm__normalize_simd(uint32_t* in, int32_t w, int32_t h, float scale, int flipY)
-{
-    assert(w % SINM_SIMD_WIDTH == 0);
-    for (int32_t i = 0; i < w * h; i += SINM_SIMD_WIDTH) {
-        simd__int pixel = simd__loadu_ix((simd__int*)&in[i]);
-        simd__float x, y, z;
-        sinm__rgba_to_v3_simd(pixel, &x, &y, &z);
-        simd__float len = sinm__length_simd(x, y, z);
-        simd__float invLen = simd__div_ps(simd__set1_ps(1.0f), len);
-        x = simd__mul_ps(x, invLen);
-        y = simd__mul_ps(y, invLen);
-        z = simd__mul_ps(z, invLen);
-        simd__storeu_ix((simd__int*)&in[i], sinm__v3_to_rgba_simd(x, y, z));
+    for (int32_t x = xs; x < xe; x += SINM__BLUR_STRIP_WIDTH) {
+        int32_t columns = sinm__min(SINM__BLUR_STRIP_WIDTH, xe - x);
+        int32_t vectors = (columns + SINM_SIMD_WIDTH - 1) / SINM_SIMD_WIDTH;
+        simd__double p[SINM__BLUR_STRIP_VECTORS * 2][3];
+        simd__double last[SINM__BLUR_STRIP_VECTORS * 2];
+
+        for (int32_t v = 0; v < vectors; ++v) {
+            simd__int first = SINM__H(sinm__load_heights_partial_simd)(&in[x + v * SINM_SIMD_WIDTH], columns - v * SINM_SIMD_WIDTH);
+            SINM__K(sinm__cvtepi32_pd_simd)(first, &last[v * 2]);
+            for (int32_t i = 0; i < 3; ++i) {
+                p[v * 2][i] = last[v * 2];
+                p[v * 2 + 1][i] = last[v * 2 + 1];
+            }
+        }
+
+        for (int32_t y = 0; y < h; ++y) {
+            const sinm__height* row = in + (size_t)y * w + x;
+            double* dst = scratch + (size_t)y * SINM__BLUR_STRIP_WIDTH;
+            for (int32_t v = 0; v < vectors; ++v) {
+                simd__int heights = SINM__H(sinm__load_heights_partial_simd)(&row[v * SINM_SIMD_WIDTH], columns - v * SINM_SIMD_WIDTH);
+                SINM__K(sinm__cvtepi32_pd_simd)(heights, &last[v * 2]);
+                simd__storeu_pd(&dst[v * SINM_SIMD_WIDTH], SINM__K(sinm__recursive_step_simd)(last[v * 2], p[v * 2], c));
+                simd__storeu_pd(&dst[v * SINM_SIMD_WIDTH + half], SINM__K(sinm__recursive_step_simd)(last[v * 2 + 1], p[v * 2 + 1], c));
+            }
+        }
+
+        for (int32_t v = 0; v < vectors * 2; ++v) {
+            SINM__K(sinm__recursive_edge_simd)(p[v], last[v], g);
+        }
+
+        for (int32_t y = h - 1; y >= 0; --y) {
+            const double* fwd = scratch + (size_t)y * SINM__BLUR_STRIP_WIDTH;
+            sinm__height* row = out + (size_t)y * w + x;
+            for (int32_t v = 0; v < vectors; ++v) {
+                if (y < h - 1) {
+                    SINM__K(sinm__recursive_step_simd)(simd__loadu_pd(&fwd[v * SINM_SIMD_WIDTH]), p[v * 2], c);
+                    SINM__K(sinm__recursive_step_simd)(simd__loadu_pd(&fwd[v * SINM_SIMD_WIDTH + half]), p[v * 2 + 1], c);
+                }
+                simd__int heights = SINM__H(sinm__recursive_heights_simd)(p[v * 2][0], p[v * 2 + 1][0]);
+                SINM__H(sinm__store_heights_partial_simd)(&row[v * SINM_SIMD_WIDTH], heights, columns - v * SINM_SIMD_WIDTH);
+            }
+        }
     }
 }
 
-#if 0
-SINM_DEF void
-sinm__normalize_gpu(uint32_t* in, )
+#define sinm__load_grey(p) simd__cvtepi32_ps(SINM__H(sinm__load_heights_simd)(p))
+
+//Turns SINM_SIMD_WIDTH gradients into normals
+static sinm__forceinline simd__int
+SINM__H(sinm__gradient_to_normals_simd)(simd__float gx, simd__float gy, simd__float scale, simd__float scaleY)
 {
+    simd__float x = simd__mul_ps(gx, scale);
+    simd__float y = simd__mul_ps(gy, scaleY);
+    simd__float z = simd__set1_ps(SINM__HEIGHT_MAX);
+
+    simd__float invLen = simd__div_ps(simd__set1_ps(1.0f), SINM__K(sinm__length_simd)(x, y, z));
+    x = simd__mul_ps(x, invLen);
+    y = simd__mul_ps(y, invLen);
+    z = simd__mul_ps(z, invLen);
+    return SINM__K(sinm__v3_to_rgba_simd)(x, y, z);
 }
 
-#endif
+//NOTE: every gradient filter gets its own block function computing SINM_SIMD_WIDTH
+//unscaled gradients from shifted loads of its rows, written out so zero taps are skipped and
+//symmetric taps are added before they are weighted. "r" points at "radius" columns
+//left of the first output pixel.
 
-SINM_DEF sinm__inline void
-sinm_normalize(uint32_t* in, int32_t w, int32_t h, float scale, int flipY)
+//x: [-1 0 1][-2 0 2][-1 0 1]  y: [-1 -2 -1][0 0 0][1 2 1]
+static sinm__forceinline void
+SINM__H(sinm__sobel3x3_block_simd)(const sinm__height* const* r, simd__float* gx, simd__float* gy)
 {
-    if (w % SINM_SIMD_WIDTH == 0) {
-        sinm__normalize_simd(in, w, h, scale, flipY);
-    } else {
-        sinm__normalize(in, w, h, scale, flipY);
-    }
+    simd__float two = simd__set1_ps(2.0f);
+    simd__float a0 = sinm__load_grey(r[0]);
+    simd__float a1 = sinm__load_grey(r[0] + 1);
+    simd__float a2 = sinm__load_grey(r[0] + 2);
+    simd__float b0 = sinm__load_grey(r[1]);
+    simd__float b2 = sinm__load_grey(r[1] + 2);
+    simd__float c0 = sinm__load_grey(r[2]);
+    simd__float c1 = sinm__load_grey(r[2] + 1);
+    simd__float c2 = sinm__load_grey(r[2] + 2);
+
+    *gx = simd__add_ps(simd__add_ps(simd__sub_ps(a2, a0), simd__mul_ps(simd__sub_ps(b2, b0), two)), simd__sub_ps(c2, c0));
+    simd__float top = simd__add_ps(simd__add_ps(a0, simd__mul_ps(a1, two)), a2);
+    simd__float bottom = simd__add_ps(simd__add_ps(c0, simd__mul_ps(c1, two)), c2);
+    *gy = simd__sub_ps(bottom, top);
 }
 
-SINM_DEF void sinm__composite(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h)
+//Separable [1 4 6 4 1] x [-1 -2 0 2 1]
+static sinm__forceinline void
+SINM__H(sinm__sobel5x5_block_simd)(const sinm__height* const* r, simd__float* gx, simd__float* gy)
 {
-    for (int32_t i = 0; i < w * h; ++i) {
-        uint32_t c1 = in1[i];
-        uint32_t c2 = in2[i];
-        uint32_t r1 = c1 & 0xFFu;
-        uint32_t r2 = c2 & 0xFFu;
-        uint32_t g1 = (c1 >> 8) & 0xFFu;
-        uint32_t g2 = (c2 >> 8) & 0xFFu;
-        uint32_t b1 = (c1 >> 16) & 0xFFu;
-        uint32_t b2 = (c2 >> 16) & 0xFFu;
-        uint32_t r = (r1 + r2) >> 1;
-        uint32_t g = (g1 + g2) >> 1;
-        uint32_t b = (b1 + b2) >> 1;
-        out[i] = (r | g << 8u | b << 16u | 255u << 24u);
+    simd__float two = simd__set1_ps(2.0f);
+    simd__float four = simd__set1_ps(4.0f);
+    simd__float six = simd__set1_ps(6.0f);
+
+    //NOTE: x smooths the columns left and right of the center, y the rows above and below
+    simd__float columns[5];
+    simd__float rows[5];
+    sinm__unroll
+    for (int32_t k = 0; k < 5; ++k) {
+        if (k != 2) {
+            simd__float outer = simd__add_ps(sinm__load_grey(r[0] + k), sinm__load_grey(r[4] + k));
+            simd__float inner = simd__add_ps(sinm__load_grey(r[1] + k), sinm__load_grey(r[3] + k));
+            columns[k] = simd__add_ps(simd__add_ps(outer, simd__mul_ps(inner, four)), simd__mul_ps(sinm__load_grey(r[2] + k), six));
+
+            const sinm__height* row = r[k];
+            simd__float outerX = simd__add_ps(sinm__load_grey(row), sinm__load_grey(row + 4));
+            simd__float innerX = simd__add_ps(sinm__load_grey(row + 1), sinm__load_grey(row + 3));
+            rows[k] = simd__add_ps(simd__add_ps(outerX, simd__mul_ps(innerX, four)), simd__mul_ps(sinm__load_grey(row + 2), six));
+        }
     }
+
+    *gx = simd__add_ps(simd__sub_ps(columns[4], columns[0]), simd__mul_ps(simd__sub_ps(columns[3], columns[1]), two));
+    *gy = simd__add_ps(simd__sub_ps(rows[4], rows[0]), simd__mul_ps(simd__sub_ps(rows[3], rows[1]), two));
 }
 
-SINM_DEF void sinm__composite_simd(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h)
+//x: [-3 0 3][-10 0 10][-3 0 3]  y: [-3 -10 -3][0 0 0][3 10 3]
+static sinm__forceinline void
+SINM__H(sinm__scharr_block_simd)(const sinm__height* const* r, simd__float* gx, simd__float* gy)
 {
-    simd__int ff = simd__set1_epi32(0xFF);
-    simd__int alpha = simd__slli_epi32(ff, 24);
-    for (int32_t i = 0; i < w * h; i += SINM_SIMD_WIDTH) {
-        simd__int c1 = simd__loadu_ix((simd__int*)&in1[i]);
-        simd__int c2 = simd__loadu_ix((simd__int*)&in2[i]);
+    simd__float three = simd__set1_ps(3.0f);
+    simd__float ten = simd__set1_ps(10.0f);
+    simd__float a0 = sinm__load_grey(r[0]);
+    simd__float a1 = sinm__load_grey(r[0] + 1);
+    simd__float a2 = sinm__load_grey(r[0] + 2);
+    simd__float b0 = sinm__load_grey(r[1]);
+    simd__float b2 = sinm__load_grey(r[1] + 2);
+    simd__float c0 = sinm__load_grey(r[2]);
+    simd__float c1 = sinm__load_grey(r[2] + 1);
+    simd__float c2 = sinm__load_grey(r[2] + 2);
+
+    simd__float corners = simd__add_ps(simd__sub_ps(a2, a0), simd__sub_ps(c2, c0));
+    *gx = simd__add_ps(simd__mul_ps(corners, three), simd__mul_ps(simd__sub_ps(b2, b0), ten));
+    corners = simd__add_ps(simd__sub_ps(c0, a0), simd__sub_ps(c2, a2));
+    *gy = simd__add_ps(simd__mul_ps(corners, three), simd__mul_ps(simd__sub_ps(c1, a1), ten));
+}
 
-        simd__int r1 = simd__and_ix(c1, ff);
-        simd__int r2 = simd__and_ix(c2, ff);
-        simd__int g1 = simd__and_ix(simd__srli_epi32(c1, 8), ff);
-        simd__int g2 = simd__and_ix(simd__srli_epi32(c2, 8), ff);
-        simd__int b1 = simd__and_ix(simd__srli_epi32(c1, 16), ff);
-        simd__int b2 = simd__and_ix(simd__srli_epi32(c2, 16), ff);
+//x: [-1 0 1][-1 0 1][-1 0 1]  y: [-1 -1 -1][0 0 0][1 1 1]
+static sinm__forceinline void
+SINM__H(sinm__prewitt_block_simd)(const sinm__height* const* r, simd__float* gx, simd__float* gy)
+{
+    simd__float a0 = sinm__load_grey(r[0]);
+    simd__float a1 = sinm__load_grey(r[0] + 1);
+    simd__float a2 = sinm__load_grey(r[0] + 2);
+    simd__float b0 = sinm__load_grey(r[1]);
+    simd__float b2 = sinm__load_grey(r[1] + 2);
+    simd__float c0 = sinm__load_grey(r[2]);
+    simd__float c1 = sinm__load_grey(r[2] + 1);
+    simd__float c2 = sinm__load_grey(r[2] + 2);
+
+    *gx = simd__add_ps(simd__add_ps(simd__sub_ps(a2, a0), simd__sub_ps(b2, b0)), simd__sub_ps(c2, c0));
+    *gy = simd__add_ps(simd__add_ps(simd__sub_ps(c0, a0), simd__sub_ps(c1, a1)), simd__sub_ps(c2, a2));
+}
 
-        simd__int r = simd__srli_epi32(simd__add_epi32(r1, r2), 1);
-        simd__int g = simd__srli_epi32(simd__add_epi32(g1, g2), 1);
-        simd__int b = simd__srli_epi32(simd__add_epi32(b1, b2), 1);
+//x: [-1 0 1]  y: [-1 0 1] down the column
+static sinm__forceinline void
+SINM__H(sinm__central_block_simd)(const sinm__height* const* r, simd__float* gx, simd__float* gy)
+{
+    *gx = simd__sub_ps(sinm__load_grey(r[1] + 2), sinm__load_grey(r[1]));
+    *gy = simd__sub_ps(sinm__load_grey(r[2] + 1), sinm__load_grey(r[0] + 1));
+}
 
-        simd__int final = simd__or_ix(simd__or_ix(simd__or_ix(r, simd__slli_epi32(g, 8)), simd__slli_epi32(b, 16)), alpha);
+#undef sinm__load_grey
 
-        simd__storeu_ix((simd__int*)&out[i], final);
-    }
-}
+typedef void SINM__H(sinm__gradient_block_proc)(const sinm__height* const* r, simd__float* gx, simd__float* gy);
 
-SINM_DEF sinm__inline void
-sinm_composite(const uint32_t* in1, const uint32_t* in2, uint32_t* out, int32_t w, int32_t h)
+//Gradients of the SINM_SIMD_WIDTH pixels starting at column "x"
+static sinm__forceinline void
+SINM__H(sinm__gradient_at_simd)(const sinm__height* const* rows, int32_t x, int32_t w, int32_t radius, SINM__H(sinm__gradient_block_proc)* block, simd__float* gx, simd__float* gy)
 {
-    if ((w * h) % SINM_SIMD_WIDTH == 0) {
-        sinm__composite_simd(in1, in2, out, w, h);
+    const sinm__height* r[5];
+    int32_t size = radius * 2 + 1;
+    if (x >= radius + 1 && x + SINM_SIMD_WIDTH <= w - radius) {
+        for (int32_t a = 0; a < size; ++a) {
+            r[a] = rows[a] + x - radius;
+        }
+        block(r, gx, gy);
     } else {
-        sinm__composite(in1, in2, out, w, h);
+        //NOTE: the edges(and the tail) read clamped columns so they go through a padded copy
+        sinm__height edge[5][SINM_SIMD_WIDTH + 4];
+        for (int32_t a = 0; a < size; ++a) {
+            for (int32_t i = 0; i < SINM_SIMD_WIDTH + 2 * radius; ++i) {
+                edge[a][i] = rows[a][sinm__min(w - 1, sinm__max(1, x + i - radius))];
+            }
+            r[a] = edge[a];
+        }
+        block(r, gx, gy);
     }
 }
 
-SINM_DEF sinm__inline uint32_t*
-sinm_composite_alloc(const uint32_t* in1, const uint32_t* in2, int32_t w, int32_t h)
+//NOTE: shared row loop, "radius" and "block" are constants in every caller so each
+//filter ends up with its own copy with the block inlined
+static sinm__forceinline void
+SINM__H(sinm__gradient_normals_row_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY, int32_t radius, SINM__H(sinm__gradient_block_proc)* block)
 {
-    uint32_t* result = (uint32_t*)malloc(sizeof(uint32_t) * w * h);
-    if (result) {
-        sinm_composite(in1, in2, result, w, h);
+    simd__float simdScale = simd__set1_ps(scale);
+    simd__float simdScaleY = simd__set1_ps((flipY) ? -scale : scale);
+
+    for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+        simd__float gx, gy;
+        SINM__H(sinm__gradient_at_simd)(rows, x, w, radius, block, &gx, &gy);
+        simd__int normals = SINM__H(sinm__gradient_to_normals_simd)(gx, gy, simdScale, simdScaleY);
+
+        int32_t count = w - x;
+        if (count >= SINM_SIMD_WIDTH) {
+            simd__storeu_ix((simd__int*)&out[x], normals);
+        } else {
+            sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+            simd__storeu_ix((simd__int*)tail, normals);
+            memcpy(out + x, tail, count * sizeof(uint32_t));
+        }
     }
-    return result;
 }
 
-static void
-sinm__greyscale(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+//Normals of a row from the gradients of several blurred copies of the heights added up.
+//"rows" holds the 2 * radius + 1 rows of every level, 5 pointers apart, and "scales" the
+//scale of every level.
+static sinm__forceinline void
+SINM__H(sinm__gradient_levels_row_simd)(const sinm__height* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, float strength, int flipY, int32_t radius, SINM__H(sinm__gradient_block_proc)* block)
 {
-    int32_t count = w * h;
-    switch (type) {
-    case sinm_greyscale_lightness: {
-        for (int32_t i = 0; i < count; ++i) {
-            uint32_t c = in[i];
-            uint32_t l = sinm__lightness_average(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu);
-            out[i] = sinm__greyscale_from_byte(l);
-        }
-    } break;
-
-    case sinm_greyscale_average: {
-        for (int32_t i = 0; i < count; ++i) {
-            uint32_t c = in[i];
-            uint32_t l = sinm__average(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu);
-            out[i] = sinm__greyscale_from_byte(l);
+    simd__float one = simd__set1_ps(1.0f);
+    for (int32_t x = 0; x < w; x += SINM_SIMD_WIDTH) {
+        simd__float sumX = simd__set1_ps(0.0f);
+        simd__float sumY = simd__set1_ps(0.0f);
+        for (int32_t l = 0; l < levels; ++l) {
+            simd__float gx, gy;
+            SINM__H(sinm__gradient_at_simd)(rows + l * 5, x, w, radius, block, &gx, &gy);
+            float scale = scales[l] * strength;
+            sumX = simd__add_ps(sumX, simd__mul_ps(gx, simd__set1_ps(scale)));
+            sumY = simd__add_ps(sumY, simd__mul_ps(gy, simd__set1_ps((flipY) ? -scale : scale)));
         }
-    } break;
+        simd__int normals = SINM__H(sinm__gradient_to_normals_simd)(sumX, sumY, one, one);
 
-    case sinm_greyscale_luminance: {
-        for (int32_t i = 0; i < count; ++i) {
-            uint32_t c = in[i];
-            uint32_t l = sinm__luminance(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu);
-            out[i] = sinm__greyscale_from_byte(l);
+        int32_t count = w - x;
+        if (count >= SINM_SIMD_WIDTH) {
+            simd__storeu_ix((simd__int*)&out[x], normals);
+        } else {
+            sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+            simd__storeu_ix((simd__int*)tail, normals);
+            memcpy(out + x, tail, count * sizeof(uint32_t));
         }
-    } break;
-    default: {
-        //INVALID OPTION
-        assert(false);
-    } break;
     }
 }
 
 static void
-sinm__simd_greyscale(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+SINM__H(sinm__sobel3x3_normals_row_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
 {
-    simd__int redMask = simd__set1_epi32(0xFF);
-    simd__int greenMask = simd__set1_epi32(0xFF00u);
-    simd__int blueMask = simd__set1_epi32(0xFF0000u);
-    simd__int alpha = simd__set1_epi32(0xFF000000u);
-
-    int32_t count = w * h;
+    SINM__H(sinm__gradient_normals_row_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__sobel3x3_block_simd));
+}
 
-    switch (type) {
-    case sinm_greyscale_lightness: {
-        for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
-            simd__int c = simd__loadu_ix((simd__int*)&in[i]);
-            simd__int r = simd__and_ix(c, redMask);
-            simd__int g = simd__srli_epi32(simd__and_ix(c, greenMask), 8);
-            simd__int b = simd__srli_epi32(simd__and_ix(c, blueMask), 16);
+static void
+SINM__H(sinm__sobel5x5_normals_row_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_sobel5x5].strength;
+    SINM__H(sinm__gradient_normals_row_simd)(rows, out, w, scale, flipY, 2, SINM__H(sinm__sobel5x5_block_simd));
+}
 
-            simd__int max = simd__max_epi32(simd__max_epi32(r, g), b);
-            simd__int min = simd__min_epi32(simd__min_epi32(r, g), b);
-            simd__int l = simd__srli_epi32(simd__add_epi32(min, max), 1);
+static void
+SINM__H(sinm__scharr_normals_row_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_scharr].strength;
+    SINM__H(sinm__gradient_normals_row_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__scharr_block_simd));
+}
 
-            l = simd__or_ix(simd__slli_epi32(l, 16),
-                simd__or_ix(simd__slli_epi32(l, 8),
-                    simd__or_ix(l, alpha)));
+static void
+SINM__H(sinm__prewitt_normals_row_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_prewitt].strength;
+    SINM__H(sinm__gradient_normals_row_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__prewitt_block_simd));
+}
 
-            simd__storeu_ix((simd__int*)&out[i], l);
-        }
-    } break;
+static void
+SINM__H(sinm__central_normals_row_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_central].strength;
+    SINM__H(sinm__gradient_normals_row_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__central_block_simd));
+}
 
-    case sinm_greyscale_average: {
-        simd__float inverse3 = simd__set1_ps(1.0f / 3.0f);
-        for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
-            simd__int c = simd__loadu_ix((simd__int*)&in[i]);
-            simd__int r = simd__and_ix(c, redMask);
-            simd__int g = simd__srli_epi32(simd__and_ix(c, greenMask), 8);
-            simd__int b = simd__srli_epi32(simd__and_ix(c, blueMask), 16);
+//NOTE: only 8 bit heights have multi-scale normal maps
+#if SINM__HEIGHT_PASS == 1
+static void
+SINM__H(sinm__sobel3x3_levels_row_simd)(const sinm__height* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, int flipY)
+{
+    SINM__H(sinm__gradient_levels_row_simd)(rows, scales, levels, out, w, 1.0f, flipY, 1, SINM__H(sinm__sobel3x3_block_simd));
+}
 
-            simd__int s = simd__add_epi32(simd__add_epi32(r, g), b);
-            s = simd__cvtps_epi32(simd__mul_ps(simd__cvtepi32_ps(s), inverse3));
-            s = simd__or_ix(simd__slli_epi32(s, 16),
-                simd__or_ix(simd__slli_epi32(s, 8),
-                    simd__or_ix(s, alpha)));
+static void
+SINM__H(sinm__sobel5x5_levels_row_simd)(const sinm__height* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, int flipY)
+{
+    float strength = sinm__gradient_filters[sinm_gradient_sobel5x5].strength;
+    SINM__H(sinm__gradient_levels_row_simd)(rows, scales, levels, out, w, strength, flipY, 2, SINM__H(sinm__sobel5x5_block_simd));
+}
 
-            simd__storeu_ix((simd__int*)&out[i], s);
-        }
-    } break;
+static void
+SINM__H(sinm__scharr_levels_row_simd)(const sinm__height* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, int flipY)
+{
+    float strength = sinm__gradient_filters[sinm_gradient_scharr].strength;
+    SINM__H(sinm__gradient_levels_row_simd)(rows, scales, levels, out, w, strength, flipY, 1, SINM__H(sinm__scharr_block_simd));
+}
 
-    case sinm_greyscale_luminance: {
-        simd__float rBias = simd__set1_ps(0.21f);
-        simd__float gBias = simd__set1_ps(0.72f);
-        simd__float bBias = simd__set1_ps(0.07f);
+static void
+SINM__H(sinm__prewitt_levels_row_simd)(const sinm__height* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, int flipY)
+{
+    float strength = sinm__gradient_filters[sinm_gradient_prewitt].strength;
+    SINM__H(sinm__gradient_levels_row_simd)(rows, scales, levels, out, w, strength, flipY, 1, SINM__H(sinm__prewitt_block_simd));
+}
 
-        for (int32_t i = 0; i < count; i += SINM_SIMD_WIDTH) {
-            simd__int c = simd__loadu_ix((simd__int*)&in[i]);
-            simd__float r = simd__cvtepi32_ps(simd__and_ix(c, redMask));
-            simd__float g = simd__cvtepi32_ps(simd__srli_epi32(simd__and_ix(c, greenMask), 8));
-            simd__float b = simd__cvtepi32_ps(simd__srli_epi32(simd__and_ix(c, blueMask), 16));
+static void
+SINM__H(sinm__central_levels_row_simd)(const sinm__height* const* rows, const float* scales, int32_t levels, uint32_t* out, int32_t w, int flipY)
+{
+    float strength = sinm__gradient_filters[sinm_gradient_central].strength;
+    SINM__H(sinm__gradient_levels_row_simd)(rows, scales, levels, out, w, strength, flipY, 1, SINM__H(sinm__central_block_simd));
+}
 
-            r = simd__mul_ps(r, rBias);
-            g = simd__mul_ps(g, gBias);
-            b = simd__mul_ps(b, bBias);
+//NOTE: sinm_pipeline_fixed16 versions of the block functions, 2 * SINM_SIMD_WIDTH
+//gradients per call on 16 bit lanes. The taps are shifts and adds, the largest
+//gradient(sobel 5x5) is 48 * 255 so nothing wraps and the result is exact.
+#define sinm__load_grey16(p) SINM__H(sinm__load_heights16_simd)(p)
 
-            simd__int sum = simd__cvtps_epi32(simd__add_ps(r, simd__add_ps(g, b)));
-            sum = simd__or_ix(simd__slli_epi32(sum, 16),
-                simd__or_ix(simd__slli_epi32(sum, 8),
-                    simd__or_ix(sum, alpha)));
+static sinm__forceinline void
+SINM__H(sinm__sobel3x3_block16_simd)(const sinm__height* const* r, simd__int* gx, simd__int* gy)
+{
+    simd__int a0 = sinm__load_grey16(r[0]);
+    simd__int a1 = sinm__load_grey16(r[0] + 1);
+    simd__int a2 = sinm__load_grey16(r[0] + 2);
+    simd__int b0 = sinm__load_grey16(r[1]);
+    simd__int b2 = sinm__load_grey16(r[1] + 2);
+    simd__int c0 = sinm__load_grey16(r[2]);
+    simd__int c1 = sinm__load_grey16(r[2] + 1);
+    simd__int c2 = sinm__load_grey16(r[2] + 2);
+
+    *gx = simd__add_epi16(simd__add_epi16(simd__sub_epi16(a2, a0), simd__slli_epi16(simd__sub_epi16(b2, b0), 1)), simd__sub_epi16(c2, c0));
+    simd__int top = simd__add_epi16(simd__add_epi16(a0, simd__slli_epi16(a1, 1)), a2);
+    simd__int bottom = simd__add_epi16(simd__add_epi16(c0, simd__slli_epi16(c1, 1)), c2);
+    *gy = simd__sub_epi16(bottom, top);
+}
 
-            simd__storeu_ix((simd__int*)&out[i], sum);
+static sinm__forceinline void
+SINM__H(sinm__sobel5x5_block16_simd)(const sinm__height* const* r, simd__int* gx, simd__int* gy)
+{
+    simd__int columns[5];
+    simd__int rows[5];
+    sinm__unroll
+    for (int32_t k = 0; k < 5; ++k) {
+        if (k != 2) {
+            simd__int outer = simd__add_epi16(sinm__load_grey16(r[0] + k), sinm__load_grey16(r[4] + k));
+            simd__int inner = simd__add_epi16(sinm__load_grey16(r[1] + k), sinm__load_grey16(r[3] + k));
+            simd__int center = sinm__load_grey16(r[2] + k);
+            simd__int six = simd__add_epi16(simd__slli_epi16(center, 2), simd__slli_epi16(center, 1));
+            columns[k] = simd__add_epi16(simd__add_epi16(outer, simd__slli_epi16(inner, 2)), six);
+
+            const sinm__height* row = r[k];
+            simd__int outerX = simd__add_epi16(sinm__load_grey16(row), sinm__load_grey16(row + 4));
+            simd__int innerX = simd__add_epi16(sinm__load_grey16(row + 1), sinm__load_grey16(row + 3));
+            simd__int centerX = sinm__load_grey16(row + 2);
+            simd__int sixX = simd__add_epi16(simd__slli_epi16(centerX, 2), simd__slli_epi16(centerX, 1));
+            rows[k] = simd__add_epi16(simd__add_epi16(outerX, simd__slli_epi16(innerX, 2)), sixX);
         }
-    } break;
-    default: {
-        //INVALID OPTION
-        assert(false);
-    } break;
     }
+
+    *gx = simd__add_epi16(simd__sub_epi16(columns[4], columns[0]), simd__slli_epi16(simd__sub_epi16(columns[3], columns[1]), 1));
+    *gy = simd__add_epi16(simd__sub_epi16(rows[4], rows[0]), simd__slli_epi16(simd__sub_epi16(rows[3], rows[1]), 1));
 }
 
-SINM_DEF void
-sinm_greyscale(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, sinm_greyscale_type type)
+static sinm__forceinline void
+SINM__H(sinm__scharr_block16_simd)(const sinm__height* const* r, simd__int* gx, simd__int* gy)
 {
-    int32_t count = w * h;
-    if (count % SINM_SIMD_WIDTH == 0) {
-        sinm__simd_greyscale(in, out, w, h, type);
-    } else {
-        sinm__greyscale(in, out, w, h, type);
-    }
+    simd__int a0 = sinm__load_grey16(r[0]);
+    simd__int a1 = sinm__load_grey16(r[0] + 1);
+    simd__int a2 = sinm__load_grey16(r[0] + 2);
+    simd__int b0 = sinm__load_grey16(r[1]);
+    simd__int b2 = sinm__load_grey16(r[1] + 2);
+    simd__int c0 = sinm__load_grey16(r[2]);
+    simd__int c1 = sinm__load_grey16(r[2] + 1);
+    simd__int c2 = sinm__load_grey16(r[2] + 2);
+
+    //NOTE: 3x = 2x + x and 10x = 8x + 2x
+    simd__int corners = simd__add_epi16(simd__sub_epi16(a2, a0), simd__sub_epi16(c2, c0));
+    simd__int middle = simd__sub_epi16(b2, b0);
+    *gx = simd__add_epi16(simd__add_epi16(simd__slli_epi16(corners, 1), corners), simd__add_epi16(simd__slli_epi16(middle, 3), simd__slli_epi16(middle, 1)));
+    corners = simd__add_epi16(simd__sub_epi16(c0, a0), simd__sub_epi16(c2, a2));
+    middle = simd__sub_epi16(c1, a1);
+    *gy = simd__add_epi16(simd__add_epi16(simd__slli_epi16(corners, 1), corners), simd__add_epi16(simd__slli_epi16(middle, 3), simd__slli_epi16(middle, 1)));
 }
 
-SINM_DEF int
-sinm_normal_map_buffer(const uint32_t* in, uint32_t* out, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY)
+static sinm__forceinline void
+SINM__H(sinm__prewitt_block16_simd)(const sinm__height* const* r, simd__int* gx, simd__int* gy)
 {
-    assert(w > 0 && h > 0);
-    uint32_t* intermediate = (uint32_t*)malloc(w * h * sizeof(uint32_t));
+    simd__int a0 = sinm__load_grey16(r[0]);
+    simd__int a1 = sinm__load_grey16(r[0] + 1);
+    simd__int a2 = sinm__load_grey16(r[0] + 2);
+    simd__int b0 = sinm__load_grey16(r[1]);
+    simd__int b2 = sinm__load_grey16(r[1] + 2);
+    simd__int c0 = sinm__load_grey16(r[2]);
+    simd__int c1 = sinm__load_grey16(r[2] + 1);
+    simd__int c2 = sinm__load_grey16(r[2] + 2);
+
+    *gx = simd__add_epi16(simd__add_epi16(simd__sub_epi16(a2, a0), simd__sub_epi16(b2, b0)), simd__sub_epi16(c2, c0));
+    *gy = simd__add_epi16(simd__add_epi16(simd__sub_epi16(c0, a0), simd__sub_epi16(c1, a1)), simd__sub_epi16(c2, a2));
+}
 
-    if (intermediate) {
-        if (greyscaleType != sinm_greyscale_none) {
-            sinm_greyscale(in, out, w, h, greyscaleType);
-        } else {
-            memcpy(out, in, w * h * sizeof(uint32_t));
-        }
+static sinm__forceinline void
+SINM__H(sinm__central_block16_simd)(const sinm__height* const* r, simd__int* gx, simd__int* gy)
+{
+    *gx = simd__sub_epi16(sinm__load_grey16(r[1] + 2), sinm__load_grey16(r[1]));
+    *gy = simd__sub_epi16(sinm__load_grey16(r[2] + 1), sinm__load_grey16(r[0] + 1));
+}
 
-        float radius = sinm__min(sinm__min(w, h), sinm__max(0, blurRadius));
-        if (radius >= 1.0f) {
-            sinm__gaussian_box(out, intermediate, w, h, radius);
-        } else {
-            memcpy(intermediate, out, w * h * sizeof(uint32_t));
-        }
+#undef sinm__load_grey16
 
-        //TODO: support using simd on non power of 2 images
-        int32_t count = w * h;
-        if (count % SINM_SIMD_WIDTH == 0) {
-            sinm__sobel3x3_normals_simd(intermediate, out, w, h, scale, flipY);
+typedef void SINM__H(sinm__gradient_block16_proc)(const sinm__height* const* r, simd__int* gx, simd__int* gy);
+
+//Same normals as sinm__gradient_normals_row_simd, the gradients of 2 * SINM_SIMD_WIDTH
+//pixels come from one block16 call and are widened to floats for the normalization
+static sinm__forceinline void
+SINM__H(sinm__gradient_normals_row_fixed_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY, int32_t radius, SINM__H(sinm__gradient_block16_proc)* block)
+{
+    const int32_t step = SINM_SIMD_WIDTH * 2;
+    simd__float simdScale = simd__set1_ps(scale);
+    simd__float simdScaleY = simd__set1_ps((flipY) ? -scale : scale);
+    int32_t size = radius * 2 + 1;
+
+    for (int32_t x = 0; x < w; x += step) {
+        const sinm__height* r[5];
+        sinm__height edge[5][SINM_SIMD_WIDTH * 2 + 4];
+        if (x >= radius + 1 && x + step <= w - radius) {
+            for (int32_t a = 0; a < size; ++a) {
+                r[a] = rows[a] + x - radius;
+            }
         } else {
-            sinm__sobel3x3_normals(intermediate, out, w, h, scale, flipY);
+            for (int32_t a = 0; a < size; ++a) {
+                for (int32_t i = 0; i < step + 2 * radius; ++i) {
+                    edge[a][i] = rows[a][sinm__min(w - 1, sinm__max(1, x + i - radius))];
+                }
+                r[a] = edge[a];
+            }
         }
 
-        free(intermediate);
-        return 1;
+        simd__int gx16, gy16;
+        block(r, &gx16, &gy16);
+        simd__float gx[2], gy[2];
+        SINM__K(sinm__cvtepi16_ps_simd)(gx16, gx);
+        SINM__K(sinm__cvtepi16_ps_simd)(gy16, gy);
+
+        for (int32_t i = 0; i < 2; ++i) {
+            simd__int normals = SINM__H(sinm__gradient_to_normals_simd)(gx[i], gy[i], simdScale, simdScaleY);
+            int32_t start = x + i * SINM_SIMD_WIDTH;
+            int32_t count = w - start;
+            if (count >= SINM_SIMD_WIDTH) {
+                simd__storeu_ix((simd__int*)&out[start], normals);
+            } else if (count > 0) {
+                sinm__aligned_var(uint32_t, 64) tail[SINM_SIMD_WIDTH];
+                simd__storeu_ix((simd__int*)tail, normals);
+                memcpy(out + start, tail, count * sizeof(uint32_t));
+            }
+        }
     }
-    return 0;
 }
 
+static void
+SINM__H(sinm__sobel3x3_normals_row_fixed_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    SINM__H(sinm__gradient_normals_row_fixed_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__sobel3x3_block16_simd));
+}
 
-SINM_DEF sinm__inline uint32_t*
-sinm_normal_map(const uint32_t* in, int32_t w, int32_t h, float scale, float blurRadius, sinm_greyscale_type greyscaleType, int flipY)
+static void
+SINM__H(sinm__sobel5x5_normals_row_fixed_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
 {
-    uint32_t* result = (uint32_t*)malloc(w * h * sizeof(uint32_t));
-    if (result) {
-        if (!sinm_normal_map_buffer(in, result, w, h, scale, blurRadius, greyscaleType, flipY)) {
-            free(result);
-            return NULL;
-        }
-    }
-    return result;
+    scale *= sinm__gradient_filters[sinm_gradient_sobel5x5].strength;
+    SINM__H(sinm__gradient_normals_row_fixed_simd)(rows, out, w, scale, flipY, 2, SINM__H(sinm__sobel5x5_block16_simd));
 }
 
-#endif //ifndef SI_NORMALMAP_IMPLEMENTATION
+static void
+SINM__H(sinm__scharr_normals_row_fixed_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_scharr].strength;
+    SINM__H(sinm__gradient_normals_row_fixed_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__scharr_block16_simd));
+}
+
+static void
+SINM__H(sinm__prewitt_normals_row_fixed_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_prewitt].strength;
+    SINM__H(sinm__gradient_normals_row_fixed_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__prewitt_block16_simd));
+}
+
+static void
+SINM__H(sinm__central_normals_row_fixed_simd)(const sinm__height* const* rows, uint32_t* out, int32_t w, float scale, int flipY)
+{
+    scale *= sinm__gradient_filters[sinm_gradient_central].strength;
+    SINM__H(sinm__gradient_normals_row_fixed_simd)(rows, out, w, scale, flipY, 1, SINM__H(sinm__central_block16_simd));
+}
+#endif
+
+#undef SINM__HEIGHT_SUFFIX
+#undef SINM__HEIGHT_MAX
+#undef sinm__height
+
+#endif //SINM__KERNEL_PASS
 /*
 Copyright (c) 2019 Jeremy Montgomery
 Permission is hereby granted, free of charge, to any person obtaining a copy of 
@@ -0,0 +1,512 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "types.h"
+
+#define SI_NORMALMAP_STATIC
+#define SI_NORMALMAP_IMPLEMENTATION
+#include "si_normalmap.h"
+
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+//NOTE: headless batch converter. Every input image goes through
+//decode -> greyscale -> blur -> sobel -> encode and is written next to the others in
+//the output directory as <name>_normal.tga.
+//
+//usage: sinm_batch [options] <manifest file | directory> <output directory>
+//  -s scale      normal strength(default 2)
+//  -b radius     blur radius(default 1)
+//  -g type       none, lightness, average or luminance(default average)
+//  -d filter     sobel, sobel5, scharr, prewitt or central(default sobel)
+//  -y            flip y
+//  -j threads    worker threads, 0 is one per core(default 0)
+//  -m megabytes  memory budget for images in flight(default 1024)
+//  -r WxH        out of core mode, see below
+//
+//A manifest lists one image path per line, empty lines and lines starting with #
+//are skipped. 16 bit pngs are loaded as one 16 bit grey channel and go through
+//sinm_normal_map_u16_buffer so their precision isn't lost, -g doesn't apply to them.
+//Files that can't be decoded(truncated, corrupt or not images at all) are reported as
+//failed and the exit code is 2.
+//
+//usage: sinm_batch [options] -r <width>x<height> <input file> <output file>
+//Converts a single raw image(w * h 32 bit rgba pixels, no header) that may be much
+//bigger than memory, such as a 64k x 64k terrain heightmap. Both files are memory
+//mapped and processed in tiles by sinm_normal_map_tiled, -m is the scratch memory for
+//the tiles. The output is raw too.
+
+typedef struct batch_image {
+    char* path;
+    i32 w, h;
+    b32 failed;
+    const char* error;
+    f64 decodeTime, processTime, encodeTime;
+} batch_image;
+
+typedef struct batch_queue {
+    batch_image* images;
+    i32 imageCount;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t memoryFreed;
+    i32 nextImage;
+    size_t memoryBudget;
+    size_t memoryInUse;
+
+    const char* outDir;
+    f32 scale;
+    f32 blurRadius;
+    sinm_greyscale_type greyscaleType;
+    b32 flipY;
+    sinm_options options;
+} batch_queue;
+
+internal f64
+batch_time(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//NOTE: decoded input, normal map and the decoder's own buffers. Only a budget, the
+//real peak depends on the file format.
+internal size_t
+batch_image_memory(i32 w, i32 h)
+{
+    return (size_t)w * h * 12;
+}
+
+//Blocks until "size" bytes fit in the budget. An image bigger than the whole budget
+//waits until nothing else is in flight and then runs alone.
+internal void
+batch_reserve(batch_queue* q, size_t size)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->memoryInUse > 0 && q->memoryInUse + size > q->memoryBudget) {
+        pthread_cond_wait(&q->memoryFreed, &q->mutex);
+    }
+    q->memoryInUse += size;
+    pthread_mutex_unlock(&q->mutex);
+}
+
+internal void
+batch_release(batch_queue* q, size_t size)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->memoryInUse -= size;
+    pthread_cond_broadcast(&q->memoryFreed);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+//Uncompressed 32 bit tga with the origin in the top left
+internal b32
+batch_write_tga(const char* path, const u32* pixels, i32 w, i32 h)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    u8 header[18] = { 0 };
+    header[2] = 2;
+    header[12] = (u8)(w & 0xFF);
+    header[13] = (u8)(w >> 8);
+    header[14] = (u8)(h & 0xFF);
+    header[15] = (u8)(h >> 8);
+    header[16] = 32;
+    header[17] = 0x28; //8 alpha bits, top left origin
+    b32 ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+    //NOTE: tga stores BGRA, swap a row at a time
+    u32* row = (u32*)malloc(w * sizeof(u32));
+    ok = ok && row;
+    for (i32 y = 0; ok && y < h; ++y) {
+        const u32* src = pixels + (size_t)y * w;
+        for (i32 x = 0; x < w; ++x) {
+            u32 c = src[x];
+            row[x] = (c & 0xFF00FF00) | ((c & 0xFF) << 16) | ((c >> 16) & 0xFF);
+        }
+        ok = fwrite(row, w * sizeof(u32), 1, f) == 1;
+    }
+    free(row);
+
+    return (fclose(f) == 0) && ok;
+}
+
+internal void
+batch_output_path(char* out, size_t outSize, const char* outDir, const char* path)
+{
+    const char* name = strrchr(path, '/');
+    name = (name) ? name + 1 : path;
+    const char* ext = strrchr(name, '.');
+    i32 nameLength = (i32)((ext) ? ext - name : strlen(name));
+    snprintf(out, outSize, "%s/%.*s_normal.tga", outDir, nameLength, name);
+}
+
+internal void
+batch_process(batch_queue* q, batch_image* image)
+{
+    //NOTE: the budget is reserved before decoding when the header can be read on its
+    //own. stb_image can't size every file that way(some tga files) and those reserve
+    //right after decoding instead.
+    i32 w = 0, h = 0, c;
+    b32 is16 = stbi_is_16_bit(image->path);
+    b32 sized = stbi_info(image->path, &w, &h, &c);
+    size_t memory = batch_image_memory(w, h);
+    if (sized) {
+        batch_reserve(q, memory);
+    }
+
+    //NOTE: 16 bit pngs are decoded straight to one grey channel, stb_image weighs it
+    //(77 * r + 150 * g + 29 * b) / 256 and drops alpha
+    f64 t0 = batch_time();
+    void* pixels = (is16) ? (void*)stbi_load_16(image->path, &w, &h, NULL, 1) : (void*)stbi_load(image->path, &w, &h, NULL, 4);
+    if (pixels && !sized) {
+        memory = batch_image_memory(w, h);
+        batch_reserve(q, memory);
+    }
+    //NOTE: tga sizes are 16 bit
+    b32 fits = w <= 0xFFFF && h <= 0xFFFF;
+    u32* normals = (pixels && fits) ? (u32*)malloc((size_t)w * h * sizeof(u32)) : NULL;
+    image->error = (!pixels) ? "can't decode" : (!fits) ? "too big for a tga" : (!normals) ? "out of memory" : NULL;
+
+    f64 t1 = batch_time();
+    b32 ok = false;
+    if (normals && is16) {
+        ok = sinm_normal_map_u16_buffer_ex((const u16*)pixels, normals, w, h, q->scale, q->blurRadius, q->flipY, 1, &q->options);
+    } else if (normals) {
+        ok = sinm_normal_map_buffer_streaming_ex((const u32*)pixels, normals, w, h, q->scale, q->blurRadius, q->greyscaleType, q->flipY, &q->options);
+    }
+    if (normals && !ok) {
+        image->error = "out of memory";
+    }
+    stbi_image_free(pixels);
+
+    f64 t2 = batch_time();
+    if (ok) {
+        char outPath[4096];
+        batch_output_path(outPath, sizeof(outPath), q->outDir, image->path);
+        ok = batch_write_tga(outPath, normals, w, h);
+        image->error = (ok) ? NULL : "can't write the tga";
+    }
+    free(normals);
+    f64 t3 = batch_time();
+
+    if (sized || pixels) {
+        batch_release(q, memory);
+    }
+
+    image->w = w;
+    image->h = h;
+    image->failed = !ok;
+    image->decodeTime = t1 - t0;
+    image->processTime = t2 - t1;
+    image->encodeTime = t3 - t2;
+}
+
+//NOTE: images are handed out from a shared counter, a thread that finishes early
+//just takes the next one so big and small images balance out. A broken image only
+//fails itself, the worker reports it and goes on with the next one.
+internal void*
+batch_worker(void* data)
+{
+    batch_queue* q = (batch_queue*)data;
+    for (;;) {
+        pthread_mutex_lock(&q->mutex);
+        i32 index = q->nextImage++;
+        pthread_mutex_unlock(&q->mutex);
+        if (index >= q->imageCount) {
+            break;
+        }
+
+        batch_image* image = &q->images[index];
+        batch_process(q, image);
+
+        f64 total = image->decodeTime + image->processTime + image->encodeTime;
+        if (image->failed) {
+            fprintf(stderr, "failed: %s, %s\n", image->path, image->error);
+        } else {
+            f64 mpix = (f64)image->w * image->h / 1e6;
+            printf("%s %dx%d decode %.1fms process %.1fms encode %.1fms, %.1f MPix/s\n", image->path, image->w, image->h,
+                image->decodeTime * 1e3, image->processTime * 1e3, image->encodeTime * 1e3, mpix / total);
+        }
+    }
+    return NULL;
+}
+
+internal void
+batch_add_image(batch_queue* q, i32* capacity, const char* path)
+{
+    if (q->imageCount == *capacity) {
+        *capacity = (*capacity) ? *capacity * 2 : 64;
+        q->images = (batch_image*)realloc(q->images, *capacity * sizeof(batch_image));
+        assert(q->images);
+    }
+    batch_image image = { 0 };
+    image.path = strdup(path);
+    q->images[q->imageCount++] = image;
+}
+
+internal b32
+batch_is_image(const char* name)
+{
+    static const char* extensions[] = { ".png", ".tga", ".jpg", ".jpeg", ".bmp", ".psd", ".gif", ".pgm", ".ppm" };
+    const char* ext = strrchr(name, '.');
+    if (ext) {
+        for (i32 i = 0; i < (i32)(sizeof(extensions) / sizeof(extensions[0])); ++i) {
+            if (strcasecmp(ext, extensions[i]) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+internal b32
+batch_collect(batch_queue* q, const char* input)
+{
+    i32 capacity = 0;
+    struct stat st;
+    if (stat(input, &st) != 0) {
+        return false;
+    }
+
+    char path[4096];
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(input);
+        if (!dir) {
+            return false;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir))) {
+            if (batch_is_image(entry->d_name)) {
+                snprintf(path, sizeof(path), "%s/%s", input, entry->d_name);
+                batch_add_image(q, &capacity, path);
+            }
+        }
+        closedir(dir);
+    } else {
+        FILE* f = fopen(input, "r");
+        if (!f) {
+            return false;
+        }
+        while (fgets(path, sizeof(path), f)) {
+            size_t length = strcspn(path, "\r\n");
+            path[length] = '\0';
+            if (length > 0 && path[0] != '#') {
+                batch_add_image(q, &capacity, path);
+            }
+        }
+        fclose(f);
+    }
+    return true;
+}
+
+internal void
+batch_usage(void)
+{
+    fprintf(stderr, "usage: sinm_batch [-s scale] [-b blur radius] [-g none|lightness|average|luminance] [-d sobel|sobel5|scharr|prewitt|central] [-y] [-j threads] [-m megabytes] "
+                    "<manifest | directory> <output directory>\n"
+                    "       sinm_batch [options] -r <width>x<height> <raw input> <raw output>\n");
+}
+
+internal int
+batch_raw(batch_queue* q, const char* inPath, const char* outPath, i32 w, i32 h, i32 threadCount)
+{
+    size_t size = (size_t)w * h * sizeof(u32);
+    int inFile = open(inPath, O_RDONLY);
+    if (inFile < 0) {
+        fprintf(stderr, "can't read %s\n", inPath);
+        return 1;
+    }
+    struct stat inStat;
+    if (fstat(inFile, &inStat) != 0 || (size_t)inStat.st_size != size) {
+        fprintf(stderr, "%s is not %dx%d 32 bit pixels\n", inPath, w, h);
+        close(inFile);
+        return 1;
+    }
+    int outFile = open(outPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (outFile < 0 || ftruncate(outFile, (off_t)size) != 0) {
+        fprintf(stderr, "can't write %s\n", outPath);
+        close(inFile);
+        if (outFile >= 0) {
+            close(outFile);
+        }
+        return 1;
+    }
+
+    int result = 2;
+    void* in = mmap(NULL, size, PROT_READ, MAP_SHARED, inFile, 0);
+    void* out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, outFile, 0);
+    if (in != MAP_FAILED && out != MAP_FAILED) {
+        f64 start = batch_time();
+        if (sinm_normal_map_tiled_ex((const u32*)in, (u32*)out, w, h, q->scale, q->blurRadius, q->greyscaleType, q->flipY, q->memoryBudget, threadCount, &q->options)) {
+            result = 0;
+        } else {
+            fprintf(stderr, "memory budget too small for %s\n", inPath);
+        }
+        f64 elapsed = batch_time() - start;
+        if (result == 0) {
+            printf("%s: %.1f MPix in %.2fs, %.1f MPix/s\n", inPath, (f64)w * h / 1e6, elapsed, (f64)w * h / 1e6 / elapsed);
+        }
+    } else {
+        fprintf(stderr, "can't map %s or %s\n", inPath, outPath);
+    }
+
+    if (in != MAP_FAILED) {
+        munmap(in, size);
+    }
+    if (out != MAP_FAILED) {
+        munmap(out, size);
+    }
+    close(inFile);
+    close(outFile);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    batch_queue q = { 0 };
+    q.scale = 2.0f;
+    q.blurRadius = 1.0f;
+    q.greyscaleType = sinm_greyscale_average;
+    q.memoryBudget = (size_t)1024 << 20;
+    q.options = sinm_default_options();
+    i32 threadCount = 0;
+    i32 rawW = 0;
+    i32 rawH = 0;
+
+    static const char* greyscaleNames[] = { "none", "lightness", "average", "luminance" };
+    static const char* gradientNames[] = { "sobel", "sobel5", "scharr", "prewitt", "central" };
+    i32 arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        char option = argv[arg][1];
+        if (option == 'y') {
+            q.flipY = true;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            batch_usage();
+            return 1;
+        }
+        const char* value = argv[++arg];
+        if (option == 's') {
+            q.scale = (f32)atof(value);
+        } else if (option == 'b') {
+            q.blurRadius = (f32)atof(value);
+        } else if (option == 'j') {
+            threadCount = atoi(value);
+        } else if (option == 'm') {
+            q.memoryBudget = (size_t)atoi(value) << 20;
+        } else if (option == 'r') {
+            if (sscanf(value, "%dx%d", &rawW, &rawH) != 2 || rawW <= 0 || rawH <= 0) {
+                batch_usage();
+                return 1;
+            }
+        } else if (option == 'g') {
+            q.greyscaleType = sinm_greyscale_count;
+            for (i32 i = 0; i < sinm_greyscale_count; ++i) {
+                if (strcmp(value, greyscaleNames[i]) == 0) {
+                    q.greyscaleType = (sinm_greyscale_type)i;
+                }
+            }
+            if (q.greyscaleType == sinm_greyscale_count) {
+                batch_usage();
+                return 1;
+            }
+        } else if (option == 'd') {
+            q.options.gradient = sinm_gradient_count;
+            for (i32 i = 0; i < sinm_gradient_count; ++i) {
+                if (strcmp(value, gradientNames[i]) == 0) {
+                    q.options.gradient = (sinm_gradient_type)i;
+                }
+            }
+            if (q.options.gradient == sinm_gradient_count) {
+                batch_usage();
+                return 1;
+            }
+        } else {
+            batch_usage();
+            return 1;
+        }
+    }
+    if (argc - arg != 2) {
+        batch_usage();
+        return 1;
+    }
+
+    if (rawW > 0) {
+        int result = batch_raw(&q, argv[arg], argv[arg + 1], rawW, rawH, threadCount);
+        sinm_shutdown();
+        return result;
+    }
+
+    q.outDir = argv[arg + 1];
+    mkdir(q.outDir, 0755);
+    if (!batch_collect(&q, argv[arg])) {
+        fprintf(stderr, "can't read %s\n", argv[arg]);
+        return 1;
+    }
+    if (q.imageCount == 0) {
+        fprintf(stderr, "no images in %s\n", argv[arg]);
+        return 1;
+    }
+
+    if (threadCount <= 0) {
+        threadCount = (i32)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    threadCount = (threadCount < q.imageCount) ? threadCount : q.imageCount;
+    threadCount = (threadCount > 1) ? threadCount : 1;
+    pthread_mutex_init(&q.mutex, NULL);
+    pthread_cond_init(&q.memoryFreed, NULL);
+
+    f64 start = batch_time();
+    pthread_t* threads = (pthread_t*)malloc(threadCount * sizeof(pthread_t));
+    i32 started = 0;
+    for (; started < threadCount - 1; ++started) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &q) != 0) {
+            break;
+        }
+    }
+    batch_worker(&q);
+    for (i32 i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    f64 elapsed = batch_time() - start;
+
+    f64 pixels = 0;
+    f64 processTime = 0;
+    i32 failed = 0;
+    for (i32 i = 0; i < q.imageCount; ++i) {
+        if (q.images[i].failed) {
+            ++failed;
+        } else {
+            pixels += (f64)q.images[i].w * q.images[i].h;
+            processTime += q.images[i].processTime;
+        }
+        free(q.images[i].path);
+    }
+
+    printf("%d images(%d failed) %.1f MPix in %.2fs on %d threads: %.1f MPix/s overall, %.1f MPix/s per thread in the pipeline\n",
+        q.imageCount, failed, pixels / 1e6, elapsed, threadCount, pixels / 1e6 / elapsed,
+        (processTime > 0) ? pixels / 1e6 / processTime : 0.0);
+
+    free(threads);
+    free(q.images);
+    sinm_shutdown();
+    return (failed) ? 2 : 0;
+}
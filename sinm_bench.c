@@ -0,0 +1,160 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+
+#define SI_NORMALMAP_STATIC
+#define SI_NORMALMAP_IMPLEMENTATION
+#include "si_normalmap.h"
+
+//NOTE: benchmarks sinm_normal_map_buffer_ex on a generated image. Every instruction set
+//the cpu supports runs with sinm_pipeline_float and sinm_pipeline_fixed16, the best of
+//BENCH_RUNS runs is printed along with how many channels differ from the first
+//configuration, which should always be 0.
+//
+//usage: sinm_bench [options] [<width>x<height>(default 2048x2048)]
+//  -s scale      normal strength(default 2)
+//  -b radius     blur radius(default 1)
+//  -d filter     sobel, sobel5, scharr, prewitt or central(default sobel)
+//  -j threads    worker threads, 0 is one per core(default 1)
+//
+//./build.sh bench builds it with optimizations and runs it.
+
+#define BENCH_RUNS 10
+
+internal f64
+bench_time(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+internal void
+bench_usage(void)
+{
+    fprintf(stderr, "usage: sinm_bench [-s scale] [-b blur radius] [-d sobel|sobel5|scharr|prewitt|central] [-j threads] [<width>x<height>]\n");
+}
+
+//NOTE: the image is a fixed pattern so runs on different machines see the same data:
+//smooth slopes for the blur and gradients plus some hashed noise for the branches.
+internal void
+bench_fill(u32* in, i32 w, i32 h)
+{
+    for (i32 y = 0; y < h; ++y) {
+        for (i32 x = 0; x < w; ++x) {
+            u32 noise = ((u32)x * 73856093u ^ (u32)y * 19349663u) >> 27;
+            u32 v = ((x * 3 + y * 5) / 4 + (x ^ y) / 16 + noise) & 255;
+            in[(size_t)y * w + x] = 0xFF000000u | (v << 16) | (v << 8) | v;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static const char* levelNames[] = { "auto", "sse4.1", "avx2", "avx512" };
+    static const char* pipelineNames[] = { "float", "fixed16" };
+    static const char* gradientNames[] = { "sobel", "sobel5", "scharr", "prewitt", "central" };
+
+    f32 scale = 2.0f;
+    f32 blurRadius = 1.0f;
+    i32 threadCount = 1;
+    i32 w = 2048;
+    i32 h = 2048;
+    sinm_options options = sinm_default_options();
+
+    i32 arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (arg + 1 >= argc) {
+            bench_usage();
+            return 1;
+        }
+        char option = argv[arg][1];
+        const char* value = argv[++arg];
+        if (option == 's') {
+            scale = (f32)atof(value);
+        } else if (option == 'b') {
+            blurRadius = (f32)atof(value);
+        } else if (option == 'j') {
+            threadCount = atoi(value);
+        } else if (option == 'd') {
+            options.gradient = sinm_gradient_count;
+            for (i32 i = 0; i < sinm_gradient_count; ++i) {
+                if (strcmp(value, gradientNames[i]) == 0) {
+                    options.gradient = (sinm_gradient_type)i;
+                }
+            }
+            if (options.gradient == sinm_gradient_count) {
+                bench_usage();
+                return 1;
+            }
+        } else {
+            bench_usage();
+            return 1;
+        }
+    }
+    if (arg < argc && (arg + 1 != argc || sscanf(argv[arg], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)) {
+        bench_usage();
+        return 1;
+    }
+
+    size_t count = (size_t)w * h;
+    u32* in = (u32*)malloc(count * sizeof(u32));
+    u32* out = (u32*)malloc(count * sizeof(u32));
+    u32* first = (u32*)malloc(count * sizeof(u32));
+    if (!in || !out || !first) {
+        fprintf(stderr, "can't allocate %dx%d images\n", w, h);
+        free(in);
+        free(out);
+        free(first);
+        return 1;
+    }
+    bench_fill(in, w, h);
+    printf("%dx%d, %d threads, best of %d runs\n", w, h, threadCount, BENCH_RUNS);
+
+    int result = 0;
+    b32 haveFirst = false;
+    for (i32 level = sinm_simd_sse41; level <= sinm_simd_avx512 && result == 0; ++level) {
+        if (sinm_set_simd_level((sinm_simd_level)level) != level) {
+            printf("%-7s not supported\n", levelNames[level]);
+            continue;
+        }
+        for (i32 pipeline = 0; pipeline < sinm_pipeline_count && result == 0; ++pipeline) {
+            options.pipeline = (sinm_pipeline_type)pipeline;
+            u32* dst = (haveFirst) ? out : first;
+            f64 best = 0;
+            for (i32 run = 0; run < BENCH_RUNS && result == 0; ++run) {
+                f64 start = bench_time();
+                if (!sinm_normal_map_buffer_ex(in, dst, w, h, scale, blurRadius, sinm_greyscale_average, false, threadCount, &options)) {
+                    fprintf(stderr, "out of memory\n");
+                    result = 1;
+                }
+                f64 elapsed = bench_time() - start;
+                best = (run == 0 || elapsed < best) ? elapsed : best;
+            }
+            if (result) {
+                break;
+            }
+
+            size_t differ = 0;
+            if (haveFirst) {
+                for (size_t i = 0; i < count; ++i) {
+                    for (i32 c = 0; c < 24; c += 8) {
+                        differ += ((out[i] >> c) & 255) != ((first[i] >> c) & 255);
+                    }
+                }
+            }
+            haveFirst = true;
+            printf("%-7s %-7s %8.2fms %8.1f MPix/s, %zu channels differ\n", levelNames[level], pipelineNames[pipeline], best * 1e3, count / 1e6 / best, differ);
+        }
+    }
+
+    free(in);
+    free(out);
+    free(first);
+    return result;
+}
@@ -42,6 +42,50 @@ key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
     }
 }
 
+typedef size_t bc_size_proc(int32_t w, int32_t h);
+typedef void bc_compress_proc(const uint32_t* in, uint8_t* out, int32_t w, int32_t h, sinm_bc_quality quality, int32_t threadCount);
+
+//Builds the mip chain of "img", block compresses every level and uploads it
+static GLuint
+create_compressed_chain(const u32* img, i32 w, i32 h, sinm_mip_type type, bc_size_proc* size, bc_compress_proc* compress, GLenum format)
+{
+    u32* mips = (u32*)malloc(sinm_mip_chain_size(w, h) * sizeof(u32));
+    assert(mips);
+    sinm_mip_chain_mt(img, mips, w, h, type, 0.0f, 0);
+
+    i32 levels = sinm_mip_count(w, h);
+    size_t chainSize = 0;
+    for (i32 i = 0, lw = w, lh = h; i < levels; ++i, lw = (lw > 1) ? lw / 2 : 1, lh = (lh > 1) ? lh / 2 : 1) {
+        chainSize += size(lw, lh);
+    }
+    u8* chain = (u8*)malloc(chainSize);
+    assert(chain);
+    u32* level = mips;
+    u8* blocks = chain;
+    for (i32 i = 0, lw = w, lh = h; i < levels; ++i, lw = (lw > 1) ? lw / 2 : 1, lh = (lh > 1) ? lh / 2 : 1) {
+        compress(level, blocks, lw, lh, sinm_bc_balanced, 0);
+        level += lw * lh;
+        blocks += size(lw, lh);
+    }
+    GLuint result = create_texture_compressed(chain, w, h, levels, format);
+    free(chain);
+    free(mips);
+    return result;
+}
+
+//Same mip chain as create_compressed_chain but uploaded uncompressed, for formats the
+//driver doesn't support
+static GLuint
+create_uncompressed_chain(const u32* img, i32 w, i32 h, sinm_mip_type type, b32 useLinearColor)
+{
+    u32* mips = (u32*)malloc(sinm_mip_chain_size(w, h) * sizeof(u32));
+    assert(mips);
+    sinm_mip_chain_mt(img, mips, w, h, type, 0.0f, 0);
+    GLuint result = create_texture_mips(mips, w, h, sinm_mip_count(w, h), useLinearColor);
+    free(mips);
+    return result;
+}
+
 int main(void)
 {
     struct program_memory mem = { 0 };
@@ -79,14 +123,22 @@ int main(void)
     i32 w, h, c;
     u32* diffuseImg = (u32*)stbi_load("textures/broken_tiles_01.tga", &w, &h, &c, 4);
     assert(diffuseImg);
-    GLuint diffuse = create_texture(diffuseImg, w, h, false);
+    //NOTE: albedo goes up as BC1(8:1), the ssbump map as BC7(4:1, it needs all three
+    //channels at full precision) and the normal map as BC5(4:1). BC5 and BC7 are core
+    //but sRGB BC1 needs two extensions, without them the albedo stays uncompressed.
+    GLuint diffuse;
+    if (GLAD_GL_EXT_texture_compression_s3tc && GLAD_GL_EXT_texture_sRGB) {
+        diffuse = create_compressed_chain(diffuseImg, w, h, sinm_mip_color_map, sinm_bc1_size, sinm_bc1_compress_mt, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT);
+    } else {
+        diffuse = create_uncompressed_chain(diffuseImg, w, h, sinm_mip_color_map, false);
+    }
 
     u32* ssbumpImg = (u32*)stbi_load("textures/ssbump.png", &w, &h, NULL, 4);
     // u32 *ssbumpImg  = (u32 *)stbi_load("textures/face-ssbump.png", &w, &h, NULL, 4);
     assert(ssbumpImg);
     u32* normalImg = sinm_normal_map(ssbumpImg, w, h, 80.0f, 2.0f, sinm_greyscale_average, false);
-    GLuint ssbump = create_texture(ssbumpImg, w, h, true);
-    GLuint normal = create_texture(normalImg, w, h, true);
+    GLuint ssbump = create_compressed_chain(ssbumpImg, w, h, sinm_mip_ssbump_map, sinm_bc7_size, sinm_bc7_compress_mt, GL_COMPRESSED_RGBA_BPTC_UNORM);
+    GLuint normal = create_compressed_chain(normalImg, w, h, sinm_mip_normal_map, sinm_bc5_size, sinm_bc5_compress_mt, GL_COMPRESSED_RG_RGTC2);
 
     // clang-format off
     vertex_data quad[4] = {
@@ -206,6 +258,7 @@ int main(void)
         glfwPollEvents();
     }
 
+    sinm_shutdown();
     glfwTerminate();
     si_free_primary_buffer(&mem.buffer);
 }
\ No newline at end of file